@@ -28,7 +28,7 @@ set LINK_ONLY=0
 set SOURCE_DIRECTORIES=src test
 set INCLUDE_DIRECTORIES=include test
 set LIBRARY_DIRECTORIES=libraries/libasio-main libraries/cereal-master
-set LIBRARY_NAMES=ws2_32 wsock32 pthread
+set LIBRARY_NAMES=ws2_32 wsock32 bcrypt pthread
 
 
 :: Additional Compiler Flags And Configuration Settings
@@ -0,0 +1,60 @@
+#pragma once
+
+/*
+    Dream Admission controls how fast new connections are accepted
+    Each source address has its own token bucket and all sources share a global bucket
+    Sources over their budget are rejected - connections over the global budget are deferred until tokens refill
+*/
+
+#include "ip_tools.h"
+#include "dream_bucket.h"
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+namespace dream {
+
+struct AdmissionConfig {
+    double rate, burst; // global connections per second and burst size - rate <= 0 disables the limit
+    double source_rate, source_burst; // connections per second and burst size for one source address
+    size_t max_deferred; // connections waiting for a global token before new ones are rejected
+};
+
+struct AdmissionStats {
+    uint64_t admitted, deferred, rejected;
+};
+
+class Admission {
+    AdmissionConfig config;
+
+    std::mutex mtx;
+    TokenBucket global;
+    std::map<asio::ip::address, TokenBucket> sources;
+
+    std::atomic<uint64_t> admitted, deferred, rejected;
+
+    void prune(); // forget sources that are back to a full bucket - requires mtx
+
+public:
+    enum Result {
+        ADMIT, DEFER, REJECT
+    };
+
+    static constexpr size_t MAX_TRACKED_SOURCES = 4096; // sources tracked before idle entries are pruned
+
+    Admission(const AdmissionConfig& config);
+
+    void configure(const AdmissionConfig& config); // replaces the limits and resets every bucket
+
+    Result check(const asio::ip::address& source, size_t deferred_count); // classify a new connection
+    bool retry(); // take a global token for a deferred connection
+    void reject(size_t count = 1) { rejected += count; } // deferred connections were dropped before they got a token
+
+    std::chrono::milliseconds retry_delay(); // time until the next global token
+
+    AdmissionStats get_stats() const { return AdmissionStats { admitted, deferred, rejected }; }
+};
+
+}
@@ -0,0 +1,294 @@
+#pragma once
+
+/*
+    Dream Bitpack is a bit level archive for game state - the same serialize() that feeds cereal can feed it
+    Fields are packed back to back without byte alignment - a bool is one bit and strings and containers carry varint lengths
+    Plain integers and floats keep their full width - annotate them to shrink them:
+        ar(bits::range(health, 0, 100)); // 7 bits
+        ar(bits::quantize(yaw, -180.0f, 180.0f, 0.1f)); // 12 bits - 0.1 degree steps
+        ar(bits::varint(score)); // 1 byte for small values - zigzag for signed types
+        ar(bits::quantize_array(positions, -4096.0f, 4096.0f, 0.01f)); // float arrays are quantized by the simd kernels
+    Annotations fall back to their plain value with any other archive - a type can be written with both
+
+    Types that declare  static constexpr bool bit_packed = true;  use this archive for Blob state, snapshots and Connection messages
+*/
+
+#include <bit>
+#include <cmath>
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <type_traits>
+
+namespace dream {
+
+template<typename T>
+concept BitPacked = requires { requires bool(T::bit_packed); };
+
+namespace bits {
+
+    struct Exception : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    // batch kernels - vectorized when available - values are clamped to [min, max] and NaN maps to min
+    void quantize(const float* in, uint32_t* out, size_t count, float min, float max, float precision);
+    void dequantize(const uint32_t* in, float* out, size_t count, float min, float max, float precision);
+
+    const char* backend(); // name of the compiled kernel backend - avx2, sse2 or scalar
+
+    inline uint64_t steps(double min, double max, double precision) { return uint64_t(std::ceil((max - min) / precision)); }
+
+    class Writer {
+        std::string out;
+        uint64_t acc; // bits not yet flushed - lowest bit first
+        unsigned fill;
+
+    public:
+        Writer(): acc(0), fill(0) {}
+
+        void write(uint64_t value, unsigned count); // the low count bits of value - count <= 64
+        void write_varint(uint64_t value);
+        void write_bytes(const char* data, size_t length);
+        void write_packed(const uint32_t* values, size_t count, unsigned width); // count values of width bits each
+
+        size_t bit_size() const { return out.size() * 8 + fill; }
+        std::string finish(); // pads the last byte with zero bits
+    };
+
+    class Reader {
+        const uint8_t* data;
+        size_t length;
+        size_t bit;
+
+    public:
+        Reader(const char* data, size_t length): data(reinterpret_cast<const uint8_t*>(data)), length(length), bit(0) {}
+
+        uint64_t read(unsigned count); // throws bits::Exception past the end
+        uint64_t read_varint();
+        void read_bytes(char* out, size_t count);
+        void read_packed(uint32_t* values, size_t count, unsigned width);
+
+        size_t remaining_bits() const { return length * 8 - bit; }
+    };
+
+    // annotations - they reference the annotated field
+
+    template<typename T>
+    struct Ranged {
+        static_assert(std::is_integral_v<T>, "bits::range takes integers - use bits::quantize for floats");
+
+        T& value;
+        const T min, max;
+
+        unsigned width() const { return unsigned(std::bit_width(uint64_t(int64_t(max) - int64_t(min)))); }
+
+        void bit_save(Writer& w) const { w.write(uint64_t(int64_t(std::clamp(value, min, max)) - int64_t(min)), width()); }
+        void bit_load(Reader& r) { value = T(std::min<int64_t>(int64_t(min) + int64_t(r.read(width())), int64_t(max))); }
+
+        template<typename Archive>
+        void serialize(Archive& ar) { ar(value); }
+    };
+
+    template<typename F>
+    struct Quantized {
+        static_assert(std::is_floating_point_v<F>, "bits::quantize takes floats - use bits::range for integers");
+
+        F& value;
+        const F min, max, precision;
+
+        unsigned width() const { return unsigned(std::bit_width(steps(min, max, precision))); }
+
+        void bit_save(Writer& w) const {
+            double v = std::isnan(value) ? min : std::clamp<double>(value, min, max);
+            w.write(std::min(uint64_t(std::llround((v - min) / precision)), steps(min, max, precision)), width());
+        }
+        void bit_load(Reader& r) { value = F(std::min<double>(min + double(r.read(width())) * precision, max)); }
+
+        template<typename Archive>
+        void serialize(Archive& ar) { ar(value); }
+    };
+
+    template<typename T>
+    struct Varint {
+        static_assert(std::is_integral_v<T>, "bits::varint takes integers");
+
+        T& value;
+
+        void bit_save(Writer& w) const {
+            if constexpr(std::is_signed_v<T>) w.write_varint((uint64_t(value) << 1) ^ uint64_t(int64_t(value) >> 63)); // zigzag
+            else w.write_varint(uint64_t(value));
+        }
+        void bit_load(Reader& r) {
+            uint64_t raw = r.read_varint();
+            if constexpr(std::is_signed_v<T>) value = T(int64_t(raw >> 1) ^ -int64_t(raw & 1));
+            else value = T(raw);
+        }
+
+        template<typename Archive>
+        void serialize(Archive& ar) { ar(value); }
+    };
+
+    template<typename Container>
+    struct QuantizedArray {
+        Container& values; // contiguous floats - std::vector<float> carries its length, fixed size arrays do not
+        const float min, max, precision;
+
+        static constexpr bool resizable = requires(Container& c) { c.resize(size_t(0)); };
+
+        unsigned width() const {
+            unsigned bits = unsigned(std::bit_width(steps(min, max, precision)));
+            if(bits > 31) throw Exception("bits: quantized arrays take at most 31 bits per value - the precision is too fine");
+            return bits;
+        }
+
+        void bit_save(Writer& w) const {
+            if constexpr(resizable) w.write_varint(values.size());
+            std::vector<uint32_t> q(values.size());
+            quantize(values.data(), q.data(), q.size(), min, max, precision);
+            w.write_packed(q.data(), q.size(), width());
+        }
+        void bit_load(Reader& r) {
+            if constexpr(resizable){
+                uint64_t count = r.read_varint();
+                if(count * width() > r.remaining_bits()) throw Exception("bits: array longer than the data");
+                values.resize(size_t(count));
+            }
+            std::vector<uint32_t> q(values.size());
+            r.read_packed(q.data(), q.size(), width());
+            dequantize(q.data(), values.data(), q.size(), min, max, precision);
+        }
+
+        template<typename Archive>
+        void serialize(Archive& ar) { ar(values); }
+    };
+
+    template<typename T>
+    Ranged<T> range(T& value, T min, T max) { return { value, min, max }; }
+
+    template<typename F>
+    Quantized<F> quantize(F& value, F min, F max, F precision) { return { value, min, max, precision }; }
+
+    template<typename T>
+    Varint<T> varint(T& value) { return { value }; }
+
+    template<typename Container>
+    QuantizedArray<Container> quantize_array(Container& values, float min, float max, float precision) {
+        static_assert(std::is_same_v<std::remove_cv_t<typename Container::value_type>, float>, "bits::quantize_array takes contiguous floats");
+        return { values, min, max, precision };
+    }
+
+}
+
+class BitOutputArchive {
+    bits::Writer writer;
+
+public:
+    template<typename... Ts>
+    BitOutputArchive& operator()(Ts&&... values) {
+        (save(values), ...);
+        return *this;
+    }
+
+    std::string finish() { return writer.finish(); }
+    size_t bit_size() const { return writer.bit_size(); }
+
+private:
+    template<typename T>
+    void save(const T& value) {
+        if constexpr(requires { value.bit_save(writer); }){
+            value.bit_save(writer);
+        } else if constexpr(std::is_same_v<T, bool>){
+            writer.write(value, 1);
+        } else if constexpr(std::is_enum_v<T>){
+            writer.write(uint64_t(value), sizeof(T) * 8);
+        } else if constexpr(std::is_integral_v<T>){
+            writer.write(uint64_t(value), sizeof(T) * 8);
+        } else if constexpr(std::is_same_v<T, float>){
+            writer.write(std::bit_cast<uint32_t>(value), 32);
+        } else if constexpr(std::is_same_v<T, double>){
+            writer.write(std::bit_cast<uint64_t>(value), 64);
+        } else if constexpr(std::is_same_v<T, std::string>){
+            writer.write_varint(value.size());
+            writer.write_bytes(value.data(), value.size());
+        } else if constexpr(requires { value.size(); value.begin(); value.end(); }){
+            writer.write_varint(value.size());
+            for(const auto& element : value) save(element);
+        } else {
+            const_cast<T&>(value).serialize(*this); // serialize() is not const in the cereal convention
+        }
+    }
+};
+
+class BitInputArchive {
+    bits::Reader reader;
+
+public:
+    BitInputArchive(const std::string& data): reader(data.data(), data.size()) {}
+    BitInputArchive(const char* data, size_t length): reader(data, length) {}
+
+    template<typename... Ts>
+    BitInputArchive& operator()(Ts&&... values) {
+        (load(values), ...);
+        return *this;
+    }
+
+private:
+    template<typename T>
+    void load(T& value) {
+        if constexpr(requires { value.bit_load(reader); }){
+            value.bit_load(reader);
+        } else if constexpr(std::is_same_v<T, bool>){
+            value = reader.read(1) != 0;
+        } else if constexpr(std::is_enum_v<T> || std::is_integral_v<T>){
+            value = T(reader.read(sizeof(T) * 8));
+        } else if constexpr(std::is_same_v<T, float>){
+            value = std::bit_cast<float>(uint32_t(reader.read(32)));
+        } else if constexpr(std::is_same_v<T, double>){
+            value = std::bit_cast<double>(reader.read(64));
+        } else if constexpr(std::is_same_v<T, std::string>){
+            uint64_t length = reader.read_varint();
+            if(length * 8 > reader.remaining_bits()) throw bits::Exception("bits: string longer than the data");
+            value.resize(size_t(length));
+            reader.read_bytes(value.data(), value.size());
+        } else if constexpr(requires { value.resize(size_t(0)); value.begin(); value.end(); }){
+            uint64_t count = reader.read_varint();
+            if(count > reader.remaining_bits()) throw bits::Exception("bits: container longer than the data"); // every element takes at least one bit
+            value.resize(size_t(count));
+            for(auto& element : value) load(element);
+        } else if constexpr(requires { value.size(); value.begin(); value.end(); }){
+            if(reader.read_varint() != value.size()) throw bits::Exception("bits: fixed size container does not match");
+            for(auto& element : value) load(element);
+        } else {
+            value.serialize(*this);
+        }
+    }
+};
+
+namespace bits {
+
+    template<typename T>
+    std::string pack(const T& value) {
+        BitOutputArchive archive;
+        archive(value);
+        return archive.finish();
+    }
+
+    template<typename T>
+    bool unpack(const std::string& data, T& value) {
+        try {
+            BitInputArchive archive(data);
+            archive(value);
+        } catch(const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+}
+
+}
@@ -5,11 +5,15 @@
 */
 
 #include "dream_blobbox.h"
+#include "dream_delta.h"
+#include "dream_bitpack.h"
+#include "lib_cereal.h"
 
 #include <variant>
 #include <optional>
 #include <memory>
 #include <string>
+#include <sstream>
 
 namespace dream {
 
@@ -18,10 +22,12 @@ class Blob : public BasicBlob {
     BlobBox* blob_box;
     std::optional<uint64_t> id; // id or orhpan
     T* data;
+    delta::Baseline baseline; // delta synchronization state
 
     void set_dirty(bool dirty=true) {
         if(!blob_box) return;
         blob_box->dirty = dirty;
+        if(dirty) ++blob_box->version;
     }
 
     Blob(): blob_box(nullptr), id({}), data(nullptr) {}
@@ -36,6 +42,34 @@ public:
         data = nullptr;
     }
 
+    std::string serialize_state() const override {
+        if constexpr(BitPacked<T>) {
+            return bits::pack(*data);
+        } else {
+            std::stringstream output;
+            {
+                cereal::BinaryOutputArchive archive(output);
+                archive(*data);
+            } // enforce flush
+            return output.str();
+        }
+    }
+
+    bool deserialize_state(const std::string& bytes) override {
+        if constexpr(BitPacked<T>) {
+            return bits::unpack(bytes, *data);
+        } else {
+            try {
+                std::stringstream input(bytes);
+                cereal::BinaryInputArchive archive(input);
+                archive(*data);
+            } catch(const cereal::Exception&) {
+                return false;
+            }
+            return true;
+        }
+    }
+
     T* operator->() { // direct access to object for reading / writing // this will make the blob dirty
         set_dirty();
         return data;
@@ -46,6 +80,14 @@ public:
         return *data;
     }
 
+    const T* operator->() const { // read only access - does not make the blob dirty
+        return data;
+    }
+
+    const T& operator*() const { // read only reference access - does not make the blob dirty
+        return *data;
+    }
+
     Block* get_owner() {
         if(!blob_box) return nullptr;
         return blob_box->owner;
@@ -59,6 +101,37 @@ public:
         return data != nullptr;
     }
 
+    bool is_dirty() const {
+        return blob_box && blob_box->dirty;
+    }
+
+    // delta synchronization - only the bytes that changed since the last acknowledged state are encoded
+
+    std::string encode_delta() { // sender - encode the current state against the acknowledged baseline and clear the dirty flag
+        set_dirty(false);
+        return baseline.encode(serialize_state());
+    }
+
+    uint32_t delta_sequence() const { // sequence of the last encoded / applied delta
+        return baseline.get_sequence();
+    }
+
+    void acknowledge_delta(uint32_t sequence) { // sender - the receiver applied this sequence so it becomes the new baseline
+        baseline.acknowledge(sequence);
+    }
+
+    bool apply_delta(const std::string& delta, uint32_t& sequence) { // receiver - returns the sequence to acknowledge - on failure a sequence of 0 still has to be acknowledged
+        std::string state;
+        if(!baseline.decode(delta, state, sequence)) return false;
+        if(!deserialize_state(state)) return false;
+        if(blob_box) ++blob_box->version; // remote changes must reach the next published snapshot
+        return true;
+    }
+
+    void reset_delta() { // forget every baseline - the next delta will contain the full state
+        baseline.reset();
+    }
+
     template<class Archive>
     void serialize(Archive& archive) {
         archive(id.value(), *data);
@@ -1,16 +1,25 @@
 #pragma once
 
+#include <string>
+#include <cstdint>
+
 namespace dream {
 
 // forward declarator
 class Block;
 
-class BasicBlob {}; // common inheritance for all template types
+class BasicBlob { // common inheritance for all template types
+public:
+    virtual ~BasicBlob() = default;
+    virtual std::string serialize_state() const = 0; // serialized bytes of the blob data
+    virtual bool deserialize_state(const std::string& bytes) = 0; // overwrite the blob data - false on corrupt bytes
+};
 
 struct BlobBox {
     BasicBlob* ptr;
     Block* owner;
     bool dirty, read_only;
+    uint64_t version; // bumped on every write access - used to skip unchanged blobs when publishing snapshots
 };
 
 }
\ No newline at end of file
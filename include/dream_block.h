@@ -2,8 +2,13 @@
 
 #include "dream_blobbox.h"
 #include "dream_blob.h"
+#include "dream_snapshot.h"
+#include "dream_store.h"
+#include "dream_externs.h"
 
 #include <map>
+#include <atomic>
+#include <memory>
 #include <algorithm>
 #include <exception>
 
@@ -14,6 +19,10 @@ class Block {
     std::map<uint64_t, BlobBox> blobs;
     std::map<std::string, uint64_t> names;
 
+    uint64_t tick;
+    std::atomic<std::shared_ptr<const BlockSnapshot>> published; // latest immutable view for other threads
+    std::unique_ptr<BlockStore> store; // persistence - every publish is journaled while a store is open
+
 public:
     Block();
     ~Block();
@@ -21,18 +30,35 @@ public:
     Block(const Block&) = delete;
     Block& operator=(const Block&) = delete;
 
-    void clear(); // completely clear all blob data within this block
+    void clear(); // completely clear all blob data within this block - an open store keeps the data restorable
+
+    // persistence - blobs inserted with a persisted name get their stored state back - see dream_store.h
+    bool open_store(const StoreConfig& config); // the block must be empty
+    void close_store(); // publish and commit the current state
+    BlockStore* get_store() { return store.get(); }
+
+    // snapshots - publish() must be called from the thread that mutates the block, snapshot() is safe from any thread
+    std::shared_ptr<const BlockSnapshot> publish(); // capture an immutable view at the end of a tick
+    std::shared_ptr<const BlockSnapshot> snapshot() const { return published.load(std::memory_order_acquire); } // latest published view or nullptr
 
     template<typename T, typename... Args>
     Blob<T>& insert_blob(const std::string& name, Args&&... args) {
+        uint64_t id = cid;
+        std::string state;
+        const bool restored = store && store->take(name, id, state); // keeps the persisted id
 
-        blobs.insert( std::make_pair(cid, BlobBox { nullptr, this, false, false }) );
-        BlobBox& box = blobs.at(cid);
-        Blob<T>* blob = new Blob<T>(&box, cid, std::forward<Args>(args)...);
+        blobs.insert( std::make_pair(id, BlobBox { nullptr, this, false, false, 1 }) );
+        BlobBox& box = blobs.at(id);
+        Blob<T>* blob = new Blob<T>(&box, id, std::forward<Args>(args)...);
         box.ptr = blob;
-        names.insert_or_assign(name, cid);
+        names.insert_or_assign(name, id);
+
+        if(restored && !blob->deserialize_state(state)){
+            DLOG_WARN << "blob " << name << " could not be restored\n";
+            ++box.version; // journal the constructed state instead
+        }
 
-        ++cid;
+        if(!restored) ++cid;
 
         return *blob;
     }
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <algorithm>
+
+namespace dream {
+
+/*
+    Token Bucket rate limiter - refills rate tokens per second up to burst tokens
+    A rate of zero or less disables the limit
+    This object is not thread safe - the owner provides locking
+*/
+class TokenBucket {
+    using steady = std::chrono::steady_clock;
+
+    double rate, burst, tokens;
+    steady::time_point last;
+
+public:
+    TokenBucket(double rate = 0, double burst = 0): rate(rate), burst(burst), tokens(burst), last(steady::now()) {}
+
+    bool limited() const { return rate > 0; }
+
+    void refill(steady::time_point now = steady::now()) {
+        if(!limited()) return;
+        double elapsed = std::chrono::duration<double>(now - last).count();
+        tokens = std::min(burst, tokens + elapsed * rate);
+        last = now;
+    }
+
+    bool try_take(double count = 1.0, steady::time_point now = steady::now()) { // take tokens if they are available
+        if(!limited()) return true;
+        refill(now);
+        if(tokens < count) return false;
+        tokens -= count;
+        return true;
+    }
+
+    void take(double count, steady::time_point now = steady::now()) { // take tokens even if this puts the bucket in debt
+        if(!limited()) return;
+        refill(now);
+        tokens -= count;
+    }
+
+    double available() const { return tokens; }
+
+    bool full(steady::time_point now = steady::now()) { refill(now); return !limited() || tokens >= burst; }
+
+    std::chrono::milliseconds time_until(double count = 1.0) const { // estimated wait until count tokens are available
+        if(!limited() || tokens >= count) return std::chrono::milliseconds(0);
+        return std::chrono::milliseconds(int64_t((count - tokens) / rate * 1000.0) + 1);
+    }
+};
+
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+/*
+    Dream Capture records the frames a Socket reads and writes so production traffic can be replayed offline
+    Frames are copied into a bounded buffer on the socket thread and written by a background thread - when the writer
+    falls behind, frames are dropped and counted instead of slowing the sockets down
+
+    File layout:
+        header: "DRMCAP1\0"
+        frame:  u64 time (ns since capture start), u64 connection id, u8 direction, u32 length, serialized command bytes
+
+    Dream Replay loads a capture and feeds the inbound frames back - over loopback into a running Server with one Client
+    per captured connection, or straight into the command decoder - at the captured pace or as fast as possible
+*/
+
+#include "dream_command.h"
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <condition_variable>
+
+namespace dream {
+
+struct CaptureStats {
+    uint64_t frames, bytes; // written to the file
+    uint64_t dropped; // frames lost because the buffer was full
+};
+
+class Capture {
+public:
+    enum Direction : uint8_t {
+        INBOUND, OUTBOUND
+    };
+
+    static constexpr size_t DEFAULT_BUFFER = 1024 * 1024 * 8; // bytes waiting for the writer before frames are dropped
+
+    Capture();
+    ~Capture();
+
+    Capture(const Capture&) = delete;
+    Capture& operator=(const Capture&) = delete;
+
+    bool start(const std::string& path, size_t buffer_limit = DEFAULT_BUFFER);
+    void stop(); // write what is buffered and close the file
+
+    bool is_active() const { return active.load(std::memory_order_relaxed); }
+    void record(uint64_t connection, Direction direction, std::string_view frame); // called by sockets - cheap no-op while inactive
+
+    CaptureStats get_stats();
+
+private:
+    std::atomic_bool active;
+    std::chrono::steady_clock::time_point started;
+
+    std::mutex lock;
+    std::condition_variable signal;
+    std::string buffer; // encoded frames waiting for the writer
+    size_t buffer_limit;
+    bool stopping;
+    CaptureStats stats;
+
+    std::FILE* file;
+    std::thread writer;
+
+    void writer_loop();
+};
+
+struct CaptureFrame {
+    uint64_t time; // ns since capture start
+    uint64_t connection;
+    Capture::Direction direction;
+    std::string data; // serialized command
+};
+
+struct ReplayStats {
+    uint64_t frames, bytes;
+    uint64_t failed; // frames that could not be decoded or sent
+    double seconds;
+};
+
+class Replay {
+    std::vector<CaptureFrame> frames;
+
+public:
+    enum Pace : uint8_t {
+        ORIGINAL, // keep the captured gaps between frames - scaled by speed
+        FAST // as fast as possible
+    };
+
+    bool open(const std::string& path); // load a capture - a truncated tail is ignored
+
+    const std::vector<CaptureFrame>& get_frames() const { return frames; }
+
+    static bool decode(const CaptureFrame& frame, Command& cmd); // same decoding as Socket
+
+    // decode inbound frames on this thread - handler(connection, command)
+    ReplayStats replay_decode(const std::function<void(uint64_t, Command&)>& handler, Pace pace = FAST, double speed = 1.0);
+
+    // one Client per captured connection sends its inbound frames to a server - returns once every client flushed
+    // the captured pace is kept by each client's timer wheel - gaps are rounded to its resolution
+    ReplayStats replay_loopback(short port, const std::string& ip = "127.0.0.1", Pace pace = ORIGINAL, double speed = 1.0);
+};
+
+}
@@ -1,54 +1,129 @@
 #pragma once
 #include "dream_server.h"
+#include "dream_connector.h"
+#include "dream_runtime.h"
+
+#include <future>
 
 namespace dream {
 
 
 class Client {
-    asio::io_context ctx;
-    asio::io_context::work idle;
-    
+    ClientRuntime* shared; // nullptr for a standalone client
+    std::unique_ptr<IoWorker> own_worker; // standalone io thread
+    IoWorker* worker; // io context and timers of this client - owned by the shared runtime or by this client
+    std::atomic<uint64_t> runtime_id; // attachment to the shared runtime - zero while detached
+
     ServerHeader header;
     uint64_t cur_uuid;
     std::unique_ptr<Socket> server;
+    std::vector<std::unique_ptr<Socket>> retired; // lost or replaced connections - released on the io thread once their handlers ran
+    std::mutex expired_lock;
+    std::vector<std::unique_ptr<Socket>> expired; // retired connections a SocketRef still pins - freed by a later runtime pass
+    SendLimits send_limits;
+    ProtocolConfig protocol;
+    ConnectConfig connect_config;
+    IoBackend io_backend;
+
+    std::string host;
+    short port;
+    std::string name;
+    std::shared_ptr<Connector> connecting; // connect or reconnect in flight
+    std::shared_ptr<RingConnector> connecting_local; // start_local in flight
+    std::atomic<uint64_t> connect_attempt; // the latest start - results of cancelled attempts do not touch the runtime
 
     Block blobdata;
+    Capture capture;
+    RpcMethods methods; // rpc handlers the server may call
 
-    std::thread ctx_handle, runtime_handle;
+    std::thread runtime_handle;
     std::atomic_bool runtime_running;
 
-    Clock ping_timeout;
+    Drain drainer; // graceful stop in progress - see drain
+    std::atomic_bool close_requested; // stop_client from a hook of the update - closed once the update returned
 
     void start_context_handle();
+    void close_client(); // stop the runtime and release the connection - stop_client and the end of a drain
 
     void start_runtime();
     void stop_runtime();
-
-    std::unique_ptr<Socket> generate_server_object(asio::ip::tcp::socket&& soc, uint64_t id, const std::string& name);
+    void release_sockets(); // destroy the sockets on their io thread once their handlers ran - waits unless called on the io thread
+    bool on_io_thread() const { return std::this_thread::get_id() == worker->handle.get_id(); }
+    void retire(std::unique_ptr<Socket>&& socket); // keep a dead connection until its aborted handlers ran - requires runtime_mtx
+    void expire(std::unique_ptr<Socket> socket); // its handlers ran - freed now unless a SocketRef pins it
+    std::shared_lock<std::shared_mutex> runtime_lock(); // shared runtime_mtx - deferred when the update of this client on this thread holds it
+    std::future<RpcResult> call_server(RpcMethod method, const std::string& payload); // RPC_DISCONNECTED without a server
+
+    std::unique_ptr<Socket> generate_server_object(SocketStream&& soc, uint64_t id, const std::string& name);
+    void attach_server(SocketStream&& soc); // first connection of start_client_async or start_local_async - io context thread
+    void register_server_hooks(Socket& socket);
+    void start_resume(); // reconnect in the background while the session is detached - runtime thread
+    bool resume_session(asio::ip::tcp::socket&& soc); // present the session token on a new connection - io context thread
 
     // client runtime
     std::shared_mutex runtime_mtx; // runtime mutex
-    void client_runtime();
+    bool client_runtime(); // returns true while connecting or authorizing - the shared runtime checks again shortly
+    bool update_server(); // one update of the connection - requires that client_runtime marked this client as updating
 
 public:
     Client();
+    Client(ClientRuntime& runtime); // share the io threads and the scheduler of the runtime - see dream_runtime.h
     virtual ~Client();
 
+    // waits for start_client_async - fails right away from a hook or an io callback of this client, which would wait for itself
     bool start_client(short port, const std::string& ip = "", const std::string& name = "NoName");
+    // resolves and connects in the background - the future and the callback report whether the connection was made
+    std::future<bool> start_client_async(short port, const std::string& ip = "", const std::string& name = "NoName", std::function<void(bool)> on_result = nullptr);
+    // connect to a server on the same host through Server::start_local - commands go through shared memory rings
+    // sessions are not resumed over rings - a lost local connection is a disconnect
+    bool start_local(const std::string& path, const std::string& name = "NoName"); // waits like start_client
+    std::future<bool> start_local_async(const std::string& path, const std::string& name = "NoName", std::function<void(bool)> on_result = nullptr);
+    // immediate - queued commands are dropped and a running drain ends right away
+    // safe from hooks and io callbacks: from a hook the client closes once the update returned, from the io thread
+    // the sockets are released asynchronously and a standalone io thread keeps running until the next stop from another thread
     void stop_client();
 
+    // graceful stop - writes out what is queued for the server and disconnects once it was written or the deadline passed
+    // the future is true when nothing was lost - call from a thread of your own, not from a hook
+    std::future<bool> drain(std::chrono::milliseconds deadline);
+
     bool is_running() { return runtime_running; }
     bool is_connected() { return server && server->is_valid() && server->is_authorized(); }
 
     Block& get_block() { return blobdata; }
+    TimerWheel& get_timers() { return worker->timers; } // user timers run on the io context thread
 
     Connection get_socket();
 
-    void send_string(const std::string& data);
+    SendStatus send_string(const std::string& data);
+    SendStatus send_command(Command&& cmd);
+    size_t get_queued_bytes(); // commands waiting to be sent plus data in flight - zero without a connection
+    bool wait_for_flush(); // block until everything queued was written - false if the connection was lost first
+
+    // the server calls it with Connection::call - the handler runs on the runtime thread and must not block on a call of its own - see RpcHandler
+    bool register_method(RpcMethod method, RpcHandler handler) { return methods.add(method, std::move(handler)); }
+    void unregister_method(RpcMethod method) { methods.remove(method); }
+
+    // join or leave an open topic of the server - see dream_topic.h - RPC_DISCONNECTED without a connection
+    std::future<RpcResult> subscribe(const std::string& topic) { return call_server(TOPIC_SUBSCRIBE, topic); }
+    std::future<RpcResult> unsubscribe(const std::string& topic) { return call_server(TOPIC_UNSUBSCRIBE, topic); }
+
+    // ask the server which shard owns a key - the payload is the "ip:port" to connect to - see split_endpoint in dream_shard.h
+    std::future<RpcResult> locate_shard(const std::string& key) { return call_server(SHARD_LOCATE, key); }
+
+    bool start_capture(const std::string& path, size_t buffer = Capture::DEFAULT_BUFFER) { return capture.start(path, buffer); } // see dream_capture.h
+    void stop_capture() { capture.stop(); }
+    CaptureStats get_capture_stats() { return capture.get_stats(); }
+
+    void set_send_limits(const SendLimits& limits) { send_limits = limits; } // applied by the next start_client
+    void set_connect_config(const ConnectConfig& config) { connect_config = config; } // retries and backoff of the next start_client - see dream_connector.h
+    void set_io_backend(IoBackend backend) { io_backend = backend; } // io_uring or the reactor for the next tcp connection - see dream_uring.h
+    void set_max_frame(uint32_t bytes) { protocol.max_frame = bytes; } // largest frame accepted from the server - negotiated down to the server limit
 
     std::function<void(Connection&)> on_connect; // this is temporary just so we can quickly get a callback
 
     friend class Connection;
+    friend class ClientRuntime;
 };
 
 
@@ -5,7 +5,7 @@
 
 namespace dream {
 
-typedef std::chrono::time_point<std::chrono::system_clock> timepoint;
+typedef std::chrono::time_point<std::chrono::steady_clock> timepoint; // monotonic - wall clock adjustments never affect timing
 
 class Clock {
     timepoint start;
@@ -14,7 +14,7 @@ public:
     virtual ~Clock()=default;
     double getSeconds() const;
     double getMilliseconds() const;
-    inline void restart() { start = std::chrono::system_clock::now(); }
+    inline void restart() { start = std::chrono::steady_clock::now(); }
     void setSeconds(double time);
     void setMilliseconds(double time);
     
@@ -11,7 +11,11 @@ class Command {
 public:
 
     enum Type : uint16_t {
-        NILL, PING, RESPONSE, TEST, STRING, INHERITED
+        NILL, PING, RESPONSE, TEST, STRING, INHERITED,
+
+        // internal commands live at the top of the range - user types numbered from INHERITED keep their wire values
+        RESERVED = 0xFF00,
+        SESSION = RESERVED, RESUME, RESUMED, RPC_REQUEST, RPC_RESPONSE, REQUEST, REPLY
     } type;
 
     std::string data;
@@ -1,16 +1,32 @@
 #pragma once
 
 #include "libdream.h"
+#include "dream_socket.h"
+#include "dream_message.h"
 #include <string>
 #include <any>
+#include <memory>
 #include <cassert>
+#include <future>
 #include <variant>
 #include <functional>
 #include <shared_mutex>
+#include <unordered_map>
 
 /*
     A Connection is a friendly object that directly references the connected socket object within the server
     This object can be passed around freely as it is only a reference - the reference is thread safe
+
+    send, receive and request are asio async operations - they take any completion token and default to use_awaitable
+        asio::co_spawn(conn.get_executor(), [conn]() mutable -> asio::awaitable<void> {
+            std::string hello = co_await conn.receive<std::string>();
+            co_await conn.send(std::string("welcome"));
+        }, asio::detached);
+    Completions run on the handler's executor - or on the socket's io thread - never inside the library's locks
+    A pending operation fails with connection_aborted once the connection is gone for good - a resumable session keeps it waiting
+    Once a connection used send or receive, commands that arrive with no receive waiting are kept, up to 1 MiB - past that the
+    oldest are dropped and the next receive fails with no_buffer_space so the caller knows it missed messages
+    request correlates its answer by id - the peer takes the request with receive_request and answers it with reply
 */
 
 namespace dream {
@@ -55,13 +71,184 @@ public:
     bool is_connected();
     std::string get_name();
 
-    void send_string(const std::string& str);
+    ReceiveStats get_receive_stats(); // inbound throttle statistics - all zero when disconnected
+
+    SendStatus send_string(const std::string& str);
     uint64_t register_global_hook(UserGlobalHookCallback cb);
 
+    asio::io_context::executor_type get_executor(); // io thread of this connection
+
+    // call a method of the peer - the callback runs once with the answer, a failure or RPC_TIMED_OUT - see dream_rpc.h
+    uint64_t call(RpcMethod method, const std::string& payload, RpcCallback callback, std::chrono::milliseconds timeout = RpcCalls::DEFAULT_TIMEOUT);
+    std::future<RpcResult> call(RpcMethod method, const std::string& payload, std::chrono::milliseconds timeout = RpcCalls::DEFAULT_TIMEOUT);
+
+    // completes with an empty error code once the message was written - connection_aborted when it was dropped or the connection is gone
+    template<typename T, typename CompletionToken = asio::use_awaitable_t<>>
+    auto send(const T& message, CompletionToken&& token = {}) {
+        return asio::async_initiate<CompletionToken, void(asio::error_code)>(
+            [copy = *this, cmd = MessageTraits<T>::encode(message)](auto handler) mutable {
+                SharedHandler<decltype(handler)> done(std::move(handler), copy.get_executor());
+
+                SocketRef client = copy.get_socket();
+                if(!client.valid()){
+                    done.complete(asio::error_code(asio::error::not_connected));
+                    return;
+                }
+                client->hold_inbox(); // the answer may arrive before the caller gets to receive it
+                client->send_command(std::move(cmd), [done](bool flushed){
+                    done.complete(flushed ? asio::error_code() : asio::error_code(asio::error::connection_aborted));
+                });
+            }, token);
+    }
+
+    // completes with the next message of type MessageTraits<T>::type - invalid_argument when it did not decode
+    template<typename T, typename CompletionToken = asio::use_awaitable_t<>>
+    auto receive(CompletionToken&& token = {}) {
+        return asio::async_initiate<CompletionToken, void(asio::error_code, T)>(
+            [copy = *this](auto handler) mutable {
+                SharedHandler<decltype(handler)> done(std::move(handler), copy.get_executor());
+
+                SocketRef client = copy.get_socket();
+                if(!client.valid()){
+                    done.complete(asio::error_code(asio::error::not_connected), T {});
+                    return;
+                }
+                client->receive_command(MessageTraits<T>::type, [done](ReceiveStatus status, Command&& cmd, uint64_t){
+                    complete_receive<T>(done, status, cmd);
+                });
+            }, token);
+    }
+
+    // completes with the next request of type MessageTraits<T>::type a peer sent with request - answer it with reply
+    template<typename T, typename CompletionToken = asio::use_awaitable_t<>>
+    auto receive_request(CompletionToken&& token = {}) {
+        return asio::async_initiate<CompletionToken, void(asio::error_code, Incoming<T>)>(
+            [copy = *this](auto handler) mutable {
+                SharedHandler<decltype(handler)> done(std::move(handler), copy.get_executor());
+
+                SocketRef client = copy.get_socket();
+                if(!client.valid()){
+                    done.complete(asio::error_code(asio::error::not_connected), Incoming<T> {});
+                    return;
+                }
+                client->receive_command(MessageTraits<T>::type, [done](ReceiveStatus status, Command&& cmd, uint64_t request){
+                    Incoming<T> incoming { request, T {} };
+                    const asio::error_code error = decode_receive(status, cmd, incoming.message);
+                    done.complete(error, std::move(incoming));
+                }, true);
+            }, token);
+    }
+
+    // answer a request taken with receive_request - completes like send
+    template<typename T, typename CompletionToken = asio::use_awaitable_t<>>
+    auto reply(uint64_t request, const T& message, CompletionToken&& token = {}) {
+        return send(MessageEnvelope::wrap(Command::REPLY, request, MessageTraits<T>::encode(message)), std::forward<CompletionToken>(token));
+    }
+
+    // send the request and complete with the peer's reply to exactly this request - see receive_request
+    template<typename Response, typename Request, typename CompletionToken = asio::use_awaitable_t<>>
+    auto request(const Request& message, CompletionToken&& token = {}) {
+        return asio::async_initiate<CompletionToken, void(asio::error_code, Response)>(
+            [copy = *this, cmd = MessageTraits<Request>::encode(message)](auto handler) mutable {
+                SharedHandler<decltype(handler)> done(std::move(handler), copy.get_executor());
+
+                SocketRef client = copy.get_socket();
+                if(!client.valid()){
+                    done.complete(asio::error_code(asio::error::not_connected), Response {});
+                    return;
+                }
+
+                auto finished = std::make_shared<std::atomic_bool>(false); // the failed send and the receiver race to complete
+                const uint64_t id = client->receive_reply([done, finished](ReceiveStatus status, Command&& cmd, uint64_t){
+                    if(!finished->exchange(true)) complete_receive<Response>(done, status, cmd);
+                });
+
+                client->send_command(MessageEnvelope::wrap(Command::REQUEST, id, cmd), [copy, done, finished, id](bool flushed) mutable {
+                    if(flushed || finished->exchange(true)) return;
+                    done.complete(asio::error_code(asio::error::connection_aborted), Response {});
+
+                    asio::post(copy.get_executor(), [copy, id]() mutable { // the socket's locks may be held here
+                        SocketRef client = copy.get_socket();
+                        if(client.valid()) client->cancel_receive(id);
+                    });
+                });
+            }, token);
+    }
+
 private:
     std::variant<Server*, Client*> controller;
     
     SocketRef get_socket();
+
+    friend class RpcReply;
+
+    // a copyable wrapper for the move-only handlers asio hands to an initiation - it completes on the handler's own executor
+    template<typename Handler>
+    class SharedHandler {
+        std::shared_ptr<Handler> handler;
+        asio::io_context::executor_type fallback;
+    public:
+        SharedHandler(Handler&& handler, const asio::io_context::executor_type& fallback): handler(std::make_shared<Handler>(std::move(handler))), fallback(fallback) {}
+
+        template<typename... Args>
+        void complete(Args&&... args) const {
+            auto executor = asio::get_associated_executor(*handler, fallback);
+            asio::post(executor, [handler = handler, ...args = std::forward<Args>(args)]() mutable {
+                (*handler)(std::move(args)...);
+            });
+        }
+    };
+
+    template<typename T>
+    static asio::error_code decode_receive(ReceiveStatus status, const Command& cmd, T& message) {
+        switch(status){
+            case RECEIVE_CLOSED: return asio::error::connection_aborted;
+            case RECEIVE_DROPPED: return asio::error::no_buffer_space;
+            default: return MessageTraits<T>::decode(cmd, message) ? asio::error_code() : asio::error_code(asio::error::invalid_argument);
+        }
+    }
+
+    template<typename T, typename Handler>
+    static void complete_receive(const SharedHandler<Handler>& done, ReceiveStatus status, const Command& cmd) {
+        T message {};
+        const asio::error_code error = decode_receive(status, cmd, message);
+        done.complete(error, std::move(message));
+    }
+};
+
+// answers one request - copyable so the handler can answer later from any thread - only the first answer is sent
+class RpcReply {
+    Connection caller;
+    uint64_t id;
+    std::shared_ptr<std::atomic_bool> answered;
+
+public:
+    RpcReply(const Connection& caller, uint64_t id): caller(caller), id(id), answered(std::make_shared<std::atomic_bool>(false)) {}
+
+    bool operator()(const std::string& payload = {}) { return answer(RPC_OK, payload); }
+    bool fail(const std::string& reason = {}) { return answer(RPC_FAILED, reason); }
+    bool is_answered() const { return *answered; }
+
+private:
+    bool answer(RpcStatus status, const std::string& payload);
+
+    friend class RpcMethods;
+};
+
+// handlers run on the runtime thread while it holds the connection's incoming command lock - never wait on a call().get()
+// inside one, the answer is read by that same thread - use the callback form of call or answer through reply later
+using RpcHandler = std::function<void(Connection& caller, const std::string& payload, RpcReply reply)>;
+
+// one handler per method shared by every connection of a Server or Client
+class RpcMethods {
+    std::shared_mutex lock;
+    std::unordered_map<uint32_t, RpcHandler> handlers;
+
+public:
+    bool add(RpcMethod method, RpcHandler handler); // false if the method - or a name with the same hash - is taken
+    void remove(RpcMethod method);
+
+    void dispatch(Connection& caller, const Command& cmd); // RPC_REQUEST - a handler that throws fails the call
 };
 
 
@@ -0,0 +1,78 @@
+#pragma once
+
+/*
+    Dream Connector opens an outgoing connection without blocking the caller
+    The host is resolved for IPv4 and IPv6 - the addresses are tried happy eyeballs style, alternating families, each one
+    getting a short head start before the next is raced against it. The first connection wins and the rest are closed
+
+    A round that fails or times out is retried after an exponential backoff - every delay runs on the TimerWheel
+    The handler runs once on the io context thread - with the connected socket or the last error
+*/
+
+#include "dream_timer.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace dream {
+
+struct ConnectConfig {
+    uint32_t attempts; // rounds of resolve and connect before giving up - 0 retries until cancelled
+    std::chrono::milliseconds backoff, max_backoff; // delay before the second round - doubled each round up to max_backoff
+    std::chrono::milliseconds stagger; // head start of one address before the next one is tried
+    std::chrono::milliseconds timeout; // a round that takes longer than this fails
+};
+
+static const ConnectConfig DEFAULT_CONNECT_CONFIG { 10, std::chrono::milliseconds(50), std::chrono::milliseconds(2000),
+                                                    std::chrono::milliseconds(250), std::chrono::milliseconds(3000) };
+
+class Connector : public std::enable_shared_from_this<Connector> {
+public:
+    using Handler = std::function<void(const asio::error_code&, asio::ip::tcp::socket&&)>;
+
+    Connector(asio::io_context& ctx, TimerWheel& timers, const ConnectConfig& config = DEFAULT_CONNECT_CONFIG);
+    ~Connector();
+
+    Connector(const Connector&) = delete;
+    Connector& operator=(const Connector&) = delete;
+
+    void start(const std::string& host, short port, Handler handler); // once per connector
+    void cancel(); // any thread - the handler runs with operation_aborted unless it already ran
+
+    bool is_done() const { return done; }
+
+private:
+    asio::io_context& ctx;
+    TimerWheel& timers;
+    const ConnectConfig config;
+
+    asio::ip::tcp::resolver resolver;
+    std::string host, service;
+    Handler handler;
+
+    // io context thread only
+    std::vector<asio::ip::tcp::endpoint> candidates; // interleaved by family
+    std::vector<std::unique_ptr<asio::ip::tcp::socket>> attempts;
+    size_t next_candidate, pending;
+    uint32_t round;
+    uint64_t generation; // bumped whenever the attempts are dropped - stale completions compare against it
+    TimerId stagger_timer, round_timer, backoff_timer;
+    asio::error_code last_error;
+
+    std::atomic_bool done;
+
+    void resolve();
+    void on_resolved(const asio::ip::tcp::resolver::results_type& results);
+    void try_next();
+    void on_connect(size_t index, const asio::error_code& error);
+    void round_failed(const asio::error_code& error);
+    void drop_attempts();
+    void finish(const asio::error_code& error, asio::ip::tcp::socket&& soc);
+};
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+/*
+    Dream Delta is a byte level delta codec used to synchronize blobs against a known baseline
+    The current bytes are xor'd against the baseline and the result is zero-run encoded:
+        [varint length] { [varint zero skip] [varint literal length] [literal bytes...] }...
+    A one field change to a large blob encodes to a handful of bytes
+*/
+
+#include <string>
+#include <deque>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+namespace dream {
+
+namespace delta {
+
+    constexpr size_t MIN_ZERO_RUN = 4; // zero runs shorter than this are cheaper to send as literal bytes
+    constexpr size_t MAX_LENGTH = 64 * 1024 * 1024; // largest state decode rebuilds - longer lengths are treated as corrupt data
+
+    void xor_bytes(char* out, const char* a, const char* b, size_t length); // out = a ^ b - vectorized when available
+    size_t count_zero(const char* data, size_t length); // number of leading zero bytes - vectorized when available
+    size_t find_zero(const char* data, size_t length); // index of the first zero byte or length - vectorized when available
+
+    void write_varint(std::string& out, uint64_t value);
+    bool read_varint(const char*& data, const char* end, uint64_t& value);
+
+    std::string encode(const std::string& baseline, const std::string& current); // encode current against baseline
+    bool decode(const std::string& baseline, const std::string& data, std::string& current); // rebuild current from baseline - false on corrupt data
+
+    const char* backend(); // name of the compiled kernel backend - avx2, sse2 or scalar
+
+    /*
+        Baseline tracks the sequenced states on either end of a delta stream
+        Each encoded delta is prefixed with [varint base sequence] [varint sequence] - base sequence 0 is the empty state
+        The sender only moves its baseline forward once the receiver acknowledges a sequence
+        The sender keeps its last MAX_HISTORY unacknowledged states - the receiver keeps the base plus the last MAX_HISTORY
+        applied states, so every state the sender can move its baseline to is still known on the receiver
+        Sequences wrap around (skipping 0) and are compared with serial arithmetic
+        A receiver missing the base state sets the sequence to 0 - acknowledging 0 makes the sender send a full state
+    */
+    class Baseline {
+        using State = std::pair<uint32_t, std::string>;
+
+        uint32_t sequence, base_sequence;
+        std::string base;
+        std::deque<State> history; // oldest first - sender: unacknowledged states - receiver: base and applied states
+
+        std::deque<State>::iterator find(uint32_t seq);
+
+    public:
+        static constexpr size_t MAX_HISTORY = 32; // unacknowledged states kept before the oldest is dropped
+
+        static bool is_newer(uint32_t seq, uint32_t than) { return int32_t(seq - than) > 0; } // serial arithmetic - survives the wrap
+
+        Baseline();
+
+        std::string encode(std::string&& current); // sender - encode current against the acknowledged baseline
+        void acknowledge(uint32_t seq); // sender - receiver has applied this sequence - 0 falls back to a full state
+        bool decode(const std::string& data, std::string& current, uint32_t& seq); // receiver - false on corrupt or stale data - seq is 0 if the base state is unknown
+
+        uint32_t get_sequence() const { return sequence; }
+        uint32_t get_base_sequence() const { return base_sequence; }
+
+        void reset();
+    };
+
+}
+
+}
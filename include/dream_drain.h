@@ -0,0 +1,46 @@
+#pragma once
+
+/*
+    Dream Drain waits for outgoing queues to empty before a server or client shuts down
+    The owner stops producing, hands every socket a handler from track and starts the drain - one thread sleeps until the
+    last handler ran, the deadline passed or abort was called, then runs the finish callback that closes everything and
+    completes the future. Nothing polls - the sockets report through Socket::when_flushed
+*/
+
+#include <mutex>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+namespace dream {
+
+class Drain {
+public:
+    Drain() = default;
+    ~Drain();
+
+    Drain(const Drain&) = delete;
+    Drain& operator=(const Drain&) = delete;
+
+    bool prepare(); // false while a drain is still running - call before track
+    std::function<void(bool flushed)> track(); // one more queue to wait for - the handler may run on any thread, also right away
+    std::future<bool> start(std::chrono::milliseconds deadline, std::function<void()> finish); // true if every tracked queue flushed in time
+    void abort(); // stop waiting - finish runs now and the future reports false unless everything flushed - never from within finish
+
+private:
+    struct State {
+        std::mutex lock;
+        std::condition_variable signal;
+        size_t pending = 0;
+        bool failed = false; // a queue was lost with its connection
+        bool aborted = false;
+    };
+
+    std::shared_ptr<State> state; // shared with the handlers - they can outlive the drain
+    std::thread handle;
+};
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+/*
+    Dream Handshake is the fixed size exchange that opens every connection - one round trip
+        client -> server  HELLO   access key, protocol version, oldest version understood, max frame size, capability bits
+        server -> client  WELCOME status, negotiated version, negotiated max frame size, negotiated capability bits
+    A HELLO with the wrong access key gets no answer at all - the connection just times out
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+namespace dream {
+
+enum Capability : uint32_t {
+    CAP_SESSION = 1 << 0, // session resumption - see dream_session.h
+    CAP_BATCHING = 1 << 1, // several commands per write
+    CAP_COMPRESSION = 1 << 2 // reserved - not supported by this build
+};
+
+struct ProtocolConfig {
+    uint32_t max_frame; // largest command frame this side accepts
+    uint32_t capabilities; // features this side supports
+};
+
+static const ProtocolConfig DEFAULT_PROTOCOL { 1024 * 1024 * 64, CAP_SESSION | CAP_BATCHING };
+
+struct Handshake {
+    enum Status : uint8_t {
+        ACCEPTED,
+        VERSION_MISMATCH
+    };
+
+    static constexpr uint16_t VERSION = 4; // version 1 was the bare access key - versions 2 and 3 numbered the session and rpc commands below INHERITED
+    static constexpr uint16_t MIN_VERSION = 4;
+
+    static constexpr size_t ACCESS_SIZE = 128;
+    static constexpr size_t HELLO_SIZE = ACCESS_SIZE + sizeof(uint16_t) * 2 + sizeof(uint32_t) * 2;
+    static constexpr size_t WELCOME_SIZE = sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t) * 2;
+
+    uint8_t status;
+    uint16_t version, min_version;
+    uint32_t max_frame, capabilities;
+
+    static Handshake offer(const ProtocolConfig& config) { return { ACCEPTED, VERSION, MIN_VERSION, config.max_frame, config.capabilities }; }
+
+    // server side - the answer to a HELLO
+    Handshake negotiate(const ProtocolConfig& config) const {
+        Handshake reply { ACCEPTED, std::min(version, VERSION), 0, std::min(max_frame, config.max_frame), capabilities & config.capabilities };
+        if(version < MIN_VERSION || min_version > VERSION) reply.status = VERSION_MISMATCH; // no version both sides understand
+        return reply;
+    }
+
+    void write_hello(char* out, const char* access) const {
+        std::memcpy(out, access, ACCESS_SIZE);
+        out += ACCESS_SIZE;
+        put(out, version);
+        put(out, min_version);
+        put(out, max_frame);
+        put(out, capabilities);
+    }
+
+    static bool read_hello(const char* in, const char* access, Handshake& hello) {
+        if(std::memcmp(in, access, ACCESS_SIZE)) return false;
+        in += ACCESS_SIZE;
+        hello.status = ACCEPTED;
+        get(in, hello.version);
+        get(in, hello.min_version);
+        get(in, hello.max_frame);
+        get(in, hello.capabilities);
+        return true;
+    }
+
+    void write_welcome(char* out) const {
+        put(out, status);
+        put(out, version);
+        put(out, max_frame);
+        put(out, capabilities);
+    }
+
+    static Handshake read_welcome(const char* in) {
+        Handshake welcome {};
+        get(in, welcome.status);
+        get(in, welcome.version);
+        get(in, welcome.max_frame);
+        get(in, welcome.capabilities);
+        return welcome;
+    }
+
+private:
+    template<typename T>
+    static void put(char*& out, T value) { std::memcpy(out, &value, sizeof(value)); out += sizeof(value); }
+
+    template<typename T>
+    static void get(const char*& in, T& value) { std::memcpy(&value, in, sizeof(value)); in += sizeof(value); }
+};
+
+}
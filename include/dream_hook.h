@@ -72,6 +72,16 @@ public:
     }
 
 protected:
+    void adopt_global_hooks(Hookable& other) { // take over the global hooks of another object - used when a session moves to a new socket
+        std::unique_lock<std::shared_mutex> lock_this(trigger_mtx, std::defer_lock);
+        std::unique_lock<std::shared_mutex> lock_other(other.trigger_mtx, std::defer_lock);
+
+        std::scoped_lock lock(lock_this, lock_other);
+
+        cb_global_hooks.merge(other.cb_global_hooks);
+        other.cb_global_hooks.clear();
+    }
+
     void trigger_hook(const std::string& hook_name, const std::any& data = {}) {
         std::shared_lock<std::shared_mutex> lock_trig(trigger_mtx, std::defer_lock);
         std::shared_lock<std::shared_mutex> lock_unreg(unregister_mtx, std::defer_lock);
@@ -0,0 +1,46 @@
+#pragma once
+
+/*
+    Dream Io Worker is one io_context with its own thread and timer wheel
+    Sockets and acceptors are bound to exactly one worker so their handlers never run concurrently
+*/
+
+#include "ip_tools.h"
+#include "dream_timer.h"
+
+#include <mutex>
+#include <memory>
+#include <thread>
+
+namespace dream {
+
+enum class IoBackend {
+    REACTOR, // asio's reactor - epoll on Linux
+    URING // io_uring on Linux - falls back to the reactor elsewhere, see dream_uring.h
+};
+
+class UringDriver;
+
+class IoWorker {
+    std::once_flag uring_once;
+    std::unique_ptr<UringDriver> uring; // created by the first get_uring
+
+public:
+    asio::io_context ctx;
+    asio::io_context::work idle;
+    TimerWheel timers;
+    std::thread handle;
+
+    IoWorker(); // out of line - UringDriver is incomplete here
+    ~IoWorker();
+
+    IoWorker(const IoWorker&) = delete;
+    IoWorker& operator=(const IoWorker&) = delete;
+
+    void start(); // run the io context on the worker thread
+    void stop(); // cancel every timer, stop the io context and join the worker thread
+
+    UringDriver* get_uring(); // any thread - nullptr when io_uring is not available
+};
+
+}
@@ -4,34 +4,141 @@
 #include <sstream>
 #include <fstream>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+/*
+    Dream Log is an asynchronous logger
+    Each statement is formatted into one record on the calling thread and pushed into a lock-free ring owned by that thread
+    A background writer thread drains the rings into the output stream, so I/O threads never wait on the stream
+    The writer parks on a condition variable while the rings are empty - it never polls
+
+    Records are formatted on the calling thread into a reused thread-local stream - the writer only moves finished strings
+    Deferring the formatting would mean capturing every streamed value by copy until the writer runs, and operator<< of
+    user types may depend on state that is gone or changed by then - formatting in place is the only faithful option,
+    and it costs one string per record while the stream I/O stays on the writer
+
+    A full ring blocks the producer by default so no record is lost - IoWorker threads switch themselves to DROP with
+    set_thread_overflow, so the network path never waits on the log writer
+
+    Leveled statements below DREAM_LOG_LEVEL compile out entirely:
+        DLOG_DEBUG << "value " << x << "\n";
+*/
+
+#ifndef DREAM_LOG_LEVEL
+    #ifdef DEBUGMODE
+    #define DREAM_LOG_LEVEL 1 // debug
+    #else
+    #define DREAM_LOG_LEVEL 2 // info
+    #endif
+#endif
+
+#define DREAM_LOG(level) if constexpr(dream::Log::level < dream::Log::Level(DREAM_LOG_LEVEL)) {} else dream::dlog.record(dream::Log::level)
+
+#define DLOG_TRACE DREAM_LOG(LEVEL_TRACE)
+#define DLOG_DEBUG DREAM_LOG(LEVEL_DEBUG)
+#define DLOG_INFO DREAM_LOG(LEVEL_INFO)
+#define DLOG_WARN DREAM_LOG(LEVEL_WARN)
+#define DLOG_ERROR DREAM_LOG(LEVEL_ERROR)
 
 namespace dream {
 
 class Log {
-    std::streambuf* _stream;
-    std::ostream output;
-    std::mutex mtx;
-
 public:
+    enum Level : uint8_t {
+        LEVEL_TRACE, LEVEL_DEBUG, LEVEL_INFO, LEVEL_WARN, LEVEL_ERROR, LEVEL_NONE
+    };
+
+    enum Overflow : uint8_t {
+        BLOCK, // producers wait for the writer when their ring is full - no record is ever lost - the default outside io threads
+        DROP // bounded memory - records are dropped and counted when the ring is full
+    };
+
+    static constexpr size_t RING_SIZE = 1024; // records per producer thread - must be a power of 2
+
+    // a single log statement - collects fragments and is queued as one record when the statement ends
+    class Record {
+        Log* log; // nullptr when this record is disabled
+        std::ostringstream* stream;
+        std::unique_ptr<std::ostringstream> nested; // used when a record is formatted while another is open on this thread
+
+    public:
+        Record(Log* log);
+        Record(Record&& o) noexcept;
+        ~Record();
+
+        Record(const Record&) = delete;
+        Record& operator=(const Record&) = delete;
+
+        template<typename T>
+        Record& operator<<(const T& d) {
+            if(log) *stream << d;
+            return *this;
+        }
+
+        Record& operator<<(std::ostream& (*manip)(std::ostream&)) {
+            if(log) *stream << manip;
+            return *this;
+        }
+    };
+
     Log();
     Log(const std::ostream& out);
+    ~Log();
+
+    Log(const Log&) = delete;
+    Log& operator=(const Log&) = delete;
+
+    Record record(Level level); // begin a new record at the given level
 
     template<typename T>
-    Log& operator<<(const T& d) {
-        std::scoped_lock lock(mtx);
-        if(_stream != nullptr) // this is 3x faster
-            output << d;
-        return *this;
+    Record operator<<(const T& d) { // unleveled statements are recorded as info
+        Record r = record(LEVEL_INFO);
+        r << d;
+        return r;
     }
 
-    Log& flush() {
-        output.flush();
-        return *this;
-    }
+    Log& flush(); // block until every queued record has been written
 
     Log& redirect(const std::ostream& stream);
 
+    void set_level(Level level) { runtime_level = level; } // runtime filter on top of DREAM_LOG_LEVEL
+    Level get_level() const { return runtime_level; }
+
+    void set_overflow(Overflow policy) { overflow = policy; }
+    static void set_thread_overflow(Overflow policy); // overrides the policy of every log for the calling thread
+    uint64_t get_dropped() const { return dropped; } // records dropped by the DROP overflow policy
+
+private:
+    struct Ring;
+
+    std::atomic<std::streambuf*> _stream;
+    std::ostream output; // only touched while holding write_mtx
+
+    const uint64_t instance; // identifies this log in the per-thread ring cache
+    std::atomic<Level> runtime_level;
+    std::atomic<Overflow> overflow;
+    std::atomic<uint64_t> dropped;
+
+    std::mutex ring_mtx; // protects ring registration
+    std::vector<std::shared_ptr<Ring>> rings;
+
+    std::mutex write_mtx; // single consumer of the rings
+    std::mutex wake_mtx;
+    std::condition_variable wake; // parks the writer and producers waiting on a full ring
+    size_t blocked; // producers waiting on a full ring - guarded by wake_mtx
+    std::atomic_bool running, sleeping;
+    std::thread writer;
+
+    Ring& local_ring(); // ring owned by the calling thread - registered on first use
+    void push(std::string&& line);
+    bool drain(); // write every queued record - returns false if nothing was written
+    bool pending(); // any ring holds a record
+    void writer_loop();
 };
 
 
-}
\ No newline at end of file
+}
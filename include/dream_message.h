@@ -0,0 +1,66 @@
+#pragma once
+
+/*
+    Dream Message maps a C++ type onto the Command that carries it over the wire - used by the awaitable Connection api
+    Any cereal serializable type goes out as an INHERITED command - strings go out raw as STRING commands and a Command
+    passes through untouched. Specialize MessageTraits to give one of your types its own command type
+        template<> struct dream::MessageTraits<Move> : dream::MessageTraits<Move, Command::Type(Command::INHERITED + 1)> {};
+    A receive<T> only matches commands of MessageTraits<T>::type - Command receives any user command
+
+    Connection::request wraps its message in a REQUEST envelope with a correlation id - the peer takes it with
+    receive_request and answers with reply, which comes back as a REPLY envelope for exactly that request
+*/
+
+#include "dream_command.h"
+#include "dream_session.h"
+
+#include <string>
+
+namespace dream {
+
+// REQUEST / REPLY body - the wrapped user command and the id the answer is matched on
+struct MessageEnvelope {
+    uint64_t id;
+    uint16_t type;
+    std::string data;
+
+    template<typename Archive>
+    void serialize(Archive& ar) {
+        ar(id, type, data);
+    }
+
+    static Command wrap(Command::Type envelope, uint64_t id, const Command& cmd) { return Session::encode(envelope, MessageEnvelope { id, uint16_t(cmd.type), cmd.data }); }
+};
+
+// a message that asks for an answer - see Connection::receive_request and Connection::reply
+template<typename T>
+struct Incoming {
+    uint64_t request; // pass to Connection::reply
+    T message;
+};
+
+template<typename T, Command::Type Type = Command::INHERITED>
+struct MessageTraits {
+    static constexpr Command::Type type = Type;
+
+    static Command encode(const T& message) { return Session::encode(type, message); }
+    static bool decode(const Command& cmd, T& message) { return Session::decode(cmd, message); }
+};
+
+template<>
+struct MessageTraits<std::string> {
+    static constexpr Command::Type type = Command::STRING;
+
+    static Command encode(const std::string& message) { return Command(type, message); }
+    static bool decode(const Command& cmd, std::string& message) { message = cmd.data; return true; }
+};
+
+template<>
+struct MessageTraits<Command> {
+    static constexpr Command::Type type = Command::NILL; // any user command
+
+    static Command encode(const Command& message) { return Command(message); }
+    static bool decode(const Command& cmd, Command& message) { message = cmd; return true; }
+};
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+/*
+    Dream Runtime Pool runs server socket updates on several threads with work stealing
+    Every thread owns a queue - ids pushed from outside the pool are spread round robin, ids pushed by a pool thread
+    stay on its own queue. A thread that runs dry steals half of the queue of another thread before it goes to sleep,
+    so one busy socket only ever holds up the thread that runs it
+
+    The pool only schedules ids - keeping a socket on one thread at a time is up to the task, see Socket::begin_update
+*/
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+namespace dream {
+
+struct RuntimePoolStats {
+    uint64_t tasks; // ids that were run
+    uint64_t steals; // ids moved from the queue of one thread to another by stealing
+};
+
+class RuntimePool {
+public:
+    using Task = std::function<void(uint64_t id)>;
+
+    RuntimePool();
+    ~RuntimePool();
+
+    RuntimePool(const RuntimePool&) = delete;
+    RuntimePool& operator=(const RuntimePool&) = delete;
+
+    void start(size_t threads, Task task);
+    void stop(); // joins the threads - ids that are still queued are dropped
+    bool is_running() const { return running; }
+
+    void push(uint64_t id); // any thread
+    void push(const std::vector<uint64_t>& ids); // one wake up for the batch
+
+    size_t get_threads() const { return queues.size(); }
+    RuntimePoolStats get_stats() const { return { tasks.load(), steals.load() }; }
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<uint64_t> ids;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    Task task;
+
+    std::atomic<size_t> next_queue; // round robin for pushes from outside the pool
+    std::atomic<size_t> pending; // queued ids over all queues
+    std::atomic<size_t> sleepers;
+    std::mutex sleep_lock;
+    std::condition_variable sleep_signal;
+    std::atomic_bool running;
+
+    std::atomic<uint64_t> tasks, steals;
+
+    void run(size_t index);
+    bool pop(size_t index, uint64_t& id);
+    bool steal(size_t index, uint64_t& id);
+    size_t queue_for_push(); // the calling pool thread's own queue or the next one round robin
+    void wake(size_t count);
+};
+
+}
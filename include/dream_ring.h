@@ -0,0 +1,147 @@
+#pragma once
+
+/*
+    Dream Ring is a transport for peers on the same host - bytes travel through shared memory instead of the tcp stack
+    A connection starts on a unix domain socket:
+        server -> client  u32 length, name of a shared memory segment the server created
+        client -> server  one byte once the segment is mapped - the server unlinks the name, the mapping stays in both processes
+    The segment holds a single producer single consumer byte ring per direction - the positions are lock-free atomics
+    After the handshake the unix socket only carries doorbells: a side that runs dry or full flags it in the ring header
+    and the other side writes one byte to wake it up. Busy peers move data without any syscall, idle peers pay one wake up
+
+    RingStream is used through SocketStream - a Socket frames its commands on it exactly like on tcp - see dream_stream.h
+    Shared memory rings need POSIX shm_open - elsewhere the listener and the connector report an error
+*/
+
+#include "dream_io.h"
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace dream {
+
+// a move-only completion handler - asio's composed operations hand over handlers that cannot be copied
+class RingCompletion {
+    struct Base {
+        virtual ~Base() = default;
+        virtual void call(const asio::error_code& error, size_t bytes) = 0;
+    };
+
+    template<typename Handler>
+    struct Impl : Base {
+        Handler handler;
+        Impl(Handler&& handler): handler(std::move(handler)) {}
+        void call(const asio::error_code& error, size_t bytes) override { handler(error, bytes); }
+    };
+
+    std::unique_ptr<Base> impl;
+
+public:
+    RingCompletion() = default;
+
+    template<typename Handler>
+    RingCompletion(Handler&& handler): impl(std::make_unique<Impl<std::decay_t<Handler>>>(std::forward<Handler>(handler))) {}
+
+    explicit operator bool() const { return bool(impl); }
+    void operator()(const asio::error_code& error, size_t bytes) { auto done = std::move(impl); done->call(error, bytes); }
+};
+
+class RingStream : public std::enable_shared_from_this<RingStream> {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 1024 * 1024; // bytes per direction - rounded up to a power of 2
+
+    struct Segment; // mapped shared memory - see dream_ring.cpp
+    struct Doorbell; // unix domain socket of the handshake
+
+    RingStream(asio::io_context& ctx, std::unique_ptr<Segment>&& segment, std::unique_ptr<Doorbell>&& doorbell, bool server_side);
+    ~RingStream();
+
+    RingStream(const RingStream&) = delete;
+    RingStream& operator=(const RingStream&) = delete;
+
+    void start(); // listen for doorbells - once the stream is shared
+
+    // at most one read and one write at a time - the handler runs on the io context like a socket completion
+    void read_some(asio::mutable_buffer buffer, RingCompletion&& handler);
+    void write_some(asio::const_buffer buffer, RingCompletion&& handler);
+
+    bool is_open() const { return open; }
+    void close(); // pending operations complete with operation_aborted - the peer reads what was written and then eof
+
+private:
+    asio::io_context& ctx;
+    std::unique_ptr<Segment> segment;
+    std::unique_ptr<Doorbell> doorbell;
+    const int in_ring, out_ring;
+
+    std::mutex lock; // the pending operations - the rings themselves need no lock
+    asio::mutable_buffer read_buffer;
+    RingCompletion pending_read;
+    asio::const_buffer write_buffer;
+    RingCompletion pending_write;
+
+    std::atomic_bool open, peer_closed;
+    char bell_in[64];
+
+    size_t try_read(asio::mutable_buffer buffer, bool& corrupt); // corrupt - the peer left positions no valid ring can hold
+    size_t try_write(asio::const_buffer buffer, bool& corrupt);
+    void shutdown(const asio::error_code& error); // with the lock held - pending operations complete with error
+    void ring(); // wake the peer
+    void wait_bell();
+    void wake(); // a doorbell rang or the peer left - retry the pending operations
+    bool complete_read(); // with the lock held - false when the operation waits for a doorbell
+    bool complete_write();
+    void post(RingCompletion&& handler, const asio::error_code& error, size_t bytes);
+};
+
+class SocketStream;
+
+// server side - accepts same host peers on a unix domain socket path
+class RingListener {
+public:
+    using Handler = std::function<void(IoWorker& worker, SocketStream&& stream)>;
+
+    RingListener();
+    ~RingListener();
+
+    RingListener(const RingListener&) = delete;
+    RingListener& operator=(const RingListener&) = delete;
+
+    // accepts on the worker of next_worker() - a stale socket file at the path is replaced, false while another listener owns it
+    bool start(IoWorker& worker, const std::string& path, size_t capacity, std::function<IoWorker&()> next_worker, Handler handler);
+    void stop(); // call from outside the io threads
+
+private:
+    struct Acceptor; // see dream_ring.cpp
+    std::shared_ptr<Acceptor> acceptor;
+};
+
+// client side - connects to a RingListener path without blocking the caller
+class RingConnector : public std::enable_shared_from_this<RingConnector> {
+public:
+    using Handler = std::function<void(const asio::error_code&, SocketStream&&)>;
+
+    RingConnector(asio::io_context& ctx, TimerWheel& timers);
+    ~RingConnector();
+
+    void start(const std::string& path, std::chrono::milliseconds timeout, Handler handler); // the handler runs once on the io context thread
+    void cancel();
+    bool is_done() const { return done; }
+
+private:
+    struct State; // see dream_ring.cpp
+    asio::io_context& ctx;
+    TimerWheel& timers;
+    std::unique_ptr<State> state;
+    TimerId timeout_timer;
+    std::atomic_bool done;
+
+    void finish(const asio::error_code& error);
+};
+
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+/*
+    Dream RPC carries request / response pairs over a connection
+        caller -> callee  RPC_REQUEST   correlation id, method, payload
+        callee -> caller  RPC_RESPONSE  correlation id, status, payload
+    Any number of requests may be in flight - responses complete them by id in whatever order they arrive
+    Every call has a deadline - a call that is not answered in time completes with RPC_TIMED_OUT and a late answer is dropped
+
+    Methods are numbers - a name is hashed into the upper half so named and numeric methods never collide
+    Numeric ids are 31 bit - RpcMethod throws std::invalid_argument for an id with the upper bit set
+    The method table lives with the Server or Client - see RpcMethods in dream_connection.h
+*/
+
+#include "dream_timer.h"
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace dream {
+
+enum RpcStatus : uint8_t {
+    RPC_OK,
+    RPC_NO_METHOD, // the peer has no handler for the method
+    RPC_FAILED, // the handler failed - the payload holds the reason
+    RPC_TIMED_OUT, // no answer before the deadline
+    RPC_DISCONNECTED // the request could not be sent or the connection is gone for good
+};
+
+struct RpcMethod {
+    uint32_t id;
+
+    constexpr RpcMethod(uint32_t id): id(id) { // a constant with the upper bit set fails to compile
+        if(id & NAMED) throw std::invalid_argument("rpc method ids are 31 bit - the upper bit marks named methods");
+    }
+    constexpr RpcMethod(const char* name): id(hash(name) | NAMED) {}
+    RpcMethod(const std::string& name): RpcMethod(name.c_str()) {}
+
+    bool operator==(const RpcMethod& o) const { return id == o.id; }
+
+private:
+    static constexpr uint32_t NAMED = 1u << 31;
+
+    static constexpr uint32_t hash(const char* name) { // fnv-1a
+        uint32_t h = 2166136261u;
+        for(; *name; ++name) h = (h ^ uint8_t(*name)) * 16777619u;
+        return h;
+    }
+};
+
+// methods the library answers itself
+static constexpr RpcMethod TOPIC_SUBSCRIBE("dream.subscribe");
+static constexpr RpcMethod TOPIC_UNSUBSCRIBE("dream.unsubscribe");
+static constexpr RpcMethod SHARD_LOCATE("dream.shard.locate");
+
+struct RpcResult {
+    RpcStatus status;
+    std::string payload; // the answer - or the reason when the handler failed
+
+    bool ok() const { return status == RPC_OK; }
+};
+
+using RpcCallback = std::function<void(RpcResult&& result)>;
+
+struct RpcRequest {
+    uint64_t id;
+    uint32_t method;
+    std::string payload;
+
+    template<typename Archive>
+    void serialize(Archive& ar) {
+        ar(id, method, payload);
+    }
+};
+
+struct RpcResponse {
+    uint64_t id;
+    uint8_t status;
+    std::string payload;
+
+    template<typename Archive>
+    void serialize(Archive& ar) {
+        ar(id, status, payload);
+    }
+};
+
+// the calls of one connection that wait for an answer - shared so deadline timers can outlive the socket
+class RpcCalls : public std::enable_shared_from_this<RpcCalls> {
+    struct Pending {
+        RpcCallback callback;
+        TimerWheel* timers;
+        TimerId deadline;
+    };
+
+    std::mutex lock;
+    std::unordered_map<uint64_t, Pending> pending;
+    uint64_t next_id;
+
+public:
+    static constexpr std::chrono::milliseconds DEFAULT_TIMEOUT = std::chrono::seconds(10);
+
+    RpcCalls(): next_id(0) {}
+
+    uint64_t add(RpcCallback callback, TimerWheel& timers, std::chrono::milliseconds timeout); // returns the correlation id - a zero timeout waits forever
+    bool complete(uint64_t id, RpcResult&& result); // false when the call already completed
+    void fail_all(RpcStatus status);
+
+    size_t size();
+};
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+/*
+    Dream Client Runtime lets many Client connections share a few threads
+    A standalone Client owns an io thread and a runtime thread - a Client built on a ClientRuntime owns neither
+    Its socket is bound to one of the runtime's io workers (round robin) and one scheduler thread updates the clients
+    whose socket has work, the same way the Server runtime only visits ready sockets
+
+    The runtime must outlive every Client built on it
+*/
+
+#include "dream_io.h"
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <condition_variable>
+
+namespace dream {
+
+class Client;
+
+class ClientRuntime {
+    std::vector<std::unique_ptr<IoWorker>> workers;
+    std::atomic<size_t> next_worker; // round robin for attached clients
+
+    struct Attached {
+        Client* client;
+        bool busy; // the scheduler is updating it - without holding clients_lock, so hooks may start and stop clients
+    };
+
+    std::mutex clients_lock;
+    std::condition_variable idle_signal; // a busy client was updated
+    std::unordered_map<uint64_t, Attached> clients;
+    uint64_t next_id;
+
+    std::mutex ready_lock;
+    std::condition_variable ready_signal;
+    std::vector<uint64_t> ready_list; // clients that queued themselves for the scheduler
+    std::vector<uint64_t> lingering; // clients that are connecting or authorizing - scheduler thread only
+
+    std::thread runtime_handle;
+    std::atomic_bool running;
+
+    void runtime_loop();
+
+    // Client interface
+    uint64_t attach(Client& client);
+    void detach(uint64_t id); // waits for an update of the client in progress - unless called from the scheduler thread
+    IoWorker& next_io_worker();
+    void mark_ready(uint64_t id); // any thread
+
+public:
+    ClientRuntime(size_t io_threads = 0); // zero uses one thread per core
+    ~ClientRuntime();
+
+    ClientRuntime(const ClientRuntime&) = delete;
+    ClientRuntime& operator=(const ClientRuntime&) = delete;
+
+    size_t get_io_threads() const { return workers.size(); }
+    size_t get_client_count();
+
+    friend class Client;
+};
+
+}
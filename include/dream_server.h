@@ -3,13 +3,24 @@
 #include "dream_connection.h"
 #include "dream_socket.h"
 #include "dream_block.h"
+#include "dream_io.h"
+#include "dream_admission.h"
+#include "dream_slotmap.h"
+#include "dream_topic.h"
+#include "dream_tick.h"
+#include "dream_shard.h"
+#include "dream_pool.h"
+#include "dream_drain.h"
 #include "ip_tools.h"
 
 #include <map>
+#include <deque>
+#include <unordered_map>
 #include <string>
 #include <atomic>
 #include <functional>
 #include <mutex>
+#include <condition_variable>
 
 namespace dream {
 
@@ -24,67 +35,167 @@ struct ServerHeader {
 };
 
 class Server {
-    asio::io_context ctx;
-    asio::io_context::work idle;
-    asio::ip::tcp::acceptor listener;
+    std::vector<std::unique_ptr<IoWorker>> workers; // worker 0 owns the server timers
+    std::vector<std::unique_ptr<asio::ip::tcp::acceptor>> listeners; // one per worker when SO_REUSEPORT is available
+    RingListener local_listener; // same host peers over shared memory - see dream_ring.h
     asio::ip::tcp::endpoint endpoint;
+    std::atomic<size_t> next_worker; // round robin for sockets accepted by a shared listener
+    std::atomic_bool accepting; // cleared before the listeners shut down - io_uring accepts check it, see do_accept_uring
+    std::atomic<uint64_t> accept_round; // bumped by start_accept - io_uring accepts find their listener by index and round
+    TimerId ping_timer;
+
+    size_t io_threads;
+    IoBackend io_backend;
+    int backlog;
+    SendLimits send_limits;
+    ReceiveLimits receive_limits;
+    ProtocolConfig protocol;
 
     ServerHeader header;
-    uint64_t cur_uuid;
-    
-    std::atomic<uint16_t> connect_protect;
-    Clock last_connection_time;
+    StoreConfig store_config; // block persistence - disabled without a directory
 
-    std::map<uint64_t, std::unique_ptr<Socket>> socket_list;
+    Admission admission;
+    std::mutex deferred_lock;
+    std::deque<std::pair<IoWorker*, asio::ip::tcp::socket>> deferred_sockets; // connections waiting for a global admission token
+    TimerId admission_timer;
+
+    SlotMap<Socket> socket_list; // socket ids are slot map handles - see dream::SlotMap
     std::vector<std::unique_ptr<Socket>> expired_clients;
 
+    std::chrono::milliseconds session_grace; // zero disables session resumption
+    size_t session_backlog;
+    std::unordered_map<std::string, uint64_t> sessions; // session token to socket id - protected by socket_list_lock
+    std::mutex resume_lock;
+    std::vector<std::pair<uint64_t, SessionResume>> resume_requests; // RESUME commands waiting for the runtime
+    std::vector<std::pair<uint64_t, uint64_t>> held_resumes; // runtime thread only - resumed socket id and the commands the client received
+
     Block blobdata;
+    Capture capture; // frame capture shared by every socket
+    RpcMethods methods; // rpc handlers shared by every client
+
+    std::mutex topics_lock;
+    std::unordered_map<std::string, std::shared_ptr<Topic>> topics;
 
-    std::thread ctx_handle, runtime_handle;
+    TickConfig tick_config;
+    TickScheduler ticks;
+    std::atomic_bool paced_sockets; // clients accepted now are flushed by the tick
+
+    std::atomic<std::shared_ptr<ShardLink>> shard; // answers SHARD_LOCATE - see dream_shard.h
+
+    std::thread runtime_handle;
     std::atomic_bool runtime_running;
 
-    Clock ping_timeout;
+    size_t runtime_threads; // socket updates run on a RuntimePool above 1 - see dream_pool.h
+    RuntimePool update_pool;
+
+    std::mutex ready_lock;
+    std::condition_variable ready_signal;
+    std::vector<uint64_t> ready_list; // sockets that queued themselves for the runtime
+    std::vector<uint64_t> lingering; // invalid sockets that cannot be released yet - checked again shortly
+    std::vector<uint64_t> expired_list; // invalid sockets the runtime thread releases
+
+    Clock gc_timeout;
+
+    Drain drainer; // graceful stop in progress - see drain
 
     void start_context_handle();
+    void close_server(); // stop everything and drop the clients - stop_server and the end of a drain
 
     void start_runtime();
     void stop_runtime();
 
-    std::unique_ptr<Socket> generate_socket(asio::ip::tcp::socket&& soc, uint64_t id, const std::string& name);
+    std::unique_ptr<Socket> generate_socket(IoWorker& worker, SocketStream&& soc, uint64_t id);
 
-    // server runtime - check clients and validate the session
+    // server runtime - only visits sockets that have work
     std::shared_mutex socket_list_lock; // runtime mutex
     void server_runtime();
+    void update_socket(uint64_t id); // runtime thread or update pool
+    void mark_socket_ready(Socket& client); // called by sockets from any thread
+    void process_resume_requests(); // start or resume sessions - runtime thread
+    void finish_resumes(); // replay to resumed sessions once no pool thread holds their socket - runtime thread
+    void flush_paced_sockets(); // queue every socket with data for the runtime - tick thread
 
     // asynchronous callbacks
-    void new_client_socket(asio::ip::tcp::socket&& soc);
+    void admit_client_socket(IoWorker& worker, asio::ip::tcp::socket&& soc);
+    void new_client_socket(IoWorker& worker, SocketStream&& soc);
+    void drain_deferred();
 
     // asynchronous loop backs
 
     void start_accept();
     void stop_accept();
-    void do_accept();
+    void do_accept(size_t index, uint64_t round); // backs off on a timer while the process is out of descriptors or memory
+    void do_accept_uring(size_t index, UringDriver& driver, uint64_t round); // io thread of the listener - multishot when the kernel has it
+    int listener_handle(size_t index, uint64_t round); // -1 once the listener of that accept round is closed or replaced
+    IoWorker& accept_worker(size_t index); // the worker that runs a socket accepted by a listener
+    UringDriver* get_uring(IoWorker& worker) { return io_backend == IoBackend::URING ? worker.get_uring() : nullptr; }
 
 public:
     Server();
     virtual ~Server();
 
     bool start_server(short port, const std::string& ip = "");
-    void stop_server();
+    void stop_server(); // immediate - queued data is dropped and a running drain ends right away
+
+    // graceful stop for deploys - stops accepting and the tick, writes out what every client has queued and closes the server
+    // once all of it was written or the deadline passed - the future is true when nothing was lost
+    // call from a thread of your own - not from a hook or a tick callback
+    std::future<bool> drain(std::chrono::milliseconds deadline);
+
+    // also accept same host clients on a unix domain socket path - their traffic goes through shared memory rings
+    // call after start_server - per address admission does not apply to them
+    bool start_local(const std::string& path, size_t ring_capacity = RingStream::DEFAULT_CAPACITY);
+
+    // configuration - applied by the next start_server
+    void set_io_threads(size_t count) { io_threads = std::max<size_t>(1, count); } // each thread runs its own acceptor when SO_REUSEPORT is available
+    void set_runtime_threads(size_t count) { runtime_threads = std::max<size_t>(1, count); } // threads for socket updates - above 1 the hooks of different clients run concurrently
+    void set_io_backend(IoBackend backend) { io_backend = backend; } // io_uring or the reactor for accepted sockets - see dream_uring.h
+    void set_backlog(int size) { backlog = size; } // kernel listen backlog
+    void set_admission(const AdmissionConfig& config) { admission.configure(config); }
+    void set_send_limits(const SendLimits& limits) { send_limits = limits; } // outgoing queue limits for clients that connect afterwards
+    void set_receive_limits(const ReceiveLimits& limits) { receive_limits = limits; } // incoming rate limits for clients that connect afterwards
+    void set_max_frame(uint32_t bytes) { protocol.max_frame = bytes; } // largest frame accepted from clients that connect afterwards
+    void set_block_store(const StoreConfig& config) { store_config = config; } // persist the block - restored by the next start_server, the application publishes the block to journal it
+    void set_session_grace(std::chrono::milliseconds grace, size_t backlog = Session::DEFAULT_BACKLOG) { session_grace = grace; session_backlog = backlog; } // keep disconnected sessions resumable - zero disables
+    void set_tick_config(const TickConfig& config) { tick_config = config; } // fixed rate simulation loop - see dream_tick.h
+    void set_shard(std::shared_ptr<ShardLink> link) { shard.store(std::move(link)); } // clients locate the owner of a key through this shard - nullptr detaches
+
+    AdmissionStats get_admission_stats() const { return admission.get_stats(); }
+    RuntimePoolStats get_runtime_stats() const { return update_pool.get_stats(); }
+
+    bool start_capture(const std::string& path, size_t buffer = Capture::DEFAULT_BUFFER) { return capture.start(path, buffer); } // record every frame of every client - see dream_capture.h
+    void stop_capture() { capture.stop(); }
+    CaptureStats get_capture_stats() { return capture.get_stats(); }
 
     bool is_running() { return runtime_running; }
 
     Block& get_block() { return blobdata; }
+    TimerWheel& get_timers() { return workers.front()->timers; } // user timers run on the first io thread
 
     size_t get_client_count() { std::shared_lock<std::shared_mutex> lock(socket_list_lock); return socket_list.size(); }
 
     std::vector<Connection> get_client_list();
 
+    // tick callbacks run on the tick thread - SIMULATE first, then REPLICATE (publish the block, feed topics) - then the clients are flushed
+    uint64_t add_tick_callback(TickScheduler::Phase phase, TickScheduler::Callback callback) { return ticks.add(phase, std::move(callback)); }
+    void remove_tick_callback(uint64_t id) { ticks.remove(id); }
+    TickStats get_tick_stats() { return ticks.get_stats(); }
+
+    // clients call it with Connection::call - the handler runs on the runtime thread and must not block on a call of its own - see RpcHandler
+    bool register_method(RpcMethod method, RpcHandler handler) { return methods.add(method, std::move(handler)); }
+    void unregister_method(RpcMethod method) { methods.remove(method); }
+
     void broadcast_string(const std::string& data);
 
+    // pub/sub - see dream_topic.h
+    std::shared_ptr<Topic> create_topic(const std::string& name, bool open = false); // returns the existing topic if the name is taken
+    std::shared_ptr<Topic> get_topic(const std::string& name); // nullptr if there is none
+    void remove_topic(const std::string& name);
+
     std::function<void(Connection&)> on_client_join; // this is temporary just so we can quickly get a callback
 
     friend class Connection;
+    friend class Topic;
 };
 
 
@@ -0,0 +1,123 @@
+#pragma once
+
+/*
+    Dream Session keeps the state a connection needs to survive a transient disconnect
+    Every data command is numbered in the order it is written to the wire - control commands (ping, session handshake) are not
+    Sent data commands stay in a bounded backlog so a resumed connection replays only what the peer did not receive
+
+    Resume handshake:
+        client -> RESUME  { token, received, first_available } - an empty token asks for a new session
+        server -> RESUMED { accepted, received } - followed by the commands the client missed
+        server -> SESSION { token, grace } - ticket for a new session
+*/
+
+#include "lib_cereal.h"
+#include "dream_bitpack.h"
+#include "dream_command.h"
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+namespace dream {
+
+struct SessionTicket {
+    std::string token;
+    uint32_t grace_ms; // how long the server keeps the session after a disconnect
+
+    template<typename Archive>
+    void serialize(Archive& ar) {
+        ar(token, grace_ms);
+    }
+};
+
+struct SessionResume {
+    std::string token;
+    uint64_t received; // data commands the client received
+    uint64_t first_available; // oldest data command the client can send again
+
+    template<typename Archive>
+    void serialize(Archive& ar) {
+        ar(token, received, first_available);
+    }
+};
+
+struct SessionResumed {
+    bool accepted;
+    uint64_t received; // data commands the server received
+
+    template<typename Archive>
+    void serialize(Archive& ar) {
+        ar(accepted, received);
+    }
+};
+
+class Session {
+    std::string token;
+    std::chrono::milliseconds grace;
+    size_t backlog_limit; // bytes of sent commands kept for replay
+
+    uint64_t sent_count, received_count;
+    std::deque<std::pair<uint64_t, Command>> backlog; // sequence number and sent command
+    size_t backlog_bytes;
+
+public:
+    static constexpr size_t TOKEN_SIZE = 16;
+    static constexpr size_t DEFAULT_BACKLOG = 1024 * 1024;
+
+    Session(): grace(0), backlog_limit(0), sent_count(0), received_count(0), backlog_bytes(0) {}
+
+    static std::string generate_token(); // from the system CSPRNG - empty when no entropy is available
+    static bool is_sequenced(const Command& cmd); // data commands are numbered and replayed - control commands are not
+
+    template<typename T>
+    static Command encode(Command::Type type, const T& message) {
+        if constexpr(BitPacked<T>) {
+            return Command(type, bits::pack(message));
+        } else {
+            std::stringstream output;
+            {
+                cereal::BinaryOutputArchive archive(output);
+                archive(message);
+            } // enforce flush
+            return Command(type, output.str());
+        }
+    }
+
+    template<typename T>
+    static bool decode(const Command& cmd, T& message) {
+        if constexpr(BitPacked<T>) {
+            return bits::unpack(cmd.data, message);
+        } else {
+            try {
+                std::stringstream input(cmd.data);
+                cereal::BinaryInputArchive archive(input);
+                archive(message);
+            } catch(...) {
+                return false;
+            }
+            return true;
+        }
+    }
+
+    void start(const std::string& token, std::chrono::milliseconds grace, size_t backlog_limit); // counters keep running - the ticket may arrive after the first commands
+    void reset(); // forget the token, the backlog and the counters
+
+    bool is_active() const { return !token.empty(); }
+    const std::string& get_token() const { return token; }
+    std::chrono::milliseconds get_grace() const { return grace; }
+
+    // outgoing state - protected by the owner's outgoing lock
+    void sent(const Command& cmd); // number a command that is written to the wire and keep a copy
+    uint64_t first_available() const; // oldest sequence number that can still be replayed
+    bool can_replay(uint64_t peer_received) const;
+    std::vector<Command> rewind(uint64_t peer_received); // the commands the peer missed - they are numbered again when resent
+
+    // incoming state - protected by the owner's incoming lock
+    void received(const Command& cmd) { if(is_sequenced(cmd)) ++received_count; }
+    uint64_t get_received() const { return received_count; }
+};
+
+}
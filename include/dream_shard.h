@@ -0,0 +1,188 @@
+#pragma once
+
+/*
+    Dream Shard splits one world across several server processes on the same host
+    Every shard process runs its own Server and connects a ShardLink to a ShardBroker over a unix domain socket
+    Shards claim world keys (a zone, a region, a match) - the broker keeps the ownership table and pushes it to every shard
+    Commands and blob handoffs for another shard are relayed by the broker - shards share nothing else, so adding a
+    process adds a full Server worth of capacity and only cross shard traffic goes through the broker
+
+        shard -> broker  SHARD_HELLO       id + public endpoint of the shard's Server
+        shard -> broker  SHARD_CLAIM       key - answered with SHARD_CLAIM to the claimer and a new directory for everybody
+        shard -> broker  SHARD_RELEASE     key
+        broker -> shard  SHARD_DIRECTORY   every shard and every claimed key
+        shard <-> broker SHARD_COMMAND     user command for a shard, the owner of a key or every other shard
+        shard <-> broker SHARD_HANDOFF     blobs of a key - ownership of the key moves to the receiver with them
+        broker -> shard  SHARD_HANDOFF_REJECT  the handoff back to its sender - the key has another owner or the receiver is unknown
+
+    Frames are a u32 length followed by the cereal encoding of ShardFrame
+    Clients ask any shard for the owner of a key with Client::locate_shard and connect to the endpoint they get back
+*/
+
+#include "dream_command.h"
+#include "dream_snapshot.h"
+#include "dream_io.h"
+
+#include <map>
+#include <mutex>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+namespace dream {
+
+using ShardId = uint32_t;
+
+static constexpr ShardId NO_SHARD = 0; // shard ids start at 1
+static constexpr ShardId ALL_SHARDS = UINT32_MAX; // every shard but the sender
+
+struct ShardFrame {
+    enum Kind : uint8_t {
+        SHARD_HELLO,
+        SHARD_REJECT, // the id is taken or the first frame was no hello
+        SHARD_CLAIM,
+        SHARD_RELEASE,
+        SHARD_DIRECTORY,
+        SHARD_COMMAND,
+        SHARD_HANDOFF,
+        SHARD_HANDOFF_REJECT
+    };
+
+    uint8_t kind;
+    ShardId from, to; // to is NO_SHARD when the key picks the target
+    uint16_t type; // command type of SHARD_COMMAND
+    std::string key;
+    std::string payload;
+
+    template<typename Archive>
+    void serialize(Archive& ar) {
+        ar(kind, from, to, type, key, payload);
+    }
+};
+
+struct ShardDirectory {
+    std::map<ShardId, std::string> endpoints; // public endpoint of every connected shard - "ip:port"
+    std::map<std::string, ShardId> owners; // claimed keys
+
+    template<typename Archive>
+    void serialize(Archive& ar) {
+        ar(endpoints, owners);
+    }
+};
+
+struct ShardHandoff {
+    ShardId from;
+    std::string key; // the receiver owns it now - empty when only blobs moved
+    std::map<std::string, std::string> blobs; // blob name to serialized state - apply with deserialize_state
+
+    template<typename Archive>
+    void serialize(Archive& ar) {
+        ar(key, blobs);
+    }
+};
+
+struct ShardBrokerStats {
+    size_t shards, keys;
+    uint64_t relayed; // commands and handoffs passed on
+    uint64_t dropped; // no shard to deliver to
+};
+
+bool split_endpoint(const std::string& endpoint, std::string& host, short& port); // "ip:port" as returned by the directory
+
+class ShardPipe; // framed unix domain socket - see dream_shard.cpp
+
+class ShardBroker {
+    IoWorker worker;
+    struct Listener;
+    std::unique_ptr<Listener> listener;
+    std::string path;
+
+    // io thread only
+    std::map<ShardId, std::shared_ptr<ShardPipe>> shards;
+    ShardDirectory directory;
+
+    mutable std::mutex stats_lock;
+    ShardBrokerStats stats;
+
+    void do_accept();
+    void on_frame(const std::shared_ptr<ShardPipe>& pipe, ShardFrame&& frame);
+    void on_close(const std::shared_ptr<ShardPipe>& pipe);
+    void relay(ShardFrame&& frame);
+    void publish_directory();
+
+public:
+    ShardBroker();
+    ~ShardBroker();
+
+    ShardBroker(const ShardBroker&) = delete;
+    ShardBroker& operator=(const ShardBroker&) = delete;
+
+    bool start(const std::string& path); // a stale socket file at the path is replaced - false while another broker listens there or without unix domain sockets
+    void stop(); // disconnects every shard
+
+    ShardBrokerStats get_stats() const;
+};
+
+class ShardLink {
+    IoWorker worker;
+    std::shared_ptr<ShardPipe> pipe;
+    ShardId id;
+    std::string endpoint;
+    std::atomic_bool connected;
+
+    std::mutex out_lock;
+    std::string out_pending; // frames encoded by senders - moved to the pipe by one posted flush
+    bool flush_posted;
+
+    std::mutex directory_lock;
+    ShardDirectory directory;
+    std::unique_ptr<std::promise<bool>> registered; // completed by the first directory or a reject
+
+    std::mutex claims_lock;
+    std::map<std::string, std::deque<std::function<void(bool)>>> claims; // waiting for the broker's answer
+
+    void on_frame(ShardFrame&& frame);
+    void on_close();
+    bool send_frame(ShardFrame&& frame);
+
+public:
+    ShardLink();
+    ~ShardLink();
+
+    ShardLink(const ShardLink&) = delete;
+    ShardLink& operator=(const ShardLink&) = delete;
+
+    // register with the broker at path - endpoint is where clients reach this shard's Server
+    bool start(const std::string& path, ShardId id, const std::string& endpoint, std::chrono::milliseconds timeout = std::chrono::seconds(2));
+    void stop(); // the broker releases every key of this shard
+
+    bool is_connected() const { return connected; }
+    ShardId get_id() const { return id; }
+
+    // ownership - the first claim of a key wins
+    void claim(const std::string& key, std::function<void(bool)> on_result = nullptr);
+    void release(const std::string& key);
+    ShardId owner_of(const std::string& key); // NO_SHARD when nobody claimed it
+    std::string locate(const std::string& key); // public endpoint of the owner - empty when unclaimed
+    ShardDirectory get_directory();
+
+    bool send(ShardId to, const Command& cmd); // ALL_SHARDS for every other shard - false while disconnected
+    bool send_to_owner(const std::string& key, const Command& cmd);
+    // move the named blobs of a published snapshot and the ownership of key to another shard - the caller drops its copies
+    // the broker sends the handoff back through on_handoff_rejected when this shard does not own the key or the receiver is unknown
+    bool handoff(ShardId to, const std::string& key, const BlockSnapshot& view, const std::vector<std::string>& blobs);
+
+    // callbacks run on the link's io thread - set them before start
+    std::function<void(ShardId from, Command&& cmd)> on_command;
+    std::function<void(ShardHandoff&& handoff)> on_handoff;
+    std::function<void(ShardHandoff&& handoff)> on_handoff_rejected; // a handoff of this shard was not delivered - the blobs come back
+    std::function<void(const ShardDirectory&)> on_directory;
+    std::function<void()> on_disconnect; // the broker went away
+};
+
+}
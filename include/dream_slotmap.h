@@ -0,0 +1,181 @@
+#pragma once
+
+/*
+    Dream Slot Map is a generational table of owned objects
+    Every object is addressed by a handle - the slot index in the low 32 bits and the slot generation in the high 32 bits
+    A slot bumps its generation when it is released, so a recycled slot never resolves for a stale handle
+
+    Insert, erase and iteration must be serialized by the owner (see Server::socket_list_lock)
+    find() is lock-free and can run concurrently with writers - storage never moves once allocated
+*/
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+
+namespace dream {
+
+template<typename T>
+class SlotMap {
+public:
+    using Handle = uint64_t; // generation << 32 | index - 0 is never a valid handle
+
+    static constexpr size_t CHUNK_BITS = 8;
+    static constexpr size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS; // slots per chunk
+    static constexpr size_t MAX_CHUNKS = 4096; // 1M slots
+
+    // held while a pointer returned by find() is pinned by the caller - see quiescent()
+    class ReadGuard {
+        const SlotMap& map;
+    public:
+        ReadGuard(const SlotMap& map): map(map) { ++map.readers; }
+        ~ReadGuard() { --map.readers; }
+
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+    };
+
+    SlotMap(): chunk_count(0), capacity(0), readers(0) {
+        for(auto& c : chunks) c.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~SlotMap() {
+        clear();
+        for(auto& c : chunks) delete[] c.load(std::memory_order_relaxed);
+    }
+
+    SlotMap(const SlotMap&) = delete;
+    SlotMap& operator=(const SlotMap&) = delete;
+
+    template<typename Factory>
+    Handle emplace(Factory&& make) { // make(Handle) builds the object that will live in the new slot - O(1)
+        uint32_t index;
+        if(free_slots.size()){
+            index = free_slots.back();
+            free_slots.pop_back();
+        } else {
+            index = grow();
+        }
+
+        Slot& s = slot(index);
+        Handle h = (Handle(s.generation.load(std::memory_order_relaxed)) << 32) | index;
+
+        std::unique_ptr<T> obj;
+        try {
+            obj = make(h); // before anything is published - a throwing factory leaves no empty slot in the dense list
+            dense.push_back(index);
+        } catch(...) {
+            free_slots.push_back(index);
+            throw;
+        }
+
+        s.dense = uint32_t(dense.size() - 1);
+        s.ptr.store(obj.release(), std::memory_order_release); // the handle resolves from here on
+
+        return h;
+    }
+
+    std::unique_ptr<T> erase(Handle h) { // unpublish the object and hand ownership back to the caller
+        uint32_t index = uint32_t(h);
+        if(index >= capacity.load(std::memory_order_relaxed)) return nullptr;
+
+        Slot& s = slot(index);
+        if(s.generation.load(std::memory_order_relaxed) != uint32_t(h >> 32)) return nullptr; // stale handle
+
+        return release(index);
+    }
+
+    std::unique_ptr<T> replace(Handle h, std::unique_ptr<T> obj) { // put another object behind a live handle - returns the previous one
+        uint32_t index = uint32_t(h);
+        if(index >= capacity.load(std::memory_order_relaxed)) return obj;
+
+        Slot& s = slot(index);
+        if(s.generation.load(std::memory_order_relaxed) != uint32_t(h >> 32)) return obj; // stale handle - the object is handed back
+
+        return std::unique_ptr<T>(s.ptr.exchange(obj.release(), std::memory_order_acq_rel));
+    }
+
+    T* find(Handle h) const { // lock-free - the object can be retired at any time unless the caller pins it
+        uint32_t index = uint32_t(h);
+        if(index >= capacity.load(std::memory_order_acquire)) return nullptr;
+
+        const Slot& s = slot(index);
+        uint32_t generation = uint32_t(h >> 32);
+        if(s.generation.load(std::memory_order_acquire) != generation) return nullptr;
+
+        T* ptr = s.ptr.load(std::memory_order_acquire);
+        if(s.generation.load(std::memory_order_acquire) != generation) return nullptr; // recycled while reading
+
+        return ptr;
+    }
+
+    bool contains(Handle h) const { return find(h) != nullptr; }
+
+    template<typename F>
+    void for_each(F&& f) const { // f(Handle, T&) - visits live objects only
+        for(uint32_t index : dense){
+            const Slot& s = slot(index);
+            f((Handle(s.generation.load(std::memory_order_relaxed)) << 32) | index, *s.ptr.load(std::memory_order_relaxed));
+        }
+    }
+
+    void clear() {
+        while(dense.size()){
+            release(dense.back()); // the returned object is destroyed here
+        }
+    }
+
+    size_t size() const { return dense.size(); }
+    bool empty() const { return dense.empty(); }
+
+    bool quiescent() const { return readers.load() == 0; } // no lookup is in flight - objects erased before this call can no longer be pinned
+
+private:
+    struct Slot {
+        std::atomic<T*> ptr { nullptr };
+        std::atomic<uint32_t> generation { 1 };
+        uint32_t dense { 0 }; // position in the dense list while occupied
+    };
+
+    std::atomic<Slot*> chunks[MAX_CHUNKS];
+    size_t chunk_count;
+    std::atomic<uint32_t> capacity;
+    mutable std::atomic<uint32_t> readers;
+
+    std::vector<uint32_t> free_slots;
+    std::vector<uint32_t> dense; // occupied slots - keeps iteration proportional to the live objects
+
+    Slot& slot(uint32_t index) { return chunks[index >> CHUNK_BITS].load(std::memory_order_acquire)[index & (CHUNK_SIZE - 1)]; }
+    const Slot& slot(uint32_t index) const { return chunks[index >> CHUNK_BITS].load(std::memory_order_acquire)[index & (CHUNK_SIZE - 1)]; }
+
+    uint32_t grow() {
+        uint32_t index = capacity.load(std::memory_order_relaxed);
+        if((index >> CHUNK_BITS) >= chunk_count){
+            if(chunk_count == MAX_CHUNKS) throw std::runtime_error("slot map is full");
+            chunks[chunk_count++].store(new Slot[CHUNK_SIZE], std::memory_order_release);
+        }
+        capacity.store(index + 1, std::memory_order_release);
+        return index;
+    }
+
+    std::unique_ptr<T> release(uint32_t index) {
+        Slot& s = slot(index);
+
+        std::unique_ptr<T> obj(s.ptr.exchange(nullptr, std::memory_order_acq_rel));
+
+        uint32_t generation = s.generation.load(std::memory_order_relaxed) + 1;
+        s.generation.store(generation ? generation : 1, std::memory_order_release); // stale handles stop resolving
+
+        uint32_t moved = dense.back(); // swap remove from the dense list
+        dense[s.dense] = moved;
+        slot(moved).dense = s.dense;
+        dense.pop_back();
+
+        free_slots.push_back(index);
+        return obj;
+    }
+};
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+/*
+    Dream Block Snapshot is an immutable view of a Block published by the simulation thread
+    Network threads can hold and serialize a snapshot while the next tick mutates the Block without locks
+    Unchanged blobs share their serialized bytes with the previous snapshot so publishing costs scale with the dirty blobs
+*/
+
+#include "dream_bitpack.h"
+#include "lib_cereal.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <cstdint>
+
+namespace dream {
+
+class BlockSnapshot {
+public:
+    struct Entry {
+        std::shared_ptr<const std::string> data; // serialized blob data
+        uint64_t version; // blob version this entry was serialized from
+    };
+
+    uint64_t tick; // publish counter of the owning Block
+    std::map<uint64_t, Entry> blobs;
+    std::map<std::string, uint64_t> names;
+
+    BlockSnapshot(): tick(0) {}
+
+    const std::string* get(uint64_t id) const; // serialized bytes of a blob or nullptr
+    const std::string* get(const std::string& name) const;
+
+    template<typename T>
+    bool read(uint64_t id, T& out) const { // deserialize a copy of the blob data
+        const std::string* raw = get(id);
+        if(!raw) return false;
+        if constexpr(BitPacked<T>) {
+            return bits::unpack(*raw, out);
+        } else {
+            try {
+                std::stringstream input(*raw);
+                cereal::BinaryInputArchive archive(input);
+                archive(out);
+            } catch(const cereal::Exception&) {
+                return false;
+            }
+            return true;
+        }
+    }
+
+    template<typename T>
+    bool read(const std::string& name, T& out) const {
+        auto it = names.find(name);
+        return it != names.end() && read(it->second, out);
+    }
+};
+
+}
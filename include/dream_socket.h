@@ -6,6 +6,14 @@
 #include "dream_clock.h"
 #include "dream_externs.h"
 #include "dream_hook.h"
+#include "dream_timer.h"
+#include "dream_bucket.h"
+#include "dream_session.h"
+#include "dream_message.h"
+#include "dream_capture.h"
+#include "dream_handshake.h"
+#include "dream_rpc.h"
+#include "dream_stream.h"
 
 #include <string>
 #include <atomic>
@@ -13,23 +21,104 @@
 #include <list>
 #include <fstream>
 #include <queue>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <future>
 
 namespace dream {
 
 constexpr size_t MAX_PAYLOAD_SIZE = 1024 * 1024 * 4; // fixed cache for incoming data
 //constexpr size_t MAX_PAYLOAD_SIZE = 256; // debug: ultra small cache size for forcing payload fragmentation
+constexpr size_t UPDATE_BUDGET = 256; // incoming commands processed per runtime update - a busy socket goes back in line behind the others
 
 static const char DREAM_PROTO_ACCESS [128] = {"\x31\x08\x67\xb0\xca\x7b\xfc\xa2\x8a\x00\x9b\x68\x71\x62\xb4\xa1\x1f\x63\xe1\xe7\x61\x74\x24\x7a\x93\xbc\x30\xbf\x83\xad\xcf\x8d\x89\x5c\x44\xb6\x57\x4c\xc4\xd0\xb4\x0a\x7c\x8a\x6c\xbe\x58\x90\xac\x7c\xf8\x23\x33\x86\x6d\xcf\x49\xe2\x28\x9b\x49\x24\xd3\xb0\x5c\x71\xd8\xf0\x5c\xa6\x2b\xeb\x8c\x14\x19\x03\xfa\x64\x10\x78\x39\xc0\xdc\x64\xf1\x10\xe6\xa4\x53\xc8\x57\xb9\x71\xe3\xa7\x37\xd4\xbb\xca\xb1\x90\xfa\x7f\x8a\x8c\xd9\x6b\x15\xa4\xee\xf4\x7d\x07\x79\x28\xe5\x17\x57\xbb\x69\x83\x10\x7f\x1f\x49\xe0\xfc"};
 
+enum SendStatus : uint8_t {
+    SEND_ACCEPTED, // queued for sending
+    SEND_COALESCED, // an identical control command is already queued - nothing was added
+    SEND_REJECTED // the outgoing queue is full or the socket is gone
+};
+
+// per-connection outgoing queue limits - a limit of zero is unlimited
+struct SendLimits {
+    enum Policy : uint8_t {
+        DROP_OLDEST, // drop the oldest queued commands to make room for the new one
+        DROP_NEWEST, // reject the new command
+        DISCONNECT // shut down the slow consumer
+    };
+
+    size_t high_water; // queued bytes (waiting + in flight) that trigger the policy
+    size_t low_water; // "on_drain" is triggered once a congested queue falls to this many bytes
+    size_t max_commands; // commands waiting to be sent
+    Policy policy;
+};
+
+static const SendLimits DEFAULT_SEND_LIMITS { 1024 * 1024 * 16, 1024 * 1024 * 4, 65536, SendLimits::DISCONNECT };
+
+// per-connection incoming limits - reads are paused at the socket while a connection is over budget - zero is unlimited
+struct ReceiveLimits {
+    double byte_rate, byte_burst; // bytes per second
+    double message_rate, message_burst; // commands per second
+    size_t max_commands; // received commands waiting for the runtime
+};
+
+static const ReceiveLimits DEFAULT_RECEIVE_LIMITS { 0, 0, 0, 0, 65536 };
+
+struct ReceiveStats {
+    uint64_t bytes_received, commands_received;
+    uint64_t rate_pauses; // reads paused because a rate budget was spent
+    uint64_t queue_pauses; // reads paused because the runtime had max_commands waiting
+};
+
+// completion callbacks run on a library thread with socket locks held - keep them short and never call back into the socket
+using FlushHandler = std::function<void(bool flushed)>; // false when the command was dropped or the connection is gone
+enum ReceiveStatus : uint8_t {
+    RECEIVE_OK,
+    RECEIVE_CLOSED, // the connection is gone for good or the receive was cancelled
+    RECEIVE_DROPPED // the inbox overflowed before this receive - commands nobody waited for were lost
+};
+
+using ReceiveHandler = std::function<void(ReceiveStatus status, Command&& cmd, uint64_t request)>; // request - the id to reply to, zero for a plain command
+
+// a command framed once for many sockets - see Topic::publish
+struct SharedFrame {
+    Command cmd; // kept for hooks and the session backlog
+    std::string frame; // length prefixed wire bytes
+
+    static std::shared_ptr<const SharedFrame> make(Command&& cmd);
+};
+
+struct OutgoingCommand {
+    Command cmd; // only the type when shared is set
+    FlushHandler on_flushed; // empty unless the sender waits for the write
+    std::shared_ptr<const SharedFrame> shared; // written as is instead of serializing cmd
+
+    const Command& command() const { return shared ? shared->cmd : cmd; }
+};
+
 class Socket : public Hookable<Socket> {
     asio::io_context& ctx;
-    asio::ip::tcp::socket socket;
+    SocketStream socket; // tcp or shared memory - see dream_stream.h
+    TimerWheel& timers;
+    TimerId auth_timer; // handshake timeout on both sides
+
+    ProtocolConfig protocol; // what this side offers - set before the handshake
+    std::atomic<uint32_t> max_frame, capabilities; // negotiated by the handshake
+    char handshake_out[Handshake::HELLO_SIZE]; // HELLO or WELCOME while it is written
 
-    uint64_t id;
+    std::atomic<uint64_t> id; // a resumed session takes over the id of the connection it replaces
     std::string name;
     size_t consecutiveErrors;
 
-    std::atomic_bool server_authorized, authorizing, valid;
+    std::atomic_bool server_authorized, authorizing, valid, client_side;
+    std::atomic_bool ready_queued; // already waiting in the owner's ready set
+    std::atomic_bool updating, update_again; // one runtime thread at a time - see begin_update
+    std::atomic_bool flush_pending; // data was left behind because a flush was still in flight
+    std::atomic_bool paced; // outgoing data waits for the owner's tick - see dream_tick.h
+    std::atomic_bool paced_pending, flush_due; // data was queued since the last tick - the next update may flush
+    std::function<void(Socket&)> ready_handler; // owner callback for sockets that have work - set before the socket is shared
+    Capture* capture; // owner traffic capture - set before the socket is shared
     alignas(uint32_t) char cmdbuf[4]; // buffer for new incoming command data length data
 
     std::recursive_mutex shutdown_lock;
@@ -41,16 +130,63 @@ class Socket : public Hookable<Socket> {
     std::stringstream out_payload; // cache buffer for new command packages while waiting for outgoing data flush
     std::stringstream out_payload_flushing; // cache buffer for currently flushing / outgoing data
 
-    std::queue<Command> in_commands, out_commands; // commands that are ready for processing - commands that are ready to send
+    std::queue<Command> in_commands; // commands that are ready for processing
+    std::queue<OutgoingCommand> out_commands; // commands that are ready to send
+    std::vector<FlushHandler> package_flushes, flushing_flushes; // senders waiting for the package being built - under outgoing_command_lock - and for the one being written
+    std::vector<FlushHandler> flush_waiters; // when_flushed callers - under outgoing_command_lock
+
+    SendLimits send_limits;
+    size_t out_command_bytes; // estimated size of out_commands - protected by outgoing_command_lock
+    uint8_t out_control; // bit per control command type waiting in out_commands - see coalescing in queue_command
+    std::atomic<size_t> out_flushing_bytes; // bytes handed to the socket and not yet written
+    std::atomic<uint64_t> out_dropped; // commands dropped or rejected by the send limits
+    std::atomic_bool congested; // went above the high water mark and has not drained yet
+
+    ReceiveLimits receive_limits; // the receive state is protected by incoming_command_lock
+    TokenBucket in_bytes, in_messages;
+    ReceiveStats receive_stats;
+    bool queue_paused; // reading stopped until the runtime drains in_commands
+    TimerId read_timer; // resumes reading once the rate budget refills
+
+    Session session; // outgoing numbering and backlog under outgoing_command_lock - incoming count under incoming_command_lock
+    std::atomic<int64_t> session_grace; // milliseconds a disconnected session stays resumable - zero without a session
+    std::atomic<int64_t> detach_deadline; // steady clock ticks until the session can be resumed - zero while connected or abandoned
+    std::atomic_bool hold_output; // data commands stay queued until the session handshake is done - control commands still go out
+
+    struct Receiver {
+        uint64_t id; // also the correlation id of a request that waits for its reply
+        Command::Type type; // NILL takes any user command
+        bool requests; // takes commands that came in a REQUEST envelope instead of plain ones
+        bool reply; // waits for the REPLY to request id - type is ignored
+        ReceiveHandler handler;
+    };
+
+    struct Unclaimed {
+        Command cmd;
+        uint64_t request; // zero for a plain command
+    };
+
+    std::mutex inbox_lock;
+    bool inbox_open; // commands nobody waits for are kept once the connection used send or receive - see hold_inbox
+    std::deque<Unclaimed> inbox; // user commands nobody was waiting for yet
+    size_t inbox_bytes;
+    bool inbox_dropped; // the inbox overflowed - the next receive reports it
+    std::deque<Receiver> receivers;
+
+    std::shared_ptr<RpcCalls> rpc_calls; // our requests waiting for an answer - follows the session
 
     std::binary_semaphore in_payload_protection; // protect read payloads from getting corrupt
     std::binary_semaphore out_payload_protection; // protect write payloads from getting corrupt
     std::atomic<uint32_t> external_lock; // protects the raw access from being invalid if this object is destroyed too early - see dream::SocketRef
 
 public:
-    Socket(asio::io_context& ctx, asio::ip::tcp::socket&& soc, uint64_t id, std::string name):
-        ctx(ctx), socket(std::move(soc)), id(id), name(name), consecutiveErrors(0),
-        server_authorized(false), authorizing(false), valid(true), in_data(new char[MAX_PAYLOAD_SIZE]),
+    Socket(asio::io_context& ctx, TimerWheel& timers, SocketStream&& soc, uint64_t id, std::string name):
+        ctx(ctx), socket(std::move(soc)), timers(timers), auth_timer(0),
+        protocol(DEFAULT_PROTOCOL), max_frame(DEFAULT_PROTOCOL.max_frame), capabilities(0), id(id), name(name), consecutiveErrors(0),
+        server_authorized(false), authorizing(false), valid(true), client_side(false), ready_queued(false), updating(false), update_again(false), flush_pending(false), paced(false), paced_pending(false), flush_due(false), capture(nullptr), in_data(new char[MAX_PAYLOAD_SIZE]),
+        send_limits(DEFAULT_SEND_LIMITS), out_command_bytes(0), out_control(0), out_flushing_bytes(0), out_dropped(0), congested(false),
+        receive_limits(DEFAULT_RECEIVE_LIMITS), receive_stats({}), queue_paused(false), read_timer(0),
+        session_grace(0), detach_deadline(0), hold_output(false), inbox_open(false), inbox_bytes(0), inbox_dropped(false), rpc_calls(std::make_shared<RpcCalls>()),
         in_payload_protection(1), out_payload_protection(1), external_lock(0)
     {}
 
@@ -60,18 +196,67 @@ public:
     Socket& operator=(const Socket&) = delete;
 
     void server_authorize(); // begin authorize process for server - asynchronous
-    void client_authorize(); // begin authorize process for client - asynchronous
+    void client_authorize(); // begin authorize process for client - asynchronous - repeated calls are ignored while it runs
+
+    void set_protocol(const ProtocolConfig& config) { protocol = config; max_frame = config.max_frame; } // before the handshake
+    uint32_t get_capabilities() const { return capabilities; } // negotiated - zero before the handshake
+    uint32_t get_max_frame() const { return max_frame; }
+
+    void runtime_update(); // misc blocking update loop - at most UPDATE_BUDGET incoming commands, the rest queues the socket again
+    bool begin_update(); // false while another runtime thread updates this socket - that thread is told to queue it again
+    bool end_update(); // true when another runtime thread wanted the socket meanwhile - the owner queues it again
+
+    void set_ready_handler(std::function<void(Socket&)> handler) { ready_handler = std::move(handler); }
+    void set_capture(Capture* owner_capture) { capture = owner_capture; } // frames are recorded while the capture is active
+    void mark_ready(); // notify the owner that this socket needs a runtime update
+    void clear_ready() { ready_queued = false; } // called by the owner right before the update - new work queues the socket again
+    void set_paced(bool enabled) { paced = enabled; } // the owner flushes at its tick boundaries instead of on every send
+    bool tick_flush(); // tick boundary - allows the next update to flush - true if the owner has to queue the socket for it
+
+    SendStatus send_command(Command&& cmd, FlushHandler on_flushed = nullptr); // send command to outgoing command queue - applies the send limits - on_flushed runs once it was written
+    SendStatus send_shared(const std::shared_ptr<const SharedFrame>& frame); // like send_command - the frame is not serialized or copied again
 
-    void runtime_update(); // misc blocking update loop
+    // awaitable traffic - see Connection::receive
+    asio::io_context::executor_type get_executor() { return ctx.get_executor(); }
+    void hold_inbox(); // keep user commands nobody waits for from now on - the answer to a send may come before the receive
+    // hand the next user command of this type to the handler - runs right away when one is waiting - requests takes REQUEST envelopes only
+    uint64_t receive_command(Command::Type type, ReceiveHandler handler, bool requests = false);
+    uint64_t receive_reply(ReceiveHandler handler); // the returned id goes into the REQUEST envelope - the handler takes the REPLY to it
+    void cancel_receive(uint64_t id); // the handler runs with false unless it already ran - ids are unique across sockets so a stale id is harmless
 
-    void send_command(Command&& cmd); // send command to outgoing command queue
-    void wait_for_flush(); // block until all data has been sent or an error occurred
+    uint64_t send_request(RpcMethod method, const std::string& payload, RpcCallback callback, std::chrono::milliseconds timeout); // the callback runs once - see dream_rpc.h
+    void send_response(uint64_t id, RpcStatus status, const std::string& payload);
+    size_t get_pending_requests() { return rpc_calls->size(); }
+
+    void set_send_limits(const SendLimits& limits);
+    size_t get_queued_bytes(); // commands waiting to be sent plus data in flight
+    size_t get_queued_commands();
+    uint64_t get_dropped_commands() const { return out_dropped; }
+    bool is_congested() const { return congested; }
+
+    void set_receive_limits(const ReceiveLimits& limits);
+    ReceiveStats get_receive_stats();
+
+    // session resumption - see dream_session.h
+    void set_hold_output(bool hold); // keep data commands queued until the session handshake is done
+    void start_session(const std::string& token, std::chrono::milliseconds grace, size_t backlog); // server - send the ticket for a new session
+    void adopt_session(Socket& old); // take over the session, unsent commands and user hooks of a disconnected socket - holds output
+    void resume_session(uint64_t peer_received, bool reply); // queue the commands the peer missed - reply sends RESUMED first (server)
+    void end_session(); // forget the session and release held output
+    bool can_resume(const SessionResume& request); // both sides still have the commands the other one missed
+    SessionResume get_resume_request(); // client - RESUME payload for this session
+    std::string get_session_token();
+    void abandon_session(); // no longer resumable - the owner releases it
+    bool is_detached(); // disconnected but still resumable
+    void when_flushed(FlushHandler done); // done(true) once nothing is queued or in flight - done(false) if the connection is lost first
+    bool wait_for_flush(); // block until all data has been sent or an error occurred - never from the io or runtime thread of this socket
 
     void shutdown(); // a safe way to shutdown the socket
     bool is_valid();
     bool is_authorized();
     bool is_authorizing();
     size_t get_id() { return id; }
+    void set_id(uint64_t new_id) { id = new_id; } // owner only - see Server::process_resume_requests
     std::string get_name() { return name; }
 
     bool has_weak_references() const { return external_lock > 0; }
@@ -81,24 +266,39 @@ private:
     bool send_raw_data(const char* data, size_t length, std::function<void(bool)> on_complete=[](bool){});
 
     void append_command_package(Command&& cmd); // add command to package buffer
+    void append_frame(const std::string& frame); // add an already framed command to the package buffer
     size_t check_command_package(); // check if there is any new data waiting to be flushed - returns how many bytes are waiting to be flushed
     bool flush_command_package(); // attempt to send command package buffer to socket output buffer - returns false if still flushing previous data
+    void send_command_package(); // send the package buffer - the caller holds out_payload_protection
+
+    SendStatus queue_command(OutgoingCommand&& out, bool& disconnect); // apply the send limits and queue - requires outgoing_command_lock
+    SendStatus after_queue(SendStatus status, bool disconnect); // disconnect a slow consumer or wake the owner
+    void check_drain(); // trigger "on_drain" when a congested queue fell below the low water mark
+    void check_flushed(); // hand the flush waiters their result once the queue is empty or the connection is lost
 
     void reset_and_receive_data(); // Reset incoming handle and start receiving fresh data
     void incoming_command_handle(); // Command length payloads are async-retrieved via this basic retrieve method
     void incoming_data_handle(size_t length); // Command data payloads are async-retrieved via this basic retrieve method
+    void command_received(size_t bytes); // account for a received command and read the next one - or pause reading
+    void continue_receiving(); // read the next command once the rate budget allows it
 
     void process_incoming_commands(); // process all incoming commands synchronously with current thread
     void process_outgoing_commands(); // process outgoing commands synchronously within current thread
 
     void process_command(Command& cmd);
+    void deliver_command(const Command& cmd); // hand a user command to a receiver or keep it in the inbox
+    void release_waiters(); // fail every pending flush and receive - the connection is gone for good
 
     bool internal_error_check(const asio::error_code& error);
+    void start_handshake_timeout();
+    void handshake_complete(const Handshake& negotiated); // authorized - start reading commands
 
 public:
     template<typename Archive>
     void serialize(Archive& ar) {
-        ar(id, name);
+        uint64_t uuid = id;
+        ar(uuid, name);
+        id = uuid;
     }
 
     friend class SocketRef;
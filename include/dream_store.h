@@ -0,0 +1,121 @@
+#pragma once
+
+/*
+    Dream Block Store persists a Block so a restarted server picks up where it stopped
+    Every published snapshot appends the blobs that changed to a journal - a writer thread commits them in groups with one fsync
+    Once the journal grows past a limit the writer folds everything into a compact snapshot file and starts a new journal
+
+    Opening a store maps the newest snapshot and replays only the journal written after it - blob data stays in the mapping
+    until the application inserts the blob again - opening checksums the snapshot once, replay depends only on the journal
+
+    Only published views are persisted - nothing publishes on its own, since publish() must run on the thread that mutates
+    the Block. Call Block::publish() regularly - at the end of a tick, e.g. from a REPLICATE tick callback - or nothing is journaled
+
+    A snapshot is written with an invalid header, fsync'd, and only then gets its real header - a torn snapshot never validates
+
+    Files in the store directory:
+        block.snap.0 / block.snap.1 - snapshots, written alternately so the mapped one is never overwritten
+        block.journal.<n> - journal segments, removed once a snapshot covers them
+*/
+
+#include "dream_snapshot.h"
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <condition_variable>
+
+namespace dream {
+
+struct StoreConfig {
+    std::string directory;
+    std::chrono::milliseconds commit_interval; // journal records written within this window share one fsync
+    size_t snapshot_threshold; // journal bytes that trigger a new snapshot
+};
+
+static const StoreConfig DEFAULT_STORE_CONFIG { "", std::chrono::milliseconds(50), 1024 * 1024 * 64 };
+
+struct StoreStats {
+    uint64_t commits; // fsync'd journal groups
+    uint64_t records; // journaled blob writes
+    uint64_t snapshots;
+    uint64_t replayed; // journal records applied by open()
+    uint64_t journal_bytes; // journal size since the last snapshot
+};
+
+class MappedFile; // platform memory mapping - see dream_store.cpp
+
+class BlockStore {
+    struct Entry { // persisted state of a blob that is not in the Block yet
+        std::string name;
+        std::string_view bytes; // points into the mapping or into owned
+        std::shared_ptr<const std::string> owned; // journal or in-memory state
+    };
+
+    StoreConfig config;
+
+    std::mutex restore_lock; // the restored entries and the mapping - shared by the Block thread and the writer
+    std::shared_ptr<MappedFile> mapping; // shared - a snapshot being written keeps the entries it carries over valid
+    int mapped_slot; // which snapshot file is mapped - -1 when none
+    std::unordered_map<uint64_t, Entry> restored;
+    std::map<std::string, uint64_t> restored_names;
+    uint64_t max_id;
+
+    // Block thread only
+    std::unordered_map<uint64_t, uint64_t> recorded; // blob versions already journaled
+
+    std::mutex journal_lock;
+    std::condition_variable journal_signal, durable_signal;
+    std::string pending; // encoded records waiting for the writer
+    std::shared_ptr<const BlockSnapshot> last_view; // newest recorded view - source of the next snapshot
+    uint64_t recorded_tick, durable_tick;
+    bool sync_requested;
+    std::FILE* journal;
+    uint64_t journal_index; // number of the segment being appended
+    StoreStats stats;
+
+    std::thread writer;
+    std::atomic_bool running;
+
+    void writer_loop();
+    bool commit(std::string& batch); // append and fsync - writer thread
+    bool write_snapshot(); // fold the journal into a new snapshot - writer thread
+    bool map_snapshot(int slot); // map a snapshot and index the blobs that were not taken yet - requires restore_lock
+    void replay_journal(uint64_t snapshot_tick);
+    std::vector<std::pair<uint64_t, std::string>> list_journal() const; // segment numbers and paths in order
+
+    std::string path(const std::string& file) const;
+
+public:
+    BlockStore();
+    ~BlockStore();
+
+    BlockStore(const BlockStore&) = delete;
+    BlockStore& operator=(const BlockStore&) = delete;
+
+    bool open(const StoreConfig& config); // map the newest snapshot, replay the journal tail and start the writer
+    void close(); // commit everything recorded and stop the writer
+    bool is_open() const { return running; }
+
+    // recovery - Block thread
+    bool take(const std::string& name, uint64_t& id, std::string& bytes); // hand a persisted blob to the Block - false if there is none
+    uint64_t next_id() const { return max_id + 1; } // ids below this may belong to persisted blobs
+    void restore(); // the Block was cleared - everything recorded becomes restorable again
+
+    // persistence - Block thread
+    void record(const std::shared_ptr<const BlockSnapshot>& view); // journal the blobs that changed since the last record
+    void sync(); // block until everything recorded is durable
+
+    StoreStats get_stats();
+};
+
+}
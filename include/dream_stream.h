@@ -0,0 +1,93 @@
+#pragma once
+
+/*
+    Dream Stream is the byte stream under a Socket - a tcp socket or, for peers on the same host, shared memory rings
+    A tcp socket runs on asio's reactor or, when its worker uses the io_uring backend, on a UringDriver - see dream_uring.h
+    It is an asio AsyncReadStream / AsyncWriteStream, so asio::async_read and asio::async_write drive any of them
+*/
+
+#include "dream_ring.h"
+#include "dream_uring.h"
+
+#include <memory>
+
+namespace dream {
+
+class SocketStream {
+    asio::ip::tcp::socket tcp;
+    std::shared_ptr<RingStream> rings; // nullptr for tcp
+    std::shared_ptr<UringStream> uring; // nullptr on the reactor - the tcp socket owns the descriptor, the uring stream a copy of it
+
+public:
+    using executor_type = asio::ip::tcp::socket::executor_type;
+
+    SocketStream(asio::ip::tcp::socket&& socket, UringDriver* driver = nullptr): tcp(std::move(socket)) {
+        if(driver && tcp.is_open()){
+            uring = std::make_shared<UringStream>(*driver, tcp.native_handle());
+            if(!uring->is_open()) uring.reset(); // out of descriptors - this socket stays on the reactor
+        }
+    }
+    SocketStream(asio::io_context& ctx, std::shared_ptr<RingStream> rings): tcp(ctx), rings(std::move(rings)) {}
+    ~SocketStream() { if(uring) uring->close(); } // a multishot receive would keep the connection open
+
+    SocketStream(SocketStream&&) = default;
+    SocketStream& operator=(SocketStream&& other) {
+        if(uring) uring->close();
+        tcp = std::move(other.tcp);
+        rings = std::move(other.rings);
+        uring = std::move(other.uring);
+        return *this;
+    }
+
+    executor_type get_executor() { return tcp.get_executor(); }
+
+    asio::ip::tcp::socket* tcp_socket() { return rings ? nullptr : &tcp; } // socket options - nullptr for shared memory
+    bool is_shared_memory() const { return bool(rings); }
+    bool is_uring() const { return bool(uring); }
+
+    bool is_open() const { return rings ? rings->is_open() : tcp.is_open(); }
+
+    void close() {
+        if(rings){
+            rings->close();
+        } else {
+            if(uring) uring->close(); // before the descriptor goes away
+            asio::error_code ignored;
+            tcp.close(ignored);
+        }
+    }
+
+    template<typename MutableBuffers, typename Handler>
+    void async_read_some(const MutableBuffers& buffers, Handler&& handler) {
+        if(uring) return uring->read_some(first_buffer<asio::mutable_buffer>(buffers), complete_on(std::forward<Handler>(handler)));
+        if(!rings) return (void)tcp.async_read_some(buffers, std::forward<Handler>(handler));
+        rings->read_some(first_buffer<asio::mutable_buffer>(buffers), complete_on(std::forward<Handler>(handler)));
+    }
+
+    template<typename ConstBuffers, typename Handler>
+    void async_write_some(const ConstBuffers& buffers, Handler&& handler) {
+        if(uring) return uring->write_some(first_buffer<asio::const_buffer>(buffers), complete_on(std::forward<Handler>(handler)));
+        if(!rings) return (void)tcp.async_write_some(buffers, std::forward<Handler>(handler));
+        rings->write_some(first_buffer<asio::const_buffer>(buffers), complete_on(std::forward<Handler>(handler)));
+    }
+
+private:
+    template<typename Buffer, typename Buffers>
+    static Buffer first_buffer(const Buffers& buffers) { // a partial read or write may stop after the first non empty buffer
+        for(auto it = asio::buffer_sequence_begin(buffers); it != asio::buffer_sequence_end(buffers); ++it){
+            Buffer buffer(*it);
+            if(buffer.size()) return buffer;
+        }
+        return Buffer();
+    }
+
+    template<typename Handler>
+    RingCompletion complete_on(Handler&& handler) { // run the completion on the executor the handler asks for
+        auto executor = asio::get_associated_executor(handler, tcp.get_executor());
+        return [handler = std::forward<Handler>(handler), executor](const asio::error_code& error, size_t bytes) mutable {
+            asio::dispatch(executor, [handler = std::move(handler), error, bytes]() mutable { handler(error, bytes); });
+        };
+    }
+};
+
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+/*
+    Dream Tick Scheduler runs a fixed rate simulation loop on its own thread
+    Deadlines are absolute - tick n is due at start + n * interval - so a late wake up never shifts the ticks that follow
+    Every tick runs the SIMULATE callbacks, then the REPLICATE callbacks, then the flush of the owner
+    A tick that runs past the next deadline counts as an overrun - ticks that were missed completely are skipped, not bunched up
+
+    The thread sleeps until shortly before the deadline and yields for the rest - spin trades a little cpu for less jitter
+*/
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+namespace dream {
+
+struct TickConfig {
+    double rate; // ticks per second - 0 disables the scheduler
+    bool paced; // hold outgoing data until the tick boundary - every client gets its updates at the same cadence
+    std::chrono::microseconds spin; // yield instead of sleeping for the last part of the wait
+};
+
+static const TickConfig DEFAULT_TICK_CONFIG { 0, true, std::chrono::microseconds(500) };
+
+struct TickInfo {
+    uint64_t tick; // number of the tick - skipped ticks are counted too
+    std::chrono::steady_clock::time_point deadline; // when the tick was due
+    std::chrono::steady_clock::duration interval;
+};
+
+struct TickStats {
+    uint64_t ticks; // ticks that ran
+    uint64_t overruns; // ticks that took longer than the interval
+    uint64_t skipped; // ticks that were dropped because an overrun ran past them
+    double avg_duration_ms, max_duration_ms; // time spent in the callbacks and the flush
+    double avg_jitter_ms, max_jitter_ms; // wake up past the deadline
+};
+
+class TickScheduler {
+public:
+    enum Phase {
+        SIMULATE,
+        REPLICATE
+    };
+
+    using Callback = std::function<void(const TickInfo&)>;
+
+    TickScheduler();
+    ~TickScheduler();
+
+    TickScheduler(const TickScheduler&) = delete;
+    TickScheduler& operator=(const TickScheduler&) = delete;
+
+    bool start(double rate, std::chrono::microseconds spin = DEFAULT_TICK_CONFIG.spin); // false if the rate is not positive
+    void stop(); // waits for the running tick
+    bool is_running() { return running; }
+
+    uint64_t add(Phase phase, Callback callback); // any thread - takes effect with the next tick
+    void remove(uint64_t id);
+    void set_flush(std::function<void()> flush) { this->flush = std::move(flush); } // owner hook after the phases - set before start
+
+    TickStats get_stats();
+    void reset_stats();
+
+private:
+    struct Entry {
+        uint64_t id;
+        Phase phase;
+        Callback callback;
+    };
+
+    std::mutex callbacks_lock;
+    std::shared_ptr<const std::vector<Entry>> callbacks; // replaced on every change - the tick thread runs a snapshot
+    uint64_t next_id;
+
+    std::function<void()> flush;
+
+    std::mutex stats_lock;
+    TickStats stats;
+    double total_duration_ms, total_jitter_ms;
+
+    std::mutex state_lock;
+    std::condition_variable wake; // cuts the sleep short on stop
+    std::thread handle;
+    std::atomic_bool running;
+
+    void run(std::chrono::steady_clock::duration interval, std::chrono::microseconds spin);
+    bool wait_until(std::chrono::steady_clock::time_point deadline, std::chrono::microseconds spin); // false when stopped
+};
+
+}
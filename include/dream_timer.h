@@ -0,0 +1,90 @@
+#pragma once
+
+/*
+    Dream Timer Wheel is a hierarchical timing wheel driven from an io_context
+    One steady_timer ticks the wheel while timers are armed - no threads are spawned for timeouts
+    Arming and cancelling a timer are O(1) and callbacks run on the io_context thread
+    Once cancel returns the callback is not running and never will - so an owner can cancel its timers and then go away
+*/
+
+#include "ip_tools.h"
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include <cstdint>
+
+namespace dream {
+
+using TimerId = uint64_t; // 0 is never a valid timer
+
+class TimerWheel {
+public:
+    using Duration = std::chrono::steady_clock::duration;
+
+    static constexpr size_t LEVELS = 4;
+    static constexpr size_t SLOT_BITS = 6;
+    static constexpr size_t SLOTS = size_t(1) << SLOT_BITS; // slots per level - 4 levels cover 2^24 ticks
+
+    TimerWheel(asio::io_context& ctx, std::chrono::milliseconds resolution = std::chrono::milliseconds(10));
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    TimerId schedule(Duration delay, std::function<void()> cb); // run once after delay
+    TimerId schedule_every(Duration interval, std::function<void()> cb); // run every interval until cancelled
+    bool cancel(TimerId id); // returns true if the timer was armed and will not run - waits for a callback that is running on another thread
+    bool is_armed(TimerId id);
+
+    void stop(); // cancel every timer - waits for a callback that is running on another thread
+    size_t size(); // number of armed timers
+
+private:
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    struct Node {
+        uint64_t expires; // absolute tick
+        uint64_t interval; // ticks between runs - 0 for one-shot timers
+        std::function<void()> cb;
+        uint32_t prev, next;
+        uint32_t generation;
+        uint32_t slot; // level * SLOTS + slot index
+        bool armed;
+        bool linked; // in a wheel slot - a due one-shot timer is taken off before its callback runs
+    };
+
+    asio::steady_timer driver;
+    const std::chrono::steady_clock::duration resolution;
+    const std::chrono::steady_clock::time_point origin;
+
+    std::mutex mtx;
+    std::vector<Node> nodes;
+    std::vector<uint32_t> free_nodes;
+    uint32_t wheel[LEVELS * SLOTS];
+    uint64_t now_tick;
+    size_t armed_count;
+    bool driving;
+
+    TimerId running; // timer whose callback is running - 0 while none is
+    std::thread::id running_thread;
+    std::condition_variable idle_signal; // the running callback returned
+
+    uint64_t current_tick() const;
+    TimerId arm(uint64_t delay_ticks, uint64_t interval, std::function<void()>&& cb);
+    Node* resolve(TimerId id);
+
+    void link(uint32_t index);
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+    void cascade(size_t level);
+
+    void wait_idle(std::unique_lock<std::mutex>& lock, TimerId id); // until the callback of id - or of any timer for 0 - is not running elsewhere
+    void drive(); // arm the steady_timer for the next tick - requires mtx
+    void on_tick(const asio::error_code& error);
+};
+
+}
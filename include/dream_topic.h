@@ -0,0 +1,56 @@
+#pragma once
+
+/*
+    Dream Topic is a named channel on the Server - a set of subscribed connections that a publish reaches at once
+    The subscriber set is a sorted vector of socket ids behind a copy-on-write snapshot - publishing takes the snapshot
+    and resolves each id lock-free in the socket slot map. The command is serialized once and every subscriber queues
+    the same frame, so a publish costs one lookup and one enqueue per subscriber and never locks the socket list. Subscribing copies the set - topics are meant to be read far more often than changed
+
+    Ids of disconnected clients are pruned by the next publish - a resumed session keeps its id and its subscriptions
+    Clients subscribe themselves to open topics with Client::subscribe - closed topics are managed by the server only
+*/
+
+#include "dream_command.h"
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace dream {
+
+class Server;
+class Connection;
+
+class Topic {
+    Server& server;
+    const std::string name;
+    const bool open; // clients may subscribe themselves
+
+    std::mutex lock; // guards the snapshot pointer and serializes writers
+    std::shared_ptr<const std::vector<uint64_t>> subscribers; // sorted socket ids - replaced on every change
+
+    std::shared_ptr<const std::vector<uint64_t>> snapshot();
+    bool update(uint64_t id, bool add);
+
+public:
+    Topic(Server& server, const std::string& name, bool open);
+
+    Topic(const Topic&) = delete;
+    Topic& operator=(const Topic&) = delete;
+
+    const std::string& get_name() const { return name; }
+    bool is_open() const { return open; }
+
+    bool subscribe(const Connection& user); // false if already subscribed
+    bool unsubscribe(const Connection& user); // false if not subscribed
+    bool is_subscribed(const Connection& user);
+
+    size_t publish(const Command& cmd); // returns the number of clients the command was queued for
+    size_t publish_string(const std::string& data) { return publish(Command(Command::STRING, data)); }
+
+    size_t get_subscriber_count() { return snapshot()->size(); }
+};
+
+}
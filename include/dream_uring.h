@@ -0,0 +1,151 @@
+#pragma once
+
+/*
+    Dream Uring is an io_uring backend for the tcp sockets of an IoWorker - Linux only, selected at runtime
+    See Server::set_io_backend and Client::set_io_backend - IoBackend::REACTOR keeps asio's epoll reactor
+
+    One UringDriver per worker owns the ring. Operations queued during an io context pass are submitted together
+    by one io_uring_enter and completions are reaped when the ring's eventfd fires on the io context, so handlers
+    still run on the worker thread. No syscall or CPU comparison with the reactor has been measured - benchmark both
+    with the actual workload before switching
+    Receives land in a pool of buffers registered with the kernel as a provided buffer ring - a multishot receive stays
+    armed per socket and each frame is copied out of the pool. Listeners use a multishot accept
+    A receive that finds the pool empty waits until a buffer is handed back. Descriptors keep the flags asio gave
+    them - an operation that reports EAGAIN on a non-blocking socket polls for readiness before it is retried
+    Kernels without provided buffer rings or multishot operations get single shot operations instead
+
+    define DREAM_NO_URING to leave the backend out - IoWorker::get_uring then always returns nullptr
+*/
+
+#include "dream_ring.h"
+
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+namespace dream {
+
+struct UringConfig {
+    uint32_t entries; // submission queue size - the completion queue is twice as large
+    uint32_t buffers; // receive pool buffers - a power of 2
+    uint32_t buffer_size; // bytes per receive buffer
+    uint32_t max_held; // receive buffers one socket may hold before its multishot receive is paused
+};
+
+static const UringConfig DEFAULT_URING_CONFIG { 1024, 1024, 16 * 1024, 8 };
+
+class UringDriver {
+public:
+    using Completion = std::function<void(int result, uint32_t flags)>; // result as the kernel reports it - a negative errno on failure
+
+    static std::unique_ptr<UringDriver> create(asio::io_context& ctx, const UringConfig& config = DEFAULT_URING_CONFIG); // nullptr when io_uring is not available
+    ~UringDriver();
+
+    UringDriver(const UringDriver&) = delete;
+    UringDriver& operator=(const UringDriver&) = delete;
+
+    // io context thread only - the completion runs there too, once per result of a multishot operation
+    uint64_t recv(int fd, void* data, size_t size, Completion done);
+    uint64_t recv_multishot(int fd, Completion done); // flags carry the pool buffer - see buffer_id
+    uint64_t send(int fd, const void* data, size_t size, Completion done);
+    uint64_t accept(int fd, bool multishot, Completion done); // result is the accepted descriptor
+    uint64_t poll(int fd, uint32_t events, Completion done); // one shot readiness wait - result is the ready events
+    void cancel(uint64_t op); // the operation completes with -ECANCELED unless it already finished
+
+    bool has_buffer_pool() const { return pool_ready; }
+    bool has_multishot_accept() const { return multishot_accept; }
+    void disable_multishot_accept() { multishot_accept = false; } // the kernel refused it
+
+    static bool has_more(uint32_t flags); // a multishot operation stays armed after this result
+    static bool has_buffer(uint32_t flags);
+    static uint16_t buffer_id(uint32_t flags);
+    const char* buffer(uint16_t id) const { return pool.data() + size_t(id) * config.buffer_size; }
+    void release_buffer(uint16_t id); // hand a pool buffer back to the kernel
+    void wait_for_buffers(std::function<void()> retry); // runs once a buffer is handed back - for receives that found the pool empty
+
+    static void shutdown_listener(int fd); // any thread - ends the accepts of a listener right away and releases its port
+
+    asio::io_context& get_context() { return ctx; }
+    const UringConfig& get_config() const { return config; }
+
+private:
+    struct Rings; // mapped submission and completion queues and the eventfd watch - see dream_uring.cpp
+
+    UringDriver(asio::io_context& ctx, const UringConfig& config);
+
+    asio::io_context& ctx;
+    const UringConfig config;
+    int ring_fd, event_fd;
+    std::unique_ptr<Rings> rings;
+
+    std::unordered_map<uint64_t, Completion> ops;
+    uint64_t next_op;
+    uint32_t queued; // prepared entries waiting for io_uring_enter
+    bool flush_posted;
+
+    std::vector<char> pool;
+    void* buffer_ring;
+    size_t buffer_ring_size;
+    uint16_t buffer_tail;
+    bool pool_ready, multishot_accept;
+    std::vector<std::function<void()>> starved; // receives waiting for a pool buffer
+    bool starved_posted;
+
+    bool setup();
+    bool setup_pool();
+    void* prepare(uint8_t opcode, int fd, uint64_t user_data); // a zeroed submission entry - queued for the next submit
+    uint64_t track(Completion&& done);
+    void submit();
+    void wait_events();
+    void reap();
+};
+
+// a tcp socket driven by a UringDriver - used through SocketStream, see dream_stream.h
+class UringStream : public std::enable_shared_from_this<UringStream> {
+public:
+    UringStream(UringDriver& driver, int descriptor); // works on a copy of the descriptor - see is_open
+    ~UringStream();
+
+    UringStream(const UringStream&) = delete;
+    UringStream& operator=(const UringStream&) = delete;
+
+    // at most one read and one write at a time - any thread, the handler runs on the io context like a socket completion
+    void read_some(asio::mutable_buffer buffer, RingCompletion&& handler);
+    void write_some(asio::const_buffer buffer, RingCompletion&& handler);
+
+    bool is_open() const { return open; } // false when the descriptor could not be copied
+    void close(); // pending operations complete with operation_aborted - call before the descriptor is closed
+
+private:
+    struct Held { uint16_t id; uint32_t offset, size; };
+
+    UringDriver& driver;
+    const int fd; // own copy - closed once the last operation released the stream
+    std::atomic_bool open;
+
+    // io context thread only
+    asio::mutable_buffer read_buffer;
+    RingCompletion pending_read;
+    asio::const_buffer write_buffer;
+    RingCompletion pending_write;
+
+    std::deque<Held> held; // received pool buffers not read yet
+    asio::error_code read_error; // eof or the error that ended the receive
+    uint64_t recv_op, send_op;
+    bool multishot, armed, starved; // starved - waiting for the pool to get a buffer back
+
+    void start_read();
+    void start_write();
+    void arm();
+    void on_starved(); // the pool was empty - arm again once a buffer is handed back
+    void on_recv(int result, uint32_t flags); // multishot receive
+    void on_read(int result); // single shot receive into the read buffer
+    bool drain_held(); // copy held buffers into the pending read
+    void post(RingCompletion&& handler, const asio::error_code& error, size_t bytes);
+};
+
+}
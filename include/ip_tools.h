@@ -8,4 +8,6 @@
 
 bool stoip(const std::string& str, asio::ip::address& ipaddr);
 
-bool getIpv4Address(std::vector<asio::ip::address>& addrList);
\ No newline at end of file
+bool getIpv4Address(std::vector<asio::ip::address>& addrList);
+
+bool removeStaleSocket(const std::string& path); // unlinks a unix domain socket file nobody listens on - false while a live listener owns it
@@ -0,0 +1,68 @@
+#include "dream_admission.h"
+
+namespace dream {
+
+Admission::Admission(const AdmissionConfig& config): admitted(0), deferred(0), rejected(0) {
+    configure(config);
+}
+
+void Admission::configure(const AdmissionConfig& cfg) {
+    std::scoped_lock lock(mtx);
+    config = cfg;
+    global = TokenBucket(config.rate, config.burst);
+    sources.clear();
+}
+
+Admission::Result Admission::check(const asio::ip::address& source, size_t deferred_count) {
+    std::scoped_lock lock(mtx);
+    auto now = std::chrono::steady_clock::now();
+
+    if(config.source_rate > 0){
+        auto it = sources.find(source);
+        if(it == sources.end()){
+            if(sources.size() >= MAX_TRACKED_SOURCES) prune();
+            it = sources.emplace(source, TokenBucket(config.source_rate, config.source_burst)).first;
+        }
+
+        if(!it->second.try_take(1.0, now)){ // one source is connecting too fast
+            ++rejected;
+            return REJECT;
+        }
+    }
+
+    if(!global.try_take(1.0, now)){
+        if(deferred_count >= config.max_deferred){
+            ++rejected;
+            return REJECT;
+        }
+        ++deferred;
+        return DEFER;
+    }
+
+    ++admitted;
+    return ADMIT;
+}
+
+bool Admission::retry() {
+    std::scoped_lock lock(mtx);
+    if(!global.try_take()) return false;
+
+    ++admitted;
+    return true;
+}
+
+std::chrono::milliseconds Admission::retry_delay() {
+    std::scoped_lock lock(mtx);
+    global.refill();
+    return global.time_until();
+}
+
+void Admission::prune() {
+    auto now = std::chrono::steady_clock::now();
+    for(auto it = sources.begin(); it != sources.end();){
+        if(it->second.full(now)) it = sources.erase(it);
+        else ++it;
+    }
+}
+
+}
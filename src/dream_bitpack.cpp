@@ -0,0 +1,168 @@
+#include "dream_bitpack.h"
+
+// kernel selection happens at compile time - define DREAM_NO_SIMD to force the scalar fallback
+#ifndef DREAM_NO_SIMD
+    #if defined(__AVX2__)
+        #define DREAM_BITS_AVX2
+    #elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #define DREAM_BITS_SSE2
+    #endif
+#endif
+
+#if defined(DREAM_BITS_AVX2) || defined(DREAM_BITS_SSE2)
+#include <immintrin.h>
+#endif
+
+namespace dream {
+
+namespace bits {
+
+static_assert(std::endian::native == std::endian::little, "the bit stream is assembled in little endian words");
+
+void quantize(const float* in, uint32_t* out, size_t count, float min, float max, float precision) {
+    const float scale = 1.0f / precision;
+    const float limit = float(steps(min, max, precision)); // rounding never lands past the last step
+    size_t i = 0;
+#if defined(DREAM_BITS_AVX2)
+    const __m256 vmin = _mm256_set1_ps(min), vmax = _mm256_set1_ps(max), vscale = _mm256_set1_ps(scale), half = _mm256_set1_ps(0.5f), vlimit = _mm256_set1_ps(limit);
+    for(; i + 8 <= count; i += 8){
+        __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i), vmin), vmax); // max_ps returns vmin for NaN
+        v = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(v, vmin), vscale), half), vlimit);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvttps_epi32(v));
+    }
+#elif defined(DREAM_BITS_SSE2)
+    const __m128 vmin = _mm_set1_ps(min), vmax = _mm_set1_ps(max), vscale = _mm_set1_ps(scale), half = _mm_set1_ps(0.5f), vlimit = _mm_set1_ps(limit);
+    for(; i + 4 <= count; i += 4){
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), vmin), vmax); // max_ps returns vmin for NaN
+        v = _mm_min_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(v, vmin), vscale), half), vlimit);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_cvttps_epi32(v));
+    }
+#endif
+    for(; i < count; ++i){
+        float v = in[i] > min ? in[i] : min; // NaN compares false
+        v = v < max ? v : max;
+        out[i] = uint32_t(int32_t(std::min((v - min) * scale + 0.5f, limit)));
+    }
+}
+
+void dequantize(const uint32_t* in, float* out, size_t count, float min, float max, float precision) {
+    size_t i = 0;
+#if defined(DREAM_BITS_AVX2)
+    const __m256 vmin = _mm256_set1_ps(min), vmax = _mm256_set1_ps(max), vprecision = _mm256_set1_ps(precision);
+    for(; i + 8 <= count; i += 8){
+        __m256 q = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)));
+        _mm256_storeu_ps(out + i, _mm256_min_ps(_mm256_add_ps(vmin, _mm256_mul_ps(q, vprecision)), vmax));
+    }
+#elif defined(DREAM_BITS_SSE2)
+    const __m128 vmin = _mm_set1_ps(min), vmax = _mm_set1_ps(max), vprecision = _mm_set1_ps(precision);
+    for(; i + 4 <= count; i += 4){
+        __m128 q = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+        _mm_storeu_ps(out + i, _mm_min_ps(_mm_add_ps(vmin, _mm_mul_ps(q, vprecision)), vmax));
+    }
+#endif
+    for(; i < count; ++i){
+        out[i] = std::min(min + float(int32_t(in[i])) * precision, max);
+    }
+}
+
+const char* backend() {
+#if defined(DREAM_BITS_AVX2)
+    return "avx2";
+#elif defined(DREAM_BITS_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+void Writer::write(uint64_t value, unsigned count) {
+    if(!count) return;
+    if(count < 64) value &= (uint64_t(1) << count) - 1;
+
+    acc |= value << fill;
+    const unsigned total = fill + count;
+    if(total < 64){
+        fill = total;
+        return;
+    }
+
+    char word[sizeof(acc)];
+    std::memcpy(word, &acc, sizeof(acc));
+    out.append(word, sizeof(word));
+
+    acc = fill ? value >> (64 - fill) : 0; // the bits that did not fit
+    fill = total - 64;
+}
+
+void Writer::write_varint(uint64_t value) {
+    while(value >= 0x80){
+        write((value & 0x7F) | 0x80, 8);
+        value >>= 7;
+    }
+    write(value, 8);
+}
+
+void Writer::write_bytes(const char* data, size_t length) {
+    if(fill % 8){ // unaligned - every byte is shifted into place
+        for(size_t i = 0; i < length; ++i) write(uint8_t(data[i]), 8);
+        return;
+    }
+
+    for(; fill; fill -= 8, acc >>= 8) out.push_back(char(acc & 0xFF)); // flush the whole bytes and append directly
+    acc = 0;
+    out.append(data, length);
+}
+
+void Writer::write_packed(const uint32_t* values, size_t count, unsigned width) {
+    for(size_t i = 0; i < count; ++i) write(values[i], width);
+}
+
+std::string Writer::finish() {
+    for(; fill; fill = fill > 8 ? fill - 8 : 0, acc >>= 8) out.push_back(char(acc & 0xFF));
+    acc = 0;
+    return std::move(out);
+}
+
+uint64_t Reader::read(unsigned count) {
+    if(!count) return 0;
+    if(count > 56) return read(32) | (read(count - 32) << 32); // one word load covers 56 bits at any offset
+    if(bit + count > length * 8) throw Exception("bits: read past the end of the data");
+
+    const size_t byte = bit / 8;
+    uint64_t word = 0;
+    std::memcpy(&word, data + byte, std::min<size_t>(sizeof(word), length - byte));
+
+    uint64_t value = (word >> (bit % 8)) & ((uint64_t(1) << count) - 1);
+    bit += count;
+    return value;
+}
+
+uint64_t Reader::read_varint() {
+    uint64_t value = 0;
+    for(int shift = 0; shift < 64; shift += 7){
+        uint64_t byte = read(8);
+        value |= (byte & 0x7F) << shift;
+        if(!(byte & 0x80)) return value;
+    }
+    throw Exception("bits: varint too long");
+}
+
+void Reader::read_bytes(char* out, size_t count) {
+    if(bit % 8){
+        for(size_t i = 0; i < count; ++i) out[i] = char(read(8));
+        return;
+    }
+
+    if(bit + count * 8 > length * 8) throw Exception("bits: read past the end of the data");
+    std::memcpy(out, data + bit / 8, count);
+    bit += count * 8;
+}
+
+void Reader::read_packed(uint32_t* values, size_t count, unsigned width) {
+    if(uint64_t(count) * width > remaining_bits()) throw Exception("bits: read past the end of the data");
+    for(size_t i = 0; i < count; ++i) values[i] = uint32_t(read(width));
+}
+
+}
+
+}
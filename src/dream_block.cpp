@@ -2,16 +2,83 @@
 
 namespace dream {
 
-Block::Block(): cid(1) {}
+Block::Block(): cid(1), tick(0) {}
 
 Block::~Block() {
     clear();
 }
 
 void Block::clear() {
+    if(store){
+        publish(); // the latest state is what gets restored
+        store->restore();
+    }
+
     // free all blobs
     for(auto& [k,v] : blobs) delete v.ptr;
     blobs.clear();
+    names.clear();
+    published.store(nullptr, std::memory_order_release);
+}
+
+bool Block::open_store(const StoreConfig& config) {
+    if(blobs.size()) return false; // ids of live blobs could collide with persisted ones
+
+    store = std::make_unique<BlockStore>();
+    if(!store->open(config)){
+        store.reset();
+        return false;
+    }
+
+    cid = std::max(cid, store->next_id());
+    return true;
+}
+
+void Block::close_store() {
+    if(!store) return;
+
+    publish();
+    store->close();
+    store.reset();
+}
+
+std::shared_ptr<const BlockSnapshot> Block::publish() {
+    std::shared_ptr<const BlockSnapshot> previous = published.load(std::memory_order_relaxed); // only the publishing thread stores
+    auto next = std::make_shared<BlockSnapshot>();
+
+    next->tick = ++tick;
+    next->names = names;
+
+    for(auto& [id, box] : blobs){
+        if(previous){
+            auto it = previous->blobs.find(id);
+            if(it != previous->blobs.end() && it->second.version == box.version){
+                next->blobs.emplace(id, it->second); // unchanged - share the serialized bytes
+                continue;
+            }
+        }
+        next->blobs.emplace(id, BlockSnapshot::Entry { std::make_shared<const std::string>(box.ptr->serialize_state()), box.version });
+    }
+
+    std::shared_ptr<const BlockSnapshot> view = std::move(next);
+    published.store(view, std::memory_order_release);
+
+    if(store) store->record(view);
+    return view;
+}
+
+// Block Snapshot
+
+const std::string* BlockSnapshot::get(uint64_t id) const {
+    auto it = blobs.find(id);
+    if(it == blobs.end()) return nullptr;
+    return it->second.data.get();
+}
+
+const std::string* BlockSnapshot::get(const std::string& name) const {
+    auto it = names.find(name);
+    if(it == names.end()) return nullptr;
+    return get(it->second);
 }
 
 
@@ -0,0 +1,287 @@
+#include "libdream.h"
+#include "dream_capture.h"
+
+#include <fstream>
+#include <cstring>
+
+namespace dream {
+
+static const char CAPTURE_MAGIC[8] = { 'D', 'R', 'M', 'C', 'A', 'P', '1', '\0' };
+static constexpr size_t FRAME_HEAD = sizeof(uint64_t) * 2 + sizeof(uint8_t) + sizeof(uint32_t); // time, connection, direction, length
+static constexpr auto WRITE_INTERVAL = std::chrono::milliseconds(50); // frames are written in batches
+
+template<typename T>
+static void put(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+Capture::Capture(): active(false), buffer_limit(DEFAULT_BUFFER), stopping(false), stats({}), file(nullptr) {}
+
+Capture::~Capture() {
+    stop();
+}
+
+bool Capture::start(const std::string& path, size_t limit) {
+    stop();
+
+    file = std::fopen(path.c_str(), "wb");
+    if(!file) return false;
+    std::fwrite(CAPTURE_MAGIC, 1, sizeof(CAPTURE_MAGIC), file);
+
+    {
+        std::scoped_lock guard(lock);
+        buffer.clear();
+        buffer_limit = limit;
+        stopping = false;
+        stats = {};
+        started = std::chrono::steady_clock::now();
+    }
+
+    writer = std::thread([this](){ writer_loop(); });
+    active.store(true, std::memory_order_release);
+
+    DLOG_INFO << "capturing traffic to " << path << "\n";
+    return true;
+}
+
+void Capture::stop() {
+    active = false;
+    {
+        std::scoped_lock guard(lock);
+        stopping = true;
+    }
+    signal.notify_all();
+    if(writer.joinable()) writer.join(); // writes whatever is still buffered
+
+    if(file) std::fclose(file);
+    file = nullptr;
+}
+
+void Capture::record(uint64_t connection, Direction direction, std::string_view frame) {
+    if(!active.load(std::memory_order_acquire)) return;
+
+    std::scoped_lock guard(lock);
+    if(stopping) return;
+
+    if(buffer.size() + FRAME_HEAD + frame.size() > buffer_limit){ // the writer is behind - never stall the socket
+        ++stats.dropped;
+        return;
+    }
+
+    const bool wake = buffer.empty();
+
+    put(buffer, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count()));
+    put(buffer, connection);
+    put(buffer, uint8_t(direction));
+    put(buffer, uint32_t(frame.size()));
+    buffer.append(frame.data(), frame.size());
+
+    ++stats.frames;
+    stats.bytes += frame.size();
+
+    if(wake) signal.notify_one();
+}
+
+CaptureStats Capture::get_stats() {
+    std::scoped_lock guard(lock);
+    return stats;
+}
+
+void Capture::writer_loop() {
+    std::unique_lock<std::mutex> guard(lock);
+
+    while(true){
+        signal.wait(guard, [this](){ return stopping || !buffer.empty(); });
+        if(!stopping){
+            signal.wait_for(guard, WRITE_INTERVAL, [this](){ return stopping; }); // collect a batch
+        }
+
+        std::string batch;
+        std::swap(batch, buffer);
+        const bool done = stopping;
+
+        guard.unlock();
+        if(batch.size() && std::fwrite(batch.data(), 1, batch.size(), file) != batch.size()){
+            DLOG_ERROR << "capture write failed\n";
+        }
+        guard.lock();
+
+        if(done && buffer.empty()) break;
+    }
+
+    std::fflush(file);
+}
+
+// Replay
+
+bool Replay::open(const std::string& path) {
+    frames.clear();
+
+    std::ifstream input(path, std::ios::binary | std::ios::ate);
+    if(!input) return false;
+    const uint64_t file_size = uint64_t(input.tellg());
+    input.seekg(0);
+
+    char magic[sizeof(CAPTURE_MAGIC)];
+    if(!input.read(magic, sizeof(magic)) || std::memcmp(magic, CAPTURE_MAGIC, sizeof(magic))) return false;
+
+    char head[FRAME_HEAD];
+    while(input.read(head, sizeof(head))){
+        CaptureFrame frame;
+        uint8_t direction;
+        uint32_t length;
+
+        const char* data = head;
+        std::memcpy(&frame.time, data, sizeof(frame.time)); data += sizeof(frame.time);
+        std::memcpy(&frame.connection, data, sizeof(frame.connection)); data += sizeof(frame.connection);
+        std::memcpy(&direction, data, sizeof(direction)); data += sizeof(direction);
+        std::memcpy(&length, data, sizeof(length));
+
+        if(length > MAX_PAYLOAD_SIZE || length > file_size - uint64_t(input.tellg())){ // untrusted - never allocate from it unchecked
+            DLOG_WARN << "replay: frame length " << length << " is out of bounds - ignoring the rest of " << path << "\n";
+            break;
+        }
+
+        frame.direction = Capture::Direction(direction);
+        frame.data.resize(length);
+        if(!input.read(frame.data.data(), length)) break; // truncated tail
+
+        frames.emplace_back(std::move(frame));
+    }
+
+    return true;
+}
+
+bool Replay::decode(const CaptureFrame& frame, Command& cmd) {
+    try {
+        std::stringstream input(frame.data);
+        cereal::BinaryInputArchive fetch(input);
+        fetch(cmd);
+    } catch(const cereal::Exception&) {
+        return false;
+    }
+    return true;
+}
+
+// sleeps until the frame is due when the captured pace is kept
+static void pace_frame(Replay::Pace pace, double speed, std::chrono::steady_clock::time_point start, uint64_t first, const CaptureFrame& frame) {
+    if(pace != Replay::ORIGINAL || speed <= 0) return;
+    auto due = start + std::chrono::nanoseconds(uint64_t(double(frame.time - first) / speed));
+    std::this_thread::sleep_until(due);
+}
+
+ReplayStats Replay::replay_decode(const std::function<void(uint64_t, Command&)>& handler, Pace pace, double speed) {
+    ReplayStats stats {};
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t first = frames.size() ? frames.front().time : 0;
+
+    for(const CaptureFrame& frame : frames){
+        if(frame.direction != Capture::INBOUND) continue;
+        pace_frame(pace, speed, start, first, frame);
+
+        Command cmd;
+        if(!decode(frame, cmd)){
+            ++stats.failed;
+            continue;
+        }
+        handler(frame.connection, cmd);
+
+        ++stats.frames;
+        stats.bytes += frame.data.size();
+    }
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+// inbound commands of one captured connection - sent in capture order from the client's timer wheel
+struct ReplayQueue {
+    struct Entry {
+        std::chrono::nanoseconds offset; // since the replay started
+        Command cmd;
+        size_t bytes;
+    };
+
+    std::unique_ptr<Client> client;
+    std::vector<Entry> entries;
+    size_t next = 0;
+};
+
+ReplayStats Replay::replay_loopback(short port, const std::string& ip, Pace pace, double speed) {
+    ReplayStats stats {};
+
+    const bool paced = pace == ORIGINAL && speed > 0;
+    const uint64_t first = frames.size() ? frames.front().time : 0;
+
+    std::map<uint64_t, ReplayQueue> queues; // one client per captured connection
+    for(const CaptureFrame& frame : frames){
+        if(frame.direction != Capture::INBOUND) continue;
+
+        ReplayQueue& queue = queues[frame.connection];
+        if(!queue.client){
+            queue.client = std::make_unique<Client>();
+            if(!queue.client->start_client(port, ip, "replay " + std::to_string(frame.connection))){
+                DLOG_ERROR << "replay: could not connect to " << ip << " : " << port << "\n";
+                return stats;
+            }
+        }
+
+        Command cmd;
+        if(!decode(frame, cmd)){
+            ++stats.failed;
+            continue;
+        }
+        if(!Session::is_sequenced(cmd)) continue; // pings and handshakes belong to the captured connection - the clients run their own
+
+        auto offset = paced ? std::chrono::nanoseconds(uint64_t(double(frame.time - first) / speed)) : std::chrono::nanoseconds(0);
+        queue.entries.push_back({ offset, std::move(cmd), frame.data.size() });
+    }
+
+    std::mutex lock;
+    std::condition_variable done;
+    size_t running = queues.size();
+    const auto start = std::chrono::steady_clock::now();
+
+    // runs on the client's io thread - sends what is due and arms a timer for the next entry
+    std::function<void(ReplayQueue&)> step = [&](ReplayQueue& queue){
+        for(; queue.next < queue.entries.size(); ++queue.next){
+            ReplayQueue::Entry& entry = queue.entries[queue.next];
+
+            const auto now = std::chrono::steady_clock::now();
+            if(start + entry.offset > now){
+                queue.client->get_timers().schedule(start + entry.offset - now, [&step, &queue](){ step(queue); });
+                return;
+            }
+
+            const bool sent = queue.client->send_command(std::move(entry.cmd)) != SEND_REJECTED;
+            std::scoped_lock guard(lock);
+            if(sent){
+                ++stats.frames;
+                stats.bytes += entry.bytes;
+            } else {
+                ++stats.failed;
+            }
+        }
+
+        std::scoped_lock guard(lock);
+        if(--running == 0) done.notify_all();
+    };
+
+    for(auto& [id, queue] : queues){
+        queue.client->get_timers().schedule(std::chrono::steady_clock::duration::zero(), [&step, &queue](){ step(queue); });
+    }
+
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [&](){ return running == 0; }); // every queue was sent - the timers are idle
+    }
+
+    for(auto& [id, queue] : queues){
+        queue.client->wait_for_flush(); // everything reached the kernel
+    }
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+}
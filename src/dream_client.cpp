@@ -1,23 +1,46 @@
 #include "dream_client.h"
 
+#include <algorithm>
+
 namespace dream {
 
-Client::Client(): idle(ctx), header({}), cur_uuid(0), runtime_running(false) {}
+static thread_local Client* updating = nullptr; // the client whose update runs on this thread - see client_runtime
+
+Client::Client(): shared(nullptr), own_worker(std::make_unique<IoWorker>()), runtime_id(0), header({}), cur_uuid(0), send_limits(DEFAULT_SEND_LIMITS), protocol(DEFAULT_PROTOCOL),
+    connect_config(DEFAULT_CONNECT_CONFIG), io_backend(IoBackend::REACTOR), port(0), runtime_running(false), close_requested(false), connect_attempt(0)
+{
+    worker = own_worker.get();
+}
+
+Client::Client(ClientRuntime& runtime): shared(&runtime), runtime_id(0), header({}), cur_uuid(0), send_limits(DEFAULT_SEND_LIMITS), protocol(DEFAULT_PROTOCOL),
+    connect_config(DEFAULT_CONNECT_CONFIG), io_backend(IoBackend::REACTOR), port(0), runtime_running(false), close_requested(false), connect_attempt(0)
+{
+    worker = &runtime.next_io_worker();
+}
 
 Client::~Client() {
     stop_client();
 }
 
 void Client::start_context_handle() {
-    ctx_handle = std::thread([this](){
-        ctx.run();
-    });
+    worker->start(); // the shared workers are always running
 }
 
 void Client::start_runtime() {
-    if(!runtime_running){
+    if(shared){
+        if(!runtime_id) runtime_id = shared->attach(*this);
+        runtime_running = true;
+    } else if(!runtime_running){
+        if(runtime_handle.joinable()){
+            if(runtime_handle.get_id() == std::this_thread::get_id()){ // restarted from a hook - the loop simply goes on
+                runtime_running = true;
+                return;
+            }
+            runtime_handle.join(); // stopped from its own thread - see stop_runtime
+        }
+
+        runtime_running = true;
         runtime_handle = std::thread([this](){
-            runtime_running = true;
             while(runtime_running){
                 Clock::sleepMilliseconds(2); // client runtime has 2ms delay
                 client_runtime(); // invoke runtime update
@@ -28,108 +51,376 @@ void Client::start_runtime() {
 
 void Client::stop_runtime() {
     runtime_running = false;
+    if(uint64_t id = runtime_id.exchange(0)) shared->detach(id); // waits for a scheduler pass that is updating this client
     blobdata.clear();
-    if(runtime_handle.joinable()){
+    if(runtime_handle.joinable() && runtime_handle.get_id() != std::this_thread::get_id()){ // the runtime thread ends after this update
         runtime_handle.join();
     }
 }
 
 
-bool Client::start_client(short port, const std::string& ip, const std::string& name) {
+bool Client::start_client(short port, const std::string& ip, const std::string& client_name) {
+    if(on_io_thread() || updating == this){ // the connection is made on the io thread and attached under the runtime lock
+        DLOG_ERROR << "start_client would wait for itself - use start_client_async from hooks and io callbacks\n";
+        return false;
+    }
+    return start_client_async(port, ip, client_name).get();
+}
+
+std::future<bool> Client::start_client_async(short port, const std::string& ip, const std::string& client_name, std::function<void(bool)> on_result) {
     stop_runtime();
+    close_requested = false; // a hook that stops and starts again keeps the new connection
+    if(connecting) connecting->cancel();
+    if(connecting_local) connecting_local->cancel();
 
-    asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), port);
+    this->host = ip.size() ? ip : "localhost";
+    this->port = port;
+    name = client_name;
 
-    size_t retry = 10;
-    do {
-        try {
-            if(ip.size()){
-                asio::ip::address addr;
-                if(!stoip(ip, addr)) return false; // invalid address
-                endpoint = asio::ip::tcp::endpoint(addr, port);
-            }
+    auto result = std::make_shared<std::promise<bool>>();
+    std::future<bool> connected = result->get_future();
+
+    start_context_handle();
+    start_runtime();
 
-            asio::ip::tcp::socket soc(ctx);
-            soc.open(endpoint.protocol());
-            soc.set_option(asio::ip::tcp::no_delay(true));
-            // soc.set_option(asio::detail::socket_option::integer<SOL_SOCKET, SO_RCVTIMEO>{ 8000 });
-            // soc.set_option(asio::detail::socket_option::integer<SOL_SOCKET, SO_SNDTIMEO>{ 8000 });
-            soc.connect(endpoint);
-
-            server = generate_server_object(std::move(soc), 0, name);
-
-            server->register_hook("on_authorized", [this](Socket& client, const std::any& data){
-                if(on_connect){
-                    Connection user(this);
-                    user.uuid = client.get_id();
-                    user.name = client.get_name();
-
-                    on_connect(user);
-                }
-            });
-
-            break;
-        } catch(...) {
-            if(!--retry)
-                return false;
+    const uint64_t attempt = ++connect_attempt;
+    connecting = std::make_shared<Connector>(worker->ctx, worker->timers, connect_config);
+    connecting->start(host, port, [this, result, on_result, attempt](const asio::error_code& error, asio::ip::tcp::socket&& soc){
+        if(error){
+            if(error != asio::error::operation_aborted) DLOG_WARN << "could not connect to " << host << " : " << this->port << " - " << error.message() << "\n";
+            if(attempt == connect_attempt) runtime_running = false; // nothing to run - the thread is joined by the next start or stop
+        } else {
+            attach_server(SocketStream(std::move(soc), io_backend == IoBackend::URING ? worker->get_uring() : nullptr));
         }
-    } while(1);
+
+        if(on_result) on_result(!error);
+        result->set_value(!error);
+    });
+
+    return connected;
+}
+
+bool Client::start_local(const std::string& path, const std::string& client_name) {
+    if(on_io_thread() || updating == this){
+        DLOG_ERROR << "start_local would wait for itself - use start_local_async from hooks and io callbacks\n";
+        return false;
+    }
+    return start_local_async(path, client_name).get();
+}
+
+std::future<bool> Client::start_local_async(const std::string& path, const std::string& client_name, std::function<void(bool)> on_result) {
+    stop_runtime();
+    close_requested = false; // a hook that stops and starts again keeps the new connection
+    if(connecting) connecting->cancel();
+    if(connecting_local) connecting_local->cancel();
+
+    this->host = path;
+    this->port = 0;
+    name = client_name;
+
+    auto result = std::make_shared<std::promise<bool>>();
+    std::future<bool> connected = result->get_future();
 
     start_context_handle();
     start_runtime();
 
-    return true;
+    const uint64_t attempt = ++connect_attempt;
+    connecting_local = std::make_shared<RingConnector>(worker->ctx, worker->timers);
+    connecting_local->start(path, connect_config.timeout, [this, result, on_result, attempt](const asio::error_code& error, SocketStream&& soc){
+        if(error){
+            if(error != asio::error::operation_aborted) DLOG_WARN << "could not connect to " << host << " - " << error.message() << "\n";
+            if(attempt == connect_attempt) runtime_running = false; // a cancelled earlier attempt leaves the new runtime alone
+        } else {
+            attach_server(std::move(soc));
+        }
+
+        if(on_result) on_result(!error);
+        result->set_value(!error);
+    });
+
+    return connected;
+}
+
+void Client::attach_server(SocketStream&& soc) {
+    bool local = soc.is_shared_memory();
+    auto fresh = generate_server_object(std::move(soc), 0, name);
+    fresh->set_send_limits(send_limits);
+    if(local){ // both processes live and die on the same host - there is no network outage to survive
+        ProtocolConfig offer = protocol;
+        offer.capabilities &= ~CAP_SESSION;
+        fresh->set_protocol(offer);
+    }
+    register_server_hooks(*fresh);
+
+    std::unique_lock<std::shared_mutex> lock(runtime_mtx);
+    server = std::move(fresh);
+    if(uint64_t id = runtime_id) shared->mark_ready(id); // start the handshake
 }
 
 void Client::stop_client() {
+    if(updating == this){ // a hook of the update holds the runtime lock - see client_runtime
+        close_requested = true;
+        return;
+    }
+
+    drainer.abort(); // its thread closes the client - done again below in case there was none
+    close_client();
+}
+
+std::future<bool> Client::drain(std::chrono::milliseconds deadline) {
+    if(!drainer.prepare()){ // already draining - that drain reports the result
+        std::promise<bool> busy;
+        busy.set_value(false);
+        return busy.get_future();
+    }
+
+    {
+        auto lock = runtime_lock();
+        if(server) server->when_flushed(drainer.track()); // the runtime keeps flushing until close_client stops it
+    }
+
+    return drainer.start(deadline, [this](){ close_client(); });
+}
+
+void Client::close_client() {
     stop_runtime();
+    if(connecting) connecting->cancel();
+    if(connecting_local) connecting_local->cancel();
 
-    // if(server) server->wait_for_flush();
+    release_sockets();
+    if(own_worker && !on_io_thread()) own_worker->stop(); // a worker cannot join itself - the destructor stops it
+}
 
-    ctx.stop();
-    server.reset();
-    while(!ctx.stopped());
-    ctx.reset();
+void Client::release_sockets() {
+    if(!worker->handle.joinable()){ // the io thread never ran - no handler can be pending
+        server.reset();
+        retired.clear();
+        connecting.reset();
+        connecting_local.reset();
+        return;
+    }
 
-    if(ctx_handle.joinable()){
-        ctx_handle.join();
+    if(on_io_thread()){ // a handler of this client - waiting for the posts below would wait for itself
+        std::unique_lock<std::shared_mutex> lock(runtime_mtx);
+        if(server) retire(std::move(server));
+        connecting.reset();
+        connecting_local.reset();
+        return;
     }
+
+    // closing a socket queues its aborted handlers - the release is queued behind them on the same thread
+    std::promise<void> released;
+    asio::post(worker->ctx, [this, &released](){
+        if(server) server->shutdown();
+        for(auto& socket : retired) socket->shutdown();
+
+        asio::post(worker->ctx, [this, &released](){
+            std::unique_lock<std::shared_mutex> lock(runtime_mtx);
+            expire(std::move(server));
+            for(auto& socket : retired) expire(std::move(socket));
+            retired.clear();
+            connecting.reset();
+            connecting_local.reset();
+            released.set_value();
+        });
+    });
+    released.get_future().wait();
+}
+
+void Client::retire(std::unique_ptr<Socket>&& socket) {
+    Socket* dead = socket.get();
+    retired.emplace_back(std::move(socket)); // its handlers may still be queued on the io context
+
+    // same two hops as release_sockets - a later release_sockets queues behind these and still finds the socket gone
+    asio::post(worker->ctx, [this, dead](){
+        dead->shutdown();
+
+        asio::post(worker->ctx, [this, dead](){
+            std::unique_lock<std::shared_mutex> lock(runtime_mtx);
+            auto it = std::find_if(retired.begin(), retired.end(), [dead](const std::unique_ptr<Socket>& s){ return s.get() == dead; });
+            if(it == retired.end()) return;
+            expire(std::move(*it));
+            retired.erase(it);
+        });
+    });
+}
+
+void Client::expire(std::unique_ptr<Socket> socket) {
+    if(!socket || !socket->has_weak_references()) return; // nothing pins it - freed on return
+
+    std::scoped_lock lock(expired_lock);
+    expired.emplace_back(std::move(socket)); // a Connection still sends through it - see update_server
+}
+
+std::shared_lock<std::shared_mutex> Client::runtime_lock() {
+    if(updating == this) return std::shared_lock<std::shared_mutex>(runtime_mtx, std::defer_lock); // shared locks do not nest
+    return std::shared_lock<std::shared_mutex>(runtime_mtx);
 }
 
+bool Client::client_runtime() {
+    Client* outer = updating;
+    updating = this;
+    const bool linger = update_server();
+    updating = outer;
 
-void Client::client_runtime() { // check for and remove invalid clients
+    if(close_requested.exchange(false)){ // stop_client from a hook - nothing is locked anymore
+        drainer.abort();
+        close_client();
+        return false;
+    }
+    return linger;
+}
+
+bool Client::update_server() { // check for and remove invalid clients
     std::shared_lock<std::shared_mutex> lock(runtime_mtx);
-    if(server){
-        if(!server->is_valid()){
-            dlog << "disconnected from server\n";
-            lock.unlock();
-            std::unique_lock<std::shared_mutex> ulock(runtime_mtx);
-            server.reset();
-        } else if(!server->is_authorized()) {
-            server->client_authorize();
-        } else {
-            server->runtime_update();
+
+    bool pinned;
+    {
+        std::scoped_lock guard(expired_lock);
+        std::erase_if(expired, [](const auto& s){ return !s->has_weak_references(); }); // expired connection cleanup
+        pinned = !expired.empty();
+    }
+
+    if(!server) return pinned; // check again shortly while a retired connection is pinned
+
+    server->clear_ready(); // anything that happens from here on queues the client again
+
+    if(!server->is_valid()){
+        if(server->is_detached()){ // the server keeps the session for a while - reconnect and pick up where it left off
+            if(!connecting || connecting->is_done()) start_resume();
+            return true;
         }
+
+        DLOG_INFO << "disconnected from server\n";
+        if(connecting) connecting->cancel(); // the session expired while reconnecting
+        server->abandon_session(); // pending sends and receives fail now
+        lock.unlock();
+        std::unique_lock<std::shared_mutex> ulock(runtime_mtx);
+        if(server) retire(std::move(server));
+        return false;
+    }
+
+    if(!server->is_authorized()) {
+        server->client_authorize();
+        return true;
     }
 
+    server->runtime_update();
+    return false;
 }
 
 Connection Client::get_socket() {
     Connection user(this);
-    user.uuid = server->get_id();
-    user.name = server->get_name();
+    auto lock = runtime_lock();
+    if(server){ // no id or name while disconnected
+        user.uuid = server->get_id();
+        user.name = server->get_name();
+    }
     return user;
 }
 
-void Client::send_string(const std::string& data) {
-    server->send_command(Command(Command::STRING, data));
+std::future<RpcResult> Client::call_server(RpcMethod method, const std::string& payload) {
+    return get_socket().call(method, payload); // the call pins the socket - a ready RPC_DISCONNECTED without one
+}
+
+SendStatus Client::send_string(const std::string& data) {
+    return send_command(Command(Command::STRING, data));
+}
+
+SendStatus Client::send_command(Command&& cmd) {
+    SocketRef socket;
+    {
+        auto lock = runtime_lock(); // a reconnect replaces the server - pin it before the lock is released
+        if(!server) return SEND_REJECTED;
+        socket = SocketRef(server.get());
+    }
+    return socket->send_command(std::move(cmd));
 }
 
+size_t Client::get_queued_bytes() {
+    auto lock = runtime_lock();
+    if(!server || (!server->is_valid() && !server->is_detached())) return 0;
+    return server->get_queued_bytes();
+}
+
+bool Client::wait_for_flush() {
+    auto flushed = std::make_shared<std::promise<bool>>();
+    auto result = flushed->get_future();
+    {
+        std::shared_lock<std::shared_mutex> lock(runtime_mtx); // only to find the socket - waiting under it would hold up attach_server
+        if(!server) return true;
+        server->when_flushed([flushed](bool success){ flushed->set_value(success); });
+    }
+    return result.get();
+}
+
+
+void Client::start_resume() {
+    ConnectConfig config = connect_config;
+    config.attempts = 0; // keep trying until the session expires - client_runtime cancels it then
+
+    connecting = std::make_shared<Connector>(worker->ctx, worker->timers, config);
+    connecting->start(host, port, [this](const asio::error_code& error, asio::ip::tcp::socket&& soc){
+        if(!error) resume_session(std::move(soc));
+    });
+}
+
+bool Client::resume_session(asio::ip::tcp::socket&& soc) {
+    auto fresh = generate_server_object(SocketStream(std::move(soc), io_backend == IoBackend::URING ? worker->get_uring() : nullptr), 0, name);
+    fresh->set_send_limits(send_limits);
+    register_server_hooks(*fresh);
+
+    std::unique_lock<std::shared_mutex> lock(runtime_mtx);
+    if(!server || !server->is_detached()) return false; // the session expired in the meantime
+    fresh->adopt_session(*server); // output is held until the server answers the RESUME
+    retire(std::move(server));
+    server = std::move(fresh);
+    if(uint64_t id = runtime_id) shared->mark_ready(id); // start the handshake
+
+    DLOG_INFO << "reconnected to server - resuming session\n";
+    return true;
+}
+
+void Client::register_server_hooks(Socket& socket) {
+    socket.register_hook("on_authorized", [this](Socket& client, const std::any& data){
+        if(client.get_capabilities() & CAP_SESSION){
+            SessionResume request = client.get_resume_request(); // an empty token asks for a new session
+            client.send_command(Session::encode(Command::RESUME, request));
+
+            if(request.token.size()) return; // a resumed session is still the same connection
+        } else {
+            client.end_session(); // the server does not keep sessions (anymore) - this is a new connection
+        }
+
+        if(on_connect){
+            Connection user(this);
+            user.uuid = client.get_id();
+            user.name = client.get_name();
+
+            on_connect(user);
+        }
+    });
+
+    socket.register_hook("pre_command", [this](Socket& client, const std::any& data){
+        const Command& cmd = std::any_cast<const Command&>(data);
+        if(cmd.type != Command::RPC_REQUEST) return;
+
+        Connection user(this);
+        user.uuid = client.get_id();
+        user.name = client.get_name();
+
+        methods.dispatch(user, cmd);
+    });
+}
 
 // Misc
 
-std::unique_ptr<Socket> Client::generate_server_object(asio::ip::tcp::socket&& soc, uint64_t id, const std::string& name) {
-    return std::unique_ptr<Socket>( new Socket(ctx, std::move(soc), cur_uuid, std::to_string(cur_uuid)) );
+std::unique_ptr<Socket> Client::generate_server_object(SocketStream&& soc, uint64_t id, const std::string& name) {
+    auto socket = std::unique_ptr<Socket>( new Socket(worker->ctx, worker->timers, std::move(soc), cur_uuid, std::to_string(cur_uuid)) );
+    if(shared) socket->set_ready_handler([this](Socket& s){ if(uint64_t id = runtime_id) shared->mark_ready(id); }); // must be set before the socket is shared
+    socket->set_capture(&capture);
+    socket->set_protocol(protocol);
+    return socket;
 }
 
 
@@ -12,7 +12,7 @@ double Clock::getSeconds() const {
 }
 
 double Clock::getMilliseconds() const {
-    return double(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now() - start).count()) / 1000.0;
+    return double(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()) / 1000.0;
 }
 
 void Clock::setSeconds(double time) {
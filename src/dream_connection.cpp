@@ -6,7 +6,7 @@ namespace dream {
 SocketRef::SocketRef(): ptr(nullptr) {}
 
 SocketRef::SocketRef(Socket* ptr): ptr(ptr) {
-    ++ptr->external_lock;
+    if(ptr) ++ptr->external_lock; // a stopped client has no socket
 }
 
 SocketRef& SocketRef::operator=(const SocketRef& o) {
@@ -33,7 +33,7 @@ bool Connection::is_connected() {
     SocketRef client;
     if( !(client = get_socket()).valid() ) return false;
 
-    return client->is_authorized();
+    return client->is_valid() && client->is_authorized(); // false while a detached session waits for a reconnect
 }
 
 std::string Connection::get_name() {
@@ -43,11 +43,47 @@ std::string Connection::get_name() {
     return (name = client->get_name()); // update local name in cache
 }
 
-void Connection::send_string(const std::string& data) {
+ReceiveStats Connection::get_receive_stats() {
     SocketRef client;
-    if( !(client = get_socket()).valid() ) return;
+    if( !(client = get_socket()).valid() ) return {};
 
-    client->send_command(Command(Command::STRING, data));
+    return client->get_receive_stats();
+}
+
+SendStatus Connection::send_string(const std::string& data) {
+    SocketRef client;
+    if( !(client = get_socket()).valid() ) return SEND_REJECTED;
+
+    return client->send_command(Command(Command::STRING, data));
+}
+
+asio::io_context::executor_type Connection::get_executor() {
+    Server** _server = std::get_if<Server*>(&controller);
+    if(_server){
+        Server* server = *_server;
+
+        SocketRef client = get_socket();
+        if(client.valid()) return client->get_executor();
+        return server->workers.front()->ctx.get_executor(); // gone - any thread of the server will do
+    }
+
+    return std::get<Client*>(controller)->worker->ctx.get_executor();
+}
+
+uint64_t Connection::call(RpcMethod method, const std::string& payload, RpcCallback callback, std::chrono::milliseconds timeout) {
+    SocketRef client;
+    if( !(client = get_socket()).valid() ){
+        callback({ RPC_DISCONNECTED, {} });
+        return 0;
+    }
+
+    return client->send_request(method, payload, std::move(callback), timeout);
+}
+
+std::future<RpcResult> Connection::call(RpcMethod method, const std::string& payload, std::chrono::milliseconds timeout) {
+    auto result = std::make_shared<std::promise<RpcResult>>();
+    call(method, payload, [result](RpcResult&& answer){ result->set_value(std::move(answer)); }, timeout);
+    return result->get_future();
 }
 
 uint64_t Connection::register_global_hook(UserGlobalHookCallback cb) {
@@ -63,6 +99,51 @@ uint64_t Connection::register_global_hook(UserGlobalHookCallback cb) {
 }
 
 
+bool RpcReply::answer(RpcStatus status, const std::string& payload) {
+    if(answered->exchange(true)) return false;
+
+    SocketRef client;
+    if( !(client = caller.get_socket()).valid() ) return false; // the caller times out
+
+    client->send_response(id, status, payload);
+    return true;
+}
+
+bool RpcMethods::add(RpcMethod method, RpcHandler handler) {
+    std::unique_lock<std::shared_mutex> guard(lock);
+    return handlers.emplace(method.id, std::move(handler)).second;
+}
+
+void RpcMethods::remove(RpcMethod method) {
+    std::unique_lock<std::shared_mutex> guard(lock);
+    handlers.erase(method.id);
+}
+
+void RpcMethods::dispatch(Connection& caller, const Command& cmd) {
+    RpcRequest request;
+    if(!Session::decode(cmd, request)) return;
+
+    RpcHandler handler;
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        auto found = handlers.find(request.method);
+        if(found != handlers.end()) handler = found->second; // a copy - the handler may remove itself
+    }
+
+    RpcReply reply(caller, request.id);
+    if(!handler){
+        DLOG_DEBUG << "rpc: no handler for method " << request.method << "\n";
+        reply.answer(RPC_NO_METHOD, {});
+        return;
+    }
+
+    try {
+        handler(caller, request.payload, reply);
+    } catch(const std::exception& e) {
+        reply.fail(e.what());
+    }
+}
+
 SocketRef Connection::get_socket() {
     SocketRef cobj;
 
@@ -70,19 +151,20 @@ SocketRef Connection::get_socket() {
     if(_server){
         Server* server = *_server;
 
-        std::shared_lock<std::shared_mutex> lock(server->socket_list_lock);
-        if(server->socket_list.count(uuid))
-            cobj = SocketRef(server->socket_list.at(uuid).get());
+        SlotMap<Socket>::ReadGuard guard(server->socket_list); // lock-free - the guard keeps the gc away until the socket is pinned
+        Socket* socket = server->socket_list.find(uuid);
+        if(socket) cobj = SocketRef(socket);
     } else {
         Client** _client = std::get_if<Client*>(&controller);
         if(_client){
             Client* client = *_client;
 
+            auto lock = client->runtime_lock(); // a reconnect replaces the server - pinned before the lock is released
             cobj = SocketRef(client->server.get());
         }
     }
 
-    if(!cobj.valid() || !cobj->is_valid())
+    if(!cobj.valid() || (!cobj->is_valid() && !cobj->is_detached())) // a detached session still takes commands
         return SocketRef {};
 
     return cobj;
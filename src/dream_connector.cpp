@@ -0,0 +1,171 @@
+#include "dream_connector.h"
+#include "dream_externs.h"
+
+#include <algorithm>
+
+namespace dream {
+
+Connector::Connector(asio::io_context& ctx, TimerWheel& timers, const ConnectConfig& config):
+    ctx(ctx), timers(timers), config(config), resolver(ctx), next_candidate(0), pending(0), round(0), generation(0),
+    stagger_timer(0), round_timer(0), backoff_timer(0), done(false) {}
+
+Connector::~Connector() {}
+
+void Connector::start(const std::string& host, short port, Handler handler) {
+    this->host = host;
+    this->service = std::to_string(uint16_t(port));
+    this->handler = std::move(handler);
+
+    asio::post(ctx, [self = shared_from_this()](){ self->resolve(); });
+}
+
+void Connector::cancel() {
+    asio::post(ctx, [self = shared_from_this()](){
+        if(self->done) return;
+        self->drop_attempts();
+        self->timers.cancel(self->backoff_timer);
+        self->finish(asio::error::operation_aborted, asio::ip::tcp::socket(self->ctx));
+    });
+}
+
+void Connector::resolve() {
+    if(done) return;
+    ++round;
+
+    const uint64_t gen = generation;
+    round_timer = timers.schedule(config.timeout, [self = shared_from_this(), gen](){
+        if(self->done || gen != self->generation) return;
+        self->round_failed(asio::error::timed_out);
+    });
+
+    // an unspecified protocol asks for both families
+    resolver.async_resolve(host, service, [self = shared_from_this(), gen](const asio::error_code& error, const asio::ip::tcp::resolver::results_type& results){
+        if(self->done || gen != self->generation) return;
+        if(error){
+            self->round_failed(error);
+            return;
+        }
+        self->on_resolved(results);
+    });
+}
+
+void Connector::on_resolved(const asio::ip::tcp::resolver::results_type& results) {
+    std::vector<asio::ip::tcp::endpoint> v6, v4;
+    for(const auto& entry : results){
+        auto& list = entry.endpoint().address().is_v6() ? v6 : v4;
+        if(std::find(list.begin(), list.end(), entry.endpoint()) == list.end()) list.push_back(entry.endpoint());
+    }
+
+    // alternate the families starting with the one the resolver preferred
+    bool six = results.size() && results.begin()->endpoint().address().is_v6();
+    candidates.clear();
+    for(size_t a = 0, b = 0; a < v6.size() || b < v4.size(); six = !six){
+        if(six && a < v6.size()) candidates.push_back(v6[a++]);
+        else if(!six && b < v4.size()) candidates.push_back(v4[b++]);
+    }
+    next_candidate = 0;
+
+    if(candidates.empty()){
+        round_failed(asio::error::host_not_found);
+        return;
+    }
+    try_next();
+}
+
+void Connector::try_next() {
+    timers.cancel(stagger_timer);
+
+    while(next_candidate < candidates.size()){
+        const asio::ip::tcp::endpoint& target = candidates[next_candidate++];
+
+        auto soc = std::make_unique<asio::ip::tcp::socket>(ctx);
+        asio::error_code error;
+        soc->open(target.protocol(), error);
+        if(error){ // no route for this family on the host - move on right away
+            last_error = error;
+            continue;
+        }
+
+        const size_t index = attempts.size();
+        const uint64_t gen = generation;
+        soc->async_connect(target, [self = shared_from_this(), index, gen](const asio::error_code& error){
+            if(self->done || gen != self->generation) return;
+            self->on_connect(index, error);
+        });
+        attempts.emplace_back(std::move(soc));
+        ++pending;
+
+        if(next_candidate < candidates.size()){ // give this attempt a head start before racing the next address
+            stagger_timer = timers.schedule(config.stagger, [self = shared_from_this(), gen](){
+                if(self->done || gen != self->generation) return;
+                self->try_next();
+            });
+        }
+        return;
+    }
+
+    if(!pending) round_failed(last_error ? last_error : asio::error_code(asio::error::host_unreachable));
+}
+
+void Connector::on_connect(size_t index, const asio::error_code& error) {
+    --pending;
+
+    if(error){
+        DLOG_DEBUG << "connect to " << candidates[std::min(index, candidates.size() - 1)] << " failed: " << error.message() << "\n";
+        last_error = error;
+        asio::error_code ignored;
+        attempts[index]->close(ignored);
+        try_next(); // no reason to wait for the head start to run out
+        return;
+    }
+
+    asio::ip::tcp::socket soc = std::move(*attempts[index]);
+    asio::error_code ignored;
+    soc.set_option(asio::ip::tcp::no_delay(true), ignored);
+
+    drop_attempts(); // the losers are closed
+    finish(error, std::move(soc));
+}
+
+void Connector::round_failed(const asio::error_code& error) {
+    drop_attempts();
+
+    if(config.attempts && round >= config.attempts){
+        finish(error, asio::ip::tcp::socket(ctx));
+        return;
+    }
+
+    auto delay = config.backoff * (int64_t(1) << std::min<uint32_t>(round - 1, 16));
+    delay = std::min(delay, config.max_backoff);
+    DLOG_DEBUG << "connect to " << host << " failed: " << error.message() << " - retrying in " << delay.count() << "ms\n";
+
+    backoff_timer = timers.schedule(delay, [self = shared_from_this()](){
+        self->resolve();
+    });
+}
+
+void Connector::drop_attempts() {
+    ++generation;
+    timers.cancel(stagger_timer);
+    timers.cancel(round_timer);
+    resolver.cancel();
+
+    asio::error_code ignored;
+    for(auto& soc : attempts){
+        if(soc->is_open()) soc->close(ignored);
+    }
+    attempts.clear();
+    candidates.clear();
+    next_candidate = 0;
+    pending = 0;
+}
+
+void Connector::finish(const asio::error_code& error, asio::ip::tcp::socket&& soc) {
+    done = true;
+
+    Handler complete = std::move(handler); // drop the handler's captures once it ran
+    handler = nullptr;
+    if(complete) complete(error, std::move(soc));
+}
+
+}
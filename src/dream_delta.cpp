@@ -0,0 +1,264 @@
+#include "dream_delta.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+// kernel selection happens at compile time - define DREAM_NO_SIMD to force the scalar fallback
+#ifndef DREAM_NO_SIMD
+    #if defined(__AVX2__)
+        #define DREAM_DELTA_AVX2
+    #elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #define DREAM_DELTA_SSE2
+    #endif
+#endif
+
+#if defined(DREAM_DELTA_AVX2) || defined(DREAM_DELTA_SSE2)
+#include <immintrin.h>
+#endif
+
+namespace dream {
+
+namespace delta {
+
+void xor_bytes(char* out, const char* a, const char* b, size_t length) {
+    size_t i = 0;
+#if defined(DREAM_DELTA_AVX2)
+    for(; i + 32 <= length; i += 32){
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_xor_si256(va, vb));
+    }
+#elif defined(DREAM_DELTA_SSE2)
+    for(; i + 16 <= length; i += 16){
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(va, vb));
+    }
+#endif
+    for(; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)){ // scalar word loop - memcpy keeps this alignment safe
+        uint64_t wa, wb;
+        memcpy(&wa, a + i, sizeof(wa));
+        memcpy(&wb, b + i, sizeof(wb));
+        wa ^= wb;
+        memcpy(out + i, &wa, sizeof(wa));
+    }
+    for(; i < length; ++i){
+        out[i] = char(a[i] ^ b[i]);
+    }
+}
+
+size_t count_zero(const char* data, size_t length) {
+    size_t i = 0;
+#if defined(DREAM_DELTA_AVX2)
+    const __m256i zero = _mm256_setzero_si256();
+    for(; i + 32 <= length; i += 32){
+        uint32_t mask = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), zero)));
+        if(mask != UINT32_MAX) return i + std::countr_one(mask);
+    }
+#elif defined(DREAM_DELTA_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 16 <= length; i += 16){
+        uint32_t mask = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), zero)));
+        if(mask != 0xFFFF) return i + std::countr_one(mask);
+    }
+#endif
+    for(; i < length && data[i] == 0; ++i);
+    return i;
+}
+
+size_t find_zero(const char* data, size_t length) {
+    size_t i = 0;
+#if defined(DREAM_DELTA_AVX2)
+    const __m256i zero = _mm256_setzero_si256();
+    for(; i + 32 <= length; i += 32){
+        uint32_t mask = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), zero)));
+        if(mask) return i + std::countr_zero(mask);
+    }
+#elif defined(DREAM_DELTA_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 16 <= length; i += 16){
+        uint32_t mask = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), zero)));
+        if(mask) return i + std::countr_zero(mask);
+    }
+#endif
+    for(; i < length && data[i] != 0; ++i);
+    return i;
+}
+
+void write_varint(std::string& out, uint64_t value) {
+    while(value >= 0x80){
+        out.push_back(char((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+bool read_varint(const char*& data, const char* end, uint64_t& value) {
+    value = 0;
+    for(int shift = 0; shift < 64; shift += 7){
+        if(data == end) return false;
+        uint8_t byte = uint8_t(*data++);
+        value |= uint64_t(byte & 0x7F) << shift;
+        if(!(byte & 0x80)) return true;
+    }
+    return false; // varint too long
+}
+
+std::string encode(const std::string& baseline, const std::string& current) {
+    const size_t length = current.size();
+    const size_t common = std::min(length, baseline.size());
+
+    std::string diff(length, '\0');
+    xor_bytes(diff.data(), current.data(), baseline.data(), common);
+    std::copy(current.begin() + common, current.end(), diff.begin() + common); // bytes past the baseline are xor'd against zero
+
+    std::string out;
+    write_varint(out, length);
+
+    const char* raw = diff.data();
+    size_t pos = 0;
+    while(pos < length){
+        size_t skip = count_zero(raw + pos, length - pos);
+        pos += skip;
+        if(pos == length) break; // trailing zeros are implied
+
+        size_t start = pos;
+        while(pos < length){ // extend the literal until a zero run worth skipping is found
+            pos += find_zero(raw + pos, length - pos);
+            if(pos == length) break;
+
+            size_t run = count_zero(raw + pos, std::min(MIN_ZERO_RUN, length - pos));
+            if(run >= MIN_ZERO_RUN || pos + run == length) break;
+            pos += run;
+        }
+
+        write_varint(out, skip);
+        write_varint(out, pos - start);
+        out.append(raw + start, pos - start);
+    }
+
+    return out;
+}
+
+bool decode(const std::string& baseline, const std::string& data, std::string& current) {
+    const char* it = data.data();
+    const char* end = it + data.size();
+
+    uint64_t length;
+    if(!read_varint(it, end, length)) return false;
+    if(length > MAX_LENGTH) return false; // the length is untrusted - never allocate from it unchecked
+
+    std::string result(length, '\0');
+    std::copy_n(baseline.begin(), std::min<size_t>(length, baseline.size()), result.begin());
+
+    uint64_t pos = 0;
+    while(it != end){
+        uint64_t skip, count;
+        if(!read_varint(it, end, skip) || !read_varint(it, end, count)) return false;
+        if(skip > length - pos || count > length - pos - skip || count > uint64_t(end - it)) return false; // corrupt delta
+
+        pos += skip;
+        xor_bytes(result.data() + pos, result.data() + pos, it, count);
+        pos += count;
+        it += count;
+    }
+
+    current = std::move(result);
+    return true;
+}
+
+Baseline::Baseline(): sequence(0), base_sequence(0) {}
+
+std::string Baseline::encode(std::string&& current) {
+    if(++sequence == 0) sequence = 1; // sequence 0 is reserved for the empty state
+
+    std::string out;
+    write_varint(out, base_sequence);
+    write_varint(out, sequence);
+    out += delta::encode(base, current);
+
+    history.emplace_back(sequence, std::move(current));
+    while(history.size() > MAX_HISTORY) history.pop_front(); // receiver is not acknowledging - drop the oldest
+
+    return out;
+}
+
+std::deque<Baseline::State>::iterator Baseline::find(uint32_t seq) {
+    return std::find_if(history.begin(), history.end(), [seq](const State& state){ return state.first == seq; });
+}
+
+void Baseline::acknowledge(uint32_t seq) {
+    if(seq == 0){ // the receiver lost our baseline - the next delta is encoded against the empty state
+        base.clear();
+        base_sequence = 0;
+        return;
+    }
+
+    auto it = find(seq);
+    if(it == history.end()) return; // stale or duplicate acknowledgement
+
+    base = std::move(it->second);
+    base_sequence = seq;
+    history.erase(history.begin(), ++it); // older states can never become the baseline again
+}
+
+bool Baseline::decode(const std::string& data, std::string& current, uint32_t& seq) {
+    const char* it = data.data();
+    const char* end = it + data.size();
+
+    uint64_t base_seq, new_seq;
+    if(!read_varint(it, end, base_seq) || !read_varint(it, end, new_seq)) return false;
+
+    if(new_seq == 0 || new_seq > UINT32_MAX || base_seq > UINT32_MAX) return false;
+
+    static const std::string empty;
+    const std::string* state = &empty;
+    auto found = history.end();
+    if(base_seq){
+        found = find(uint32_t(base_seq));
+        if(found == history.end()){
+            seq = 0; // unknown baseline - acknowledge 0 to get a full state
+            return false;
+        }
+        if(sequence && !is_newer(uint32_t(new_seq), sequence)) return false; // duplicate or reordered delta - the newer state is already applied
+        state = &found->second;
+    } // a full state is always accepted - the sender may have been reset
+
+    std::string result;
+    if(!delta::decode(*state, std::string(it, end), result)) return false;
+
+    if(base_seq) history.erase(history.begin(), found); // the sender will never reference older states again
+    else history.clear();
+
+    seq = uint32_t(new_seq);
+    history.emplace_back(seq, result);
+    sequence = seq;
+    base_sequence = uint32_t(base_seq);
+    while(history.size() > MAX_HISTORY + 1){ // keep the base state - drop the oldest applied state after it
+        history.erase(history.front().first == base_sequence ? std::next(history.begin()) : history.begin());
+    }
+
+    current = std::move(result);
+    return true;
+}
+
+void Baseline::reset() {
+    sequence = base_sequence = 0;
+    base.clear();
+    history.clear();
+}
+
+const char* backend() {
+#if defined(DREAM_DELTA_AVX2)
+    return "avx2";
+#elif defined(DREAM_DELTA_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+}
+
+}
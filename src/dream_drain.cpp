@@ -0,0 +1,68 @@
+#include "dream_drain.h"
+
+namespace dream {
+
+Drain::~Drain() {
+    abort();
+}
+
+bool Drain::prepare() {
+    if(state){
+        std::scoped_lock lock(state->lock);
+        if(!state->aborted) return false; // set by the drain thread once it is done waiting
+    }
+    if(handle.joinable()) handle.join();
+
+    state = std::make_shared<State>();
+    return true;
+}
+
+std::function<void(bool)> Drain::track() {
+    {
+        std::scoped_lock lock(state->lock);
+        ++state->pending;
+    }
+
+    return [drain = state](bool flushed){
+        {
+            std::scoped_lock lock(drain->lock);
+            if(!flushed) drain->failed = true;
+            if(--drain->pending) return;
+        }
+        drain->signal.notify_all();
+    };
+}
+
+std::future<bool> Drain::start(std::chrono::milliseconds deadline, std::function<void()> finish) {
+    std::promise<bool> done;
+    auto result = done.get_future();
+    const auto until = std::chrono::steady_clock::now() + deadline;
+
+    handle = std::thread([drain = state, until, finish = std::move(finish), done = std::move(done)]() mutable {
+        bool flushed;
+        {
+            std::unique_lock<std::mutex> lock(drain->lock);
+            drain->signal.wait_until(lock, until, [&drain](){ return !drain->pending || drain->aborted; });
+            flushed = !drain->pending && !drain->failed;
+            drain->aborted = true; // handlers that run late change nothing - and the next prepare may go ahead
+        }
+
+        finish();
+        done.set_value(flushed);
+    });
+
+    return result;
+}
+
+void Drain::abort() {
+    if(state){
+        {
+            std::scoped_lock lock(state->lock);
+            state->aborted = true;
+        }
+        state->signal.notify_all();
+    }
+    if(handle.joinable() && handle.get_id() != std::this_thread::get_id()) handle.join();
+}
+
+}
@@ -0,0 +1,44 @@
+#include "dream_io.h"
+#include "dream_uring.h"
+#include "dream_externs.h"
+
+namespace dream {
+
+IoWorker::IoWorker(): idle(ctx), timers(ctx) {}
+
+IoWorker::~IoWorker() {
+    stop();
+    uring.reset(); // before the io context it watches
+}
+
+void IoWorker::start() {
+    if(handle.joinable()) return;
+
+    handle = std::thread([this](){
+        Log::set_thread_overflow(Log::DROP); // a full log ring must not stall the network path
+        ctx.run();
+    });
+}
+
+void IoWorker::stop() {
+    timers.stop();
+    ctx.stop(); // first send stop signal to io context
+
+    if(handle.joinable()){
+        handle.join(); // close context handle
+    }
+
+    ctx.reset();
+}
+
+UringDriver* IoWorker::get_uring() {
+    std::call_once(uring_once, [this](){
+        uring = UringDriver::create(ctx);
+        if(!uring){
+            DLOG_WARN << "io_uring is not available - sockets stay on the reactor\n";
+        }
+    });
+    return uring.get();
+}
+
+}
\ No newline at end of file
@@ -1,15 +1,225 @@
 #include "dream_log.h"
 
+#include <utility>
+#include <algorithm>
+
 namespace dream {
 
-Log::Log(): _stream(nullptr), output(_stream) {}
+// single producer / single consumer ring - the owning thread pushes and the writer pops
+struct Log::Ring {
+    std::string slots[RING_SIZE];
+    alignas(64) std::atomic<size_t> head; // next slot to read - owned by the writer
+    alignas(64) std::atomic<size_t> tail; // next slot to write - owned by the producer
+
+    Ring(): head(0), tail(0) {}
+
+    bool push(std::string& line) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) == RING_SIZE) return false; // full
+
+        slots[t & (RING_SIZE - 1)] = std::move(line);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(std::string& line) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire)) return false; // empty
+
+        line = std::move(slots[h & (RING_SIZE - 1)]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    bool full() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire) == RING_SIZE;
+    }
+};
+
+static std::atomic<uint64_t> _log_instance_counter = 0;
+
+// per-thread formatting state
+static thread_local std::ostringstream _record_stream;
+static thread_local bool _record_stream_busy = false;
+static thread_local std::vector<std::pair<uint64_t, std::shared_ptr<void>>> _ring_cache; // log instance -> ring
+static thread_local int _thread_overflow = -1; // Overflow set by set_thread_overflow - -1 uses the policy of the log
+
+// Record
+
+Log::Record::Record(Log* log): log(log), stream(nullptr) {
+    if(!log) return;
+
+    if(_record_stream_busy){ // a value being formatted logs on its own - give it a private stream
+        nested = std::make_unique<std::ostringstream>();
+        stream = nested.get();
+    } else {
+        _record_stream_busy = true;
+        _record_stream.str("");
+        stream = &_record_stream;
+    }
+}
+
+Log::Record::Record(Record&& o) noexcept: log(o.log), stream(o.stream), nested(std::move(o.nested)) {
+    o.log = nullptr;
+    o.stream = nullptr;
+}
+
+Log::Record::~Record() {
+    if(!log) return;
+
+    std::string line = stream->str();
+    if(!nested) _record_stream_busy = false;
+
+    if(!line.empty()) log->push(std::move(line));
+}
+
+// Log
 
-Log::Log(const std::ostream& out): _stream(out.rdbuf()), output(_stream) {}
+Log::Log(): _stream(nullptr), output(nullptr), instance(++_log_instance_counter),
+    runtime_level(LEVEL_TRACE), overflow(BLOCK), dropped(0), blocked(0), running(false), sleeping(false) {}
+
+Log::Log(const std::ostream& out): _stream(out.rdbuf()), output(out.rdbuf()), instance(++_log_instance_counter),
+    runtime_level(LEVEL_TRACE), overflow(BLOCK), dropped(0), blocked(0), running(false), sleeping(false) {}
+
+Log::~Log() {
+    {
+        std::scoped_lock lock(wake_mtx);
+        running = false;
+    }
+    wake.notify_all();
+
+    if(writer.joinable()){
+        writer.join();
+    }
+
+    flush(); // write anything left behind by the writer
+}
+
+Log::Record Log::record(Level level) {
+    if(level < runtime_level || _stream.load(std::memory_order_relaxed) == nullptr) // this is 3x faster
+        return Record(nullptr);
+
+    return Record(this);
+}
+
+Log& Log::flush() {
+    std::scoped_lock lock(write_mtx);
+    while(drain());
+    output.flush();
+    return *this;
+}
 
 Log& Log::redirect(const std::ostream& stream) {
+    std::scoped_lock lock(write_mtx);
     _stream = stream.rdbuf();
     output.rdbuf(_stream);
     return *this;
 }
 
-}
\ No newline at end of file
+Log::Ring& Log::local_ring() {
+    for(auto& [id, ring] : _ring_cache){
+        if(id == instance) return *static_cast<Ring*>(ring.get());
+    }
+
+    auto ring = std::make_shared<Ring>();
+    {
+        std::scoped_lock lock(ring_mtx);
+        rings.push_back(ring);
+
+        if(!running && !writer.joinable()){ // the writer starts with the first record so static logs spawn no threads
+            running = true;
+            writer = std::thread(&Log::writer_loop, this);
+        }
+    }
+    _ring_cache.emplace_back(instance, ring);
+
+    return *ring;
+}
+
+void Log::set_thread_overflow(Overflow policy) {
+    _thread_overflow = policy;
+}
+
+void Log::push(std::string&& line) {
+    Ring& ring = local_ring();
+    const Overflow policy = _thread_overflow >= 0 ? Overflow(_thread_overflow) : overflow.load();
+
+    while(!ring.push(line)){
+        if(policy == DROP || !running){ // nobody makes room once the writer stopped
+            ++dropped;
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mtx); // ring is full - wait for the writer to make room
+        ++blocked;
+        sleeping = false;
+        wake.notify_all();
+        wake.wait(lock, [&](){ return !ring.full() || !running; });
+        --blocked;
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the writer - either it sees this record or we see it parked
+    if(sleeping.exchange(false)){ // only pay for a wake up when the writer is parked
+        std::scoped_lock lock(wake_mtx);
+        wake.notify_all();
+    }
+}
+
+bool Log::pending() {
+    std::scoped_lock lock(ring_mtx);
+    return std::any_of(rings.begin(), rings.end(), [](const std::shared_ptr<Ring>& r){ return !r->empty(); });
+}
+
+bool Log::drain() {
+    std::vector<std::shared_ptr<Ring>> list;
+    {
+        std::scoped_lock lock(ring_mtx);
+        // rings of exited threads are only referenced here - remove them once they have been emptied
+        std::erase_if(rings, [](const std::shared_ptr<Ring>& r){ return r.use_count() == 1 && r->empty(); });
+        list = rings;
+    }
+
+    bool written = false;
+    std::string line;
+    for(auto& ring : list){
+        while(ring->pop(line)){
+            if(output.rdbuf() != nullptr)
+                output << line;
+            written = true;
+        }
+    }
+
+    return written;
+}
+
+void Log::writer_loop() {
+    while(running){
+        bool written;
+        {
+            std::scoped_lock lock(write_mtx);
+            written = drain();
+            if(written) output.flush();
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mtx);
+        if(written){
+            if(blocked) wake.notify_all(); // producers waiting for room in a full ring
+            continue;
+        }
+
+        sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with push - a record pushed before we parked is seen here
+        if(pending()){
+            sleeping = false;
+            continue;
+        }
+        wake.wait(lock, [this](){ return !running || !sleeping; }); // no polling - push and the destructor wake us
+        sleeping = false;
+    }
+}
+
+}
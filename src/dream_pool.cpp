@@ -0,0 +1,146 @@
+#include "dream_pool.h"
+
+namespace dream {
+
+static thread_local RuntimePool* current_pool = nullptr; // the pool the calling thread belongs to
+static thread_local size_t current_queue = 0;
+
+RuntimePool::RuntimePool(): next_queue(0), pending(0), sleepers(0), running(false), tasks(0), steals(0) {}
+
+RuntimePool::~RuntimePool() {
+    stop();
+}
+
+void RuntimePool::start(size_t count, Task run_task) {
+    stop();
+
+    task = std::move(run_task);
+    queues.clear();
+    for(size_t i = 0; i < std::max<size_t>(1, count); ++i){
+        queues.emplace_back(std::make_unique<Queue>());
+    }
+
+    running = true;
+    for(size_t i = 0; i < queues.size(); ++i){
+        threads.emplace_back([this, i](){ run(i); });
+    }
+}
+
+void RuntimePool::stop() {
+    {
+        std::scoped_lock lock(sleep_lock);
+        running = false;
+    }
+    sleep_signal.notify_all();
+
+    for(auto& thread : threads){
+        if(thread.joinable()) thread.join();
+    }
+    threads.clear();
+
+    for(auto& queue : queues){ // a push that passed the running check may still be adding to a queue
+        std::scoped_lock lock(queue->lock);
+        pending -= queue->ids.size();
+        queue->ids.clear();
+    }
+}
+
+size_t RuntimePool::queue_for_push() {
+    if(current_pool == this) return current_queue; // stays warm on the thread that produced it - others steal it if they run dry
+    return next_queue++ % queues.size();
+}
+
+void RuntimePool::push(uint64_t id) {
+    if(!running) return;
+
+    Queue& queue = *queues[queue_for_push()];
+    {
+        std::scoped_lock lock(queue.lock);
+        queue.ids.push_back(id);
+    }
+    ++pending;
+    wake(1);
+}
+
+void RuntimePool::push(const std::vector<uint64_t>& ids) {
+    if(!running || ids.empty()) return;
+
+    const size_t count = std::min(ids.size(), queues.size());
+    const size_t first = current_pool == this ? current_queue : next_queue.fetch_add(count);
+    for(size_t q = 0; q < count; ++q){ // a contiguous share per queue - one lock per queue
+        Queue& queue = *queues[(first + q) % queues.size()];
+        std::scoped_lock lock(queue.lock);
+        for(size_t i = q; i < ids.size(); i += count){
+            queue.ids.push_back(ids[i]);
+        }
+    }
+    pending += ids.size();
+    wake(count);
+}
+
+void RuntimePool::wake(size_t count) {
+    if(!sleepers) return; // seen after pending was raised - a thread that goes to sleep now checks pending under the lock
+
+    std::scoped_lock lock(sleep_lock);
+    if(count > 1) sleep_signal.notify_all();
+    else sleep_signal.notify_one();
+}
+
+bool RuntimePool::pop(size_t index, uint64_t& id) {
+    Queue& queue = *queues[index];
+    std::scoped_lock lock(queue.lock);
+    if(queue.ids.empty()) return false;
+
+    id = queue.ids.front(); // oldest first - a socket queued again waits behind the others
+    queue.ids.pop_front();
+    --pending;
+    return true;
+}
+
+bool RuntimePool::steal(size_t index, uint64_t& id) {
+    Queue& own = *queues[index];
+
+    for(size_t i = 1; i < queues.size(); ++i){
+        Queue& victim = *queues[(index + i) % queues.size()];
+        std::unique_lock<std::mutex> lock(victim.lock, std::try_to_lock); // a busy queue is skipped rather than waited for
+        if(!lock || victim.ids.empty()) continue;
+
+        const size_t take = (victim.ids.size() + 1) / 2; // the newer half - the owner keeps working on the oldest ids
+        std::vector<uint64_t> taken(victim.ids.end() - take, victim.ids.end());
+        victim.ids.erase(victim.ids.end() - take, victim.ids.end());
+        lock.unlock();
+
+        id = taken.front();
+        if(taken.size() > 1){
+            std::scoped_lock own_lock(own.lock);
+            own.ids.insert(own.ids.end(), taken.begin() + 1, taken.end());
+        }
+        --pending;
+        steals += take;
+        return true;
+    }
+    return false;
+}
+
+void RuntimePool::run(size_t index) {
+    current_pool = this;
+    current_queue = index;
+
+    while(running){
+        uint64_t id;
+        if(pop(index, id) || steal(index, id)){
+            ++tasks;
+            task(id);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_lock);
+        ++sleepers;
+        sleep_signal.wait(lock, [this](){ return pending > 0 || !running; });
+        --sleepers;
+    }
+
+    current_pool = nullptr;
+}
+
+}
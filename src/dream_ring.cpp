@@ -0,0 +1,505 @@
+#include "dream_stream.h"
+#include "dream_externs.h"
+
+#include <bit>
+#include <new>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS) && !defined(_WIN32)
+#define DREAM_RING_SHM
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#endif
+
+namespace dream {
+
+#ifdef DREAM_RING_SHM
+
+using local = asio::local::stream_protocol;
+
+static constexpr uint32_t RING_MAGIC = 0x474e5244; // "DRNG"
+static constexpr uint32_t RING_VERSION = 1;
+static constexpr uint32_t MAX_NAME = 255;
+
+struct RingHeader {
+    alignas(64) std::atomic<uint64_t> head; // read position - written by the consumer
+    alignas(64) std::atomic<uint64_t> tail; // write position - written by the producer
+    alignas(64) std::atomic<uint32_t> reader_waiting; // the consumer ran dry and waits for a doorbell
+    std::atomic<uint32_t> writer_waiting; // the producer ran full and waits for a doorbell
+};
+
+struct SegmentLayout {
+    uint32_t magic, version;
+    uint64_t capacity; // bytes per ring - a power of 2
+    RingHeader rings[2]; // 0 carries server to client, 1 client to server
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring positions are shared between processes");
+
+struct RingStream::Segment {
+    void* base;
+    size_t size;
+    SegmentLayout* layout;
+    uint64_t capacity, mask; // taken once the segment is validated - the peer can rewrite the layout at any time
+
+    Segment(void* base, size_t size, uint64_t capacity): base(base), size(size), layout(static_cast<SegmentLayout*>(base)), capacity(capacity), mask(capacity - 1) {}
+    ~Segment() { munmap(base, size); }
+
+    static size_t bytes(uint64_t capacity) { return sizeof(SegmentLayout) + capacity * 2; }
+    char* data(int ring) { return static_cast<char*>(base) + sizeof(SegmentLayout) + capacity * ring; }
+    RingHeader& header(int ring) { return layout->rings[ring]; }
+
+    static std::unique_ptr<Segment> create(const std::string& name, size_t capacity) {
+        const uint64_t rounded = std::bit_ceil(std::max<uint64_t>(capacity, 4096));
+        const size_t size = bytes(rounded);
+
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if(fd < 0) return nullptr;
+        void* base = ftruncate(fd, off_t(size)) == 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if(base == MAP_FAILED){
+            shm_unlink(name.c_str());
+            return nullptr;
+        }
+
+        SegmentLayout* layout = new(base) SegmentLayout;
+        layout->magic = RING_MAGIC;
+        layout->version = RING_VERSION;
+        layout->capacity = rounded;
+        for(RingHeader& ring : layout->rings){
+            ring.head = 0;
+            ring.tail = 0;
+            ring.reader_waiting = 0;
+            ring.writer_waiting = 0;
+        }
+        return std::make_unique<Segment>(base, size, rounded);
+    }
+
+    static std::unique_ptr<Segment> open(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0600);
+        if(fd < 0) return nullptr;
+
+        struct stat info;
+        void* base = fstat(fd, &info) == 0 && size_t(info.st_size) > sizeof(SegmentLayout) ? mmap(nullptr, size_t(info.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if(base == MAP_FAILED) return nullptr;
+
+        const SegmentLayout* layout = static_cast<const SegmentLayout*>(base);
+        const uint64_t capacity = layout->capacity; // read once - checked and kept
+        if(layout->magic != RING_MAGIC || layout->version != RING_VERSION || !std::has_single_bit(capacity) || capacity > uint64_t(info.st_size) || bytes(capacity) != size_t(info.st_size)){
+            munmap(base, size_t(info.st_size));
+            return nullptr;
+        }
+        return std::make_unique<Segment>(base, size_t(info.st_size), capacity);
+    }
+};
+
+struct RingStream::Doorbell {
+    local::socket socket;
+    Doorbell(local::socket&& socket): socket(std::move(socket)) {}
+};
+
+// Ring Stream
+
+RingStream::RingStream(asio::io_context& ctx, std::unique_ptr<Segment>&& segment, std::unique_ptr<Doorbell>&& doorbell, bool server_side):
+    ctx(ctx), segment(std::move(segment)), doorbell(std::move(doorbell)), in_ring(server_side ? 1 : 0), out_ring(server_side ? 0 : 1),
+    open(true), peer_closed(false) {}
+
+RingStream::~RingStream() { // nobody is left to complete - the owning Socket is gone
+    open = false;
+    asio::error_code ignored;
+    doorbell->socket.close(ignored);
+}
+
+void RingStream::start() {
+    wait_bell();
+}
+
+void RingStream::close() {
+    std::scoped_lock guard(lock); // ring() uses the descriptor under the lock
+    shutdown(asio::error::operation_aborted);
+}
+
+void RingStream::shutdown(const asio::error_code& error) {
+    if(!open.exchange(false)) return;
+
+    asio::error_code ignored;
+    doorbell->socket.shutdown(local::socket::shutdown_both, ignored); // the peer reads eof on its doorbell
+    doorbell->socket.close(ignored);
+
+    if(pending_read) post(std::move(pending_read), error, 0);
+    if(pending_write) post(std::move(pending_write), error, 0);
+}
+
+void RingStream::post(RingCompletion&& handler, const asio::error_code& error, size_t bytes) {
+    asio::post(ctx, [handler = std::move(handler), error, bytes]() mutable { handler(error, bytes); });
+}
+
+// the positions live in memory the peer can write - a ring holding more than its capacity is a protocol error
+size_t RingStream::try_read(asio::mutable_buffer buffer, bool& corrupt) {
+    RingHeader& ring = segment->header(in_ring);
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+    const uint64_t used = ring.tail.load(std::memory_order_acquire) - head;
+    if(used > segment->capacity) return corrupt = true, 0;
+
+    const size_t count = size_t(std::min<uint64_t>(used, buffer.size()));
+    if(!count) return 0;
+
+    const size_t at = size_t(head & segment->mask);
+    const size_t first = std::min<size_t>(count, segment->capacity - at);
+    std::memcpy(buffer.data(), segment->data(in_ring) + at, first);
+    std::memcpy(static_cast<char*>(buffer.data()) + first, segment->data(in_ring), count - first);
+
+    ring.head.store(head + count, std::memory_order_seq_cst); // ordered before the flag check - see the waiting sides
+    if(ring.writer_waiting.load(std::memory_order_seq_cst) && ring.writer_waiting.exchange(0)) this->ring();
+    return count;
+}
+
+size_t RingStream::try_write(asio::const_buffer buffer, bool& corrupt) {
+    RingHeader& ring = segment->header(out_ring);
+    const uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    const uint64_t used = tail - ring.head.load(std::memory_order_acquire);
+    if(used > segment->capacity) return corrupt = true, 0;
+
+    const size_t count = size_t(std::min<uint64_t>(segment->capacity - used, buffer.size()));
+    if(!count) return 0;
+
+    const size_t at = size_t(tail & segment->mask);
+    const size_t first = std::min<size_t>(count, segment->capacity - at);
+    std::memcpy(segment->data(out_ring) + at, buffer.data(), first);
+    std::memcpy(segment->data(out_ring), static_cast<const char*>(buffer.data()) + first, count - first);
+
+    ring.tail.store(tail + count, std::memory_order_seq_cst);
+    if(ring.reader_waiting.load(std::memory_order_seq_cst) && ring.reader_waiting.exchange(0)) this->ring();
+    return count;
+}
+
+void RingStream::ring() { // with the lock held
+    if(!open) return;
+    const char bell = 1;
+    ::send(doorbell->socket.native_handle(), &bell, 1, MSG_DONTWAIT | MSG_NOSIGNAL); // a full socket already holds a wake up
+}
+
+void RingStream::wait_bell() {
+    doorbell->socket.async_read_some(asio::buffer(bell_in), [self = shared_from_this()](const asio::error_code& error, size_t){
+        if(error) self->peer_closed = true; // the peer closed or died - nothing more will be written
+        self->wake();
+        if(!error) self->wait_bell();
+    });
+}
+
+void RingStream::wake() {
+    std::scoped_lock guard(lock);
+    complete_read();
+    complete_write();
+}
+
+bool RingStream::complete_read() {
+    if(!pending_read) return true;
+
+    RingHeader& ring = segment->header(in_ring);
+    for(int attempt = 0; attempt < 2; ++attempt){
+        bool corrupt = false;
+        size_t count = try_read(read_buffer, corrupt);
+        if(corrupt){
+            DLOG_ERROR << "shared memory ring was corrupted by the peer - closing the stream\n";
+            shutdown(asio::error::invalid_argument);
+            return true;
+        }
+        if(count){
+            ring.reader_waiting = 0;
+            post(std::move(pending_read), {}, count);
+            return true;
+        }
+        if(peer_closed){
+            post(std::move(pending_read), asio::error::eof, 0);
+            return true;
+        }
+        ring.reader_waiting.store(1, std::memory_order_seq_cst); // then look again - the producer checks the flag after publishing
+    }
+    return false;
+}
+
+bool RingStream::complete_write() {
+    if(!pending_write) return true;
+
+    RingHeader& ring = segment->header(out_ring);
+    for(int attempt = 0; attempt < 2; ++attempt){
+        if(peer_closed){
+            post(std::move(pending_write), asio::error::broken_pipe, 0);
+            return true;
+        }
+        bool corrupt = false;
+        size_t count = try_write(write_buffer, corrupt);
+        if(corrupt){
+            DLOG_ERROR << "shared memory ring was corrupted by the peer - closing the stream\n";
+            shutdown(asio::error::invalid_argument);
+            return true;
+        }
+        if(count){
+            ring.writer_waiting = 0;
+            post(std::move(pending_write), {}, count);
+            return true;
+        }
+        ring.writer_waiting.store(1, std::memory_order_seq_cst);
+    }
+    return false;
+}
+
+void RingStream::read_some(asio::mutable_buffer buffer, RingCompletion&& handler) {
+    if(!open) return post(std::move(handler), asio::error::bad_descriptor, 0);
+    if(!buffer.size()) return post(std::move(handler), {}, 0);
+
+    std::scoped_lock guard(lock);
+    read_buffer = buffer;
+    pending_read = std::move(handler);
+    complete_read();
+}
+
+void RingStream::write_some(asio::const_buffer buffer, RingCompletion&& handler) {
+    if(!open) return post(std::move(handler), asio::error::bad_descriptor, 0);
+    if(!buffer.size()) return post(std::move(handler), {}, 0);
+
+    std::scoped_lock guard(lock);
+    write_buffer = buffer;
+    pending_write = std::move(handler);
+    complete_write();
+}
+
+// Ring Listener
+
+static std::string segment_name() {
+    static std::atomic<uint32_t> counter(0);
+    return "/dream-ring-" + std::to_string(getpid()) + "-" + std::to_string(++counter) + "-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count() & 0xFFFFFF);
+}
+
+struct RingListener::Acceptor : std::enable_shared_from_this<RingListener::Acceptor> {
+    local::acceptor acceptor;
+    std::string path;
+    size_t capacity;
+    std::function<IoWorker&()> next_worker;
+    Handler handler;
+    std::atomic_bool running;
+
+    Acceptor(asio::io_context& ctx): acceptor(ctx), capacity(RingStream::DEFAULT_CAPACITY), running(true) {}
+
+    void do_accept() {
+        IoWorker& worker = next_worker();
+        acceptor.async_accept(worker.ctx, [self = shared_from_this(), &worker](const asio::error_code& error, local::socket socket){
+            if(!self->running || error == asio::error::operation_aborted) return;
+            if(!error) self->handshake(worker, std::move(socket));
+            self->do_accept();
+        });
+    }
+
+    // send the segment name and wait for the peer to map it
+    void handshake(IoWorker& worker, local::socket&& socket) {
+        struct Pending {
+            local::socket socket;
+            std::unique_ptr<RingStream::Segment> segment;
+            std::string name, hello;
+            char ack;
+            TimerId timeout;
+            Pending(local::socket&& socket): socket(std::move(socket)), ack(0), timeout(0) {}
+            ~Pending() { shm_unlink(name.c_str()); } // mapped by both sides or abandoned
+        };
+
+        auto pending = std::make_shared<Pending>(std::move(socket));
+        pending->name = segment_name();
+        pending->segment = RingStream::Segment::create(pending->name, capacity);
+        if(!pending->segment){
+            DLOG_ERROR << "shared memory segment could not be created\n";
+            return;
+        }
+
+        uint32_t length = uint32_t(pending->name.size());
+        pending->hello.assign(reinterpret_cast<const char*>(&length), sizeof(length));
+        pending->hello += pending->name;
+
+        pending->timeout = worker.timers.schedule(std::chrono::seconds(3), [pending](){ // the handlers run on the same thread
+            asio::error_code ignored;
+            pending->socket.close(ignored);
+        });
+
+        asio::async_write(pending->socket, asio::buffer(pending->hello), [self = shared_from_this(), pending, &worker](const asio::error_code& error, size_t){
+            if(error) return (void)worker.timers.cancel(pending->timeout);
+            asio::async_read(pending->socket, asio::buffer(&pending->ack, 1), [self, pending, &worker](const asio::error_code& error, size_t){
+                worker.timers.cancel(pending->timeout);
+                if(error || !self->running) return;
+
+                auto rings = std::make_shared<RingStream>(worker.ctx, std::move(pending->segment), std::make_unique<RingStream::Doorbell>(std::move(pending->socket)), true);
+                rings->start();
+                self->handler(worker, SocketStream(worker.ctx, std::move(rings)));
+            });
+        });
+    }
+};
+
+RingListener::RingListener() {}
+
+RingListener::~RingListener() {
+    stop();
+}
+
+bool RingListener::start(IoWorker& worker, const std::string& path, size_t capacity, std::function<IoWorker&()> next_worker, Handler handler) {
+    stop();
+    if(!removeStaleSocket(path)){ // a stale file is removed - a live listener keeps its path
+        DLOG_ERROR << "could not listen on " << path << ": another listener is running there\n";
+        return false;
+    }
+
+    auto fresh = std::make_shared<Acceptor>(worker.ctx);
+    fresh->path = path;
+    fresh->capacity = capacity;
+    fresh->next_worker = std::move(next_worker);
+    fresh->handler = std::move(handler);
+
+    asio::error_code error;
+    fresh->acceptor.open(local(), error);
+    if(!error) fresh->acceptor.bind(local::endpoint(path), error);
+    if(!error) fresh->acceptor.listen(asio::socket_base::max_listen_connections, error);
+    if(error){
+        DLOG_ERROR << "could not listen on " << path << ": " << error.message() << "\n";
+        return false;
+    }
+
+    acceptor = std::move(fresh);
+    asio::post(worker.ctx, [a = acceptor](){ a->do_accept(); });
+    return true;
+}
+
+void RingListener::stop() {
+    if(!acceptor) return;
+
+    acceptor->running = false;
+    asio::post(acceptor->acceptor.get_executor(), [a = acceptor](){ // the acceptor belongs to its io thread
+        asio::error_code ignored;
+        a->acceptor.close(ignored);
+    });
+    std::remove(acceptor->path.c_str());
+    acceptor.reset();
+}
+
+// Ring Connector
+
+struct RingConnector::State {
+    local::socket socket;
+    uint32_t length;
+    std::string name;
+    std::unique_ptr<RingStream::Segment> segment;
+    char ack;
+    Handler handler;
+
+    State(asio::io_context& ctx): socket(ctx), length(0), ack(1) {}
+};
+
+RingConnector::RingConnector(asio::io_context& ctx, TimerWheel& timers): ctx(ctx), timers(timers), state(std::make_unique<State>(ctx)), timeout_timer(0), done(false) {}
+
+RingConnector::~RingConnector() {}
+
+void RingConnector::start(const std::string& path, std::chrono::milliseconds timeout, Handler handler) {
+    state->handler = std::move(handler);
+
+    asio::post(ctx, [self = shared_from_this(), path, timeout](){
+        if(self->done) return;
+        self->timeout_timer = self->timers.schedule(timeout, [self](){ self->finish(asio::error::timed_out); });
+
+        State& s = *self->state;
+        s.socket.async_connect(local::endpoint(path), [self](const asio::error_code& error){
+            if(self->done) return;
+            if(error) return self->finish(error);
+
+            State& s = *self->state;
+            asio::async_read(s.socket, asio::buffer(&s.length, sizeof(s.length)), [self](const asio::error_code& error, size_t){
+                if(self->done) return;
+                State& s = *self->state;
+                if(error) return self->finish(error);
+                if(!s.length || s.length > MAX_NAME) return self->finish(asio::error::invalid_argument);
+
+                s.name.resize(s.length);
+                asio::async_read(s.socket, asio::buffer(s.name), [self](const asio::error_code& error, size_t){
+                    if(self->done) return;
+                    State& s = *self->state;
+                    if(error) return self->finish(error);
+
+                    s.segment = RingStream::Segment::open(s.name);
+                    if(!s.segment) return self->finish(asio::error::access_denied);
+
+                    asio::async_write(s.socket, asio::buffer(&s.ack, 1), [self](const asio::error_code& error, size_t){
+                        if(self->done) return;
+                        self->finish(error);
+                    });
+                });
+            });
+        });
+    });
+}
+
+void RingConnector::cancel() {
+    asio::post(ctx, [self = shared_from_this()](){
+        self->finish(asio::error::operation_aborted);
+    });
+}
+
+void RingConnector::finish(const asio::error_code& error) {
+    if(done.exchange(true)) return;
+    timers.cancel(timeout_timer);
+
+    Handler handler = std::move(state->handler);
+    if(error){
+        asio::error_code ignored;
+        state->socket.close(ignored);
+        if(handler) handler(error, SocketStream(asio::ip::tcp::socket(ctx)));
+        return;
+    }
+
+    auto rings = std::make_shared<RingStream>(ctx, std::move(state->segment), std::make_unique<RingStream::Doorbell>(std::move(state->socket)), false);
+    rings->start();
+    if(handler) handler(error, SocketStream(ctx, std::move(rings)));
+}
+
+#else // no POSIX shared memory - same host peers use tcp
+
+struct RingStream::Segment {};
+struct RingStream::Doorbell {};
+
+RingStream::RingStream(asio::io_context& ctx, std::unique_ptr<Segment>&& segment, std::unique_ptr<Doorbell>&& doorbell, bool server_side):
+    ctx(ctx), in_ring(0), out_ring(0), open(false), peer_closed(true) {}
+RingStream::~RingStream() {}
+void RingStream::start() {}
+void RingStream::close() {}
+void RingStream::post(RingCompletion&& handler, const asio::error_code& error, size_t bytes) {
+    asio::post(ctx, [handler = std::move(handler), error, bytes]() mutable { handler(error, bytes); });
+}
+void RingStream::read_some(asio::mutable_buffer, RingCompletion&& handler) { post(std::move(handler), asio::error::operation_not_supported, 0); }
+void RingStream::write_some(asio::const_buffer, RingCompletion&& handler) { post(std::move(handler), asio::error::operation_not_supported, 0); }
+
+struct RingListener::Acceptor {};
+RingListener::RingListener() {}
+RingListener::~RingListener() {}
+bool RingListener::start(IoWorker&, const std::string& path, size_t, std::function<IoWorker&()>, Handler) {
+    DLOG_ERROR << "shared memory rings are not available on this platform - " << path << " is not served\n";
+    return false;
+}
+void RingListener::stop() {}
+
+struct RingConnector::State {};
+RingConnector::RingConnector(asio::io_context& ctx, TimerWheel& timers): ctx(ctx), timers(timers), timeout_timer(0), done(false) {}
+RingConnector::~RingConnector() {}
+void RingConnector::start(const std::string&, std::chrono::milliseconds, Handler handler) {
+    asio::post(ctx, [self = shared_from_this(), handler = std::move(handler)](){
+        self->done = true;
+        handler(asio::error::operation_not_supported, SocketStream(asio::ip::tcp::socket(self->ctx)));
+    });
+}
+void RingConnector::cancel() {}
+void RingConnector::finish(const asio::error_code&) {}
+
+#endif
+
+}
@@ -0,0 +1,63 @@
+#include "dream_rpc.h"
+
+namespace dream {
+
+uint64_t RpcCalls::add(RpcCallback callback, TimerWheel& timers, std::chrono::milliseconds timeout) {
+    uint64_t id;
+    {
+        std::scoped_lock guard(lock);
+        id = ++next_id;
+        pending.emplace(id, Pending { std::move(callback), &timers, 0 });
+    }
+    if(!timeout.count()) return id;
+
+    TimerId deadline = timers.schedule(timeout, [weak = weak_from_this(), id](){
+        if(auto calls = weak.lock()) calls->complete(id, { RPC_TIMED_OUT, {} });
+    });
+
+    {
+        std::scoped_lock guard(lock);
+        auto call = pending.find(id);
+        if(call != pending.end()){
+            call->second.deadline = deadline;
+            return id;
+        }
+    }
+    timers.cancel(deadline); // answered before the timer was armed - outside the lock, cancel waits for a running timeout that takes it
+    return id;
+}
+
+bool RpcCalls::complete(uint64_t id, RpcResult&& result) {
+    Pending call;
+    {
+        std::scoped_lock guard(lock);
+        auto found = pending.find(id);
+        if(found == pending.end()) return false; // timed out or answered twice
+        call = std::move(found->second);
+        pending.erase(found);
+    }
+
+    if(call.deadline) call.timers->cancel(call.deadline);
+    if(call.callback) call.callback(std::move(result));
+    return true;
+}
+
+void RpcCalls::fail_all(RpcStatus status) {
+    std::unordered_map<uint64_t, Pending> failed;
+    {
+        std::scoped_lock guard(lock);
+        failed.swap(pending);
+    }
+
+    for(auto& [id, call] : failed){
+        if(call.deadline) call.timers->cancel(call.deadline);
+        if(call.callback) call.callback({ status, {} });
+    }
+}
+
+size_t RpcCalls::size() {
+    std::scoped_lock guard(lock);
+    return pending.size();
+}
+
+}
@@ -0,0 +1,111 @@
+#include "dream_runtime.h"
+#include "dream_client.h"
+
+#include <algorithm>
+
+namespace dream {
+
+static constexpr auto IDLE_INTERVAL = std::chrono::seconds(1); // nothing is ready and nothing lingers
+static constexpr auto LINGER_INTERVAL = std::chrono::milliseconds(2); // connecting clients are checked as often as a standalone client runtime
+
+ClientRuntime::ClientRuntime(size_t io_threads): next_worker(0), next_id(0), running(true) {
+    if(!io_threads) io_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+    while(workers.size() < io_threads){
+        workers.emplace_back(std::make_unique<IoWorker>())->start();
+    }
+
+    runtime_handle = std::thread([this](){ runtime_loop(); });
+}
+
+ClientRuntime::~ClientRuntime() {
+    {
+        std::scoped_lock lock(ready_lock);
+        running = false;
+    }
+    ready_signal.notify_all();
+    if(runtime_handle.joinable()){
+        runtime_handle.join();
+    }
+
+    workers.clear(); // stops every io thread
+}
+
+size_t ClientRuntime::get_client_count() {
+    std::scoped_lock lock(clients_lock);
+    return clients.size();
+}
+
+uint64_t ClientRuntime::attach(Client& client) {
+    std::scoped_lock lock(clients_lock);
+    clients.emplace(++next_id, Attached { &client, false });
+    return next_id;
+}
+
+void ClientRuntime::detach(uint64_t id) {
+    std::unique_lock<std::mutex> lock(clients_lock);
+    if(std::this_thread::get_id() != runtime_handle.get_id()){ // on the scheduler thread the update is the caller - or already over
+        idle_signal.wait(lock, [&](){
+            auto client = clients.find(id);
+            return client == clients.end() || !client->second.busy;
+        });
+    }
+    clients.erase(id);
+}
+
+IoWorker& ClientRuntime::next_io_worker() {
+    return *workers[next_worker++ % workers.size()];
+}
+
+void ClientRuntime::mark_ready(uint64_t id) {
+    bool wake;
+    {
+        std::scoped_lock lock(ready_lock);
+        wake = ready_list.empty(); // the scheduler drains the whole list - only the first entry needs a wake up
+        ready_list.push_back(id);
+    }
+    if(wake) ready_signal.notify_one();
+}
+
+void ClientRuntime::runtime_loop() {
+    while(running){
+        std::vector<uint64_t> ready;
+        {
+            std::unique_lock<std::mutex> lock(ready_lock);
+            ready_signal.wait_for(lock, lingering.empty() ? std::chrono::milliseconds(IDLE_INTERVAL) : LINGER_INTERVAL, [this](){
+                return !ready_list.empty() || !running;
+            });
+            std::swap(ready, ready_list);
+        }
+
+        ready.insert(ready.end(), lingering.begin(), lingering.end());
+        lingering.clear();
+
+        std::sort(ready.begin(), ready.end());
+        ready.erase(std::unique(ready.begin(), ready.end()), ready.end());
+
+        for(uint64_t id : ready){
+            Client* client;
+            {
+                std::scoped_lock lock(clients_lock);
+                auto attached = clients.find(id);
+                if(attached == clients.end()) continue; // stopped in the meantime - also by a hook earlier in this pass
+                attached->second.busy = true;
+                client = attached->second.client;
+            }
+
+            const bool linger = client->client_runtime();
+
+            {
+                std::scoped_lock lock(clients_lock);
+                auto attached = clients.find(id);
+                if(attached != clients.end()) attached->second.busy = false; // gone if a hook stopped the client
+            }
+            idle_signal.notify_all();
+
+            if(linger) lingering.push_back(id); // check again shortly
+        }
+    }
+}
+
+}
@@ -3,47 +3,114 @@
 #include <iomanip>
 namespace dream {
 
-Server::Server(): idle(ctx), listener(ctx), header({}), cur_uuid(1), runtime_running(false) {}
+#ifdef DREAM_CONNECTION_LIMIT
+static const AdmissionConfig DEFAULT_ADMISSION { 200.0, 500.0, 2.0, double(DREAM_CONNECTION_LIMIT), 4096 };
+#else
+static const AdmissionConfig DEFAULT_ADMISSION { 0, 0, 0, 0, 0 }; // no admission limits
+#endif
+
+static constexpr auto GC_INTERVAL = std::chrono::seconds(3); // how often released clients are garbage collected
+static constexpr auto LINGER_INTERVAL = std::chrono::milliseconds(50); // how often invalid clients that are still referenced are checked
+static constexpr auto ACCEPT_BACKOFF = std::chrono::milliseconds(100); // pause of a listener after the process ran out of descriptors or memory
+
+static bool is_resource_error(const asio::error_code& er) { // accepting again right away would fail the same way
+    return er == asio::error::no_descriptors || er == asio::error::no_buffer_space || er == asio::error::no_memory ||
+           er == asio::error_code(ENFILE, asio::system_category());
+}
+
+Server::Server(): endpoint(), next_worker(0), accepting(false), accept_round(0), ping_timer(0), io_threads(1), io_backend(IoBackend::REACTOR), backlog(asio::socket_base::max_listen_connections), send_limits(DEFAULT_SEND_LIMITS), receive_limits(DEFAULT_RECEIVE_LIMITS), protocol(DEFAULT_PROTOCOL),
+    header({}), store_config(DEFAULT_STORE_CONFIG), admission(DEFAULT_ADMISSION), admission_timer(0), session_grace(0), session_backlog(Session::DEFAULT_BACKLOG), tick_config(DEFAULT_TICK_CONFIG), paced_sockets(false), runtime_threads(1), runtime_running(false)
+{
+    workers.emplace_back(std::make_unique<IoWorker>());
+    ticks.set_flush([this](){ flush_paced_sockets(); });
+
+    // clients manage their own subscriptions of open topics - see Client::subscribe
+    methods.add(TOPIC_SUBSCRIBE, [this](Connection& user, const std::string& name, RpcReply reply){
+        auto topic = get_topic(name);
+        if(!topic || !topic->is_open()) return (void)reply.fail("no such topic");
+        topic->subscribe(user);
+        reply();
+    });
+    methods.add(TOPIC_UNSUBSCRIBE, [this](Connection& user, const std::string& name, RpcReply reply){
+        auto topic = get_topic(name);
+        if(!topic || !topic->is_open()) return (void)reply.fail("no such topic");
+        topic->unsubscribe(user);
+        reply();
+    });
+
+    // clients ask any shard which one owns a key - see Client::locate_shard
+    methods.add(SHARD_LOCATE, [this](Connection&, const std::string& key, RpcReply reply){
+        auto link = shard.load();
+        if(!link || !link->is_connected()) return (void)reply.fail("not sharded");
+        std::string endpoint = link->locate(key);
+        if(endpoint.empty()) return (void)reply.fail("no owner");
+        reply(endpoint);
+    });
+}
 
 Server::~Server() {
     stop_server();
 }
 
 void Server::start_context_handle() {
-    ctx_handle = std::thread([this](){
-        ctx.run();
-    });
+    for(auto& worker : workers){
+        worker->start();
+    }
 }
 
 void Server::start_runtime() {
     if(!runtime_running){
+        runtime_running = true; // set before the thread exists so an early stop_runtime is never lost
+        if(runtime_threads > 1) update_pool.start(runtime_threads, [this](uint64_t id){ update_socket(id); });
         runtime_handle = std::thread([this](){
-            runtime_running = true;
             while(runtime_running){
-                Clock::sleepMilliseconds(2); // server runtime has 2ms delay
-                server_runtime();
+                server_runtime(); // sleeps until a socket has work
             }
-            
-            do {
-                stop_accept();
-                Clock::sleepMilliseconds(50);
-            } while(connect_protect > 0);
+
+            stop_accept();
         });
     }
 }
 
 void Server::stop_runtime() {
-    runtime_running = false;
-    blobdata.clear();
+    {
+        std::scoped_lock lock(ready_lock);
+        runtime_running = false;
+    }
+    ready_signal.notify_all();
     if(runtime_handle.joinable()){
-        runtime_handle.join();
+        runtime_handle.join(); // before the pool stops - the runtime thread pushes to it
     }
+    update_pool.stop(); // updates in flight finish first
+    held_resumes.clear();
+    blobdata.clear();
 }
 
 bool Server::start_server(short port, const std::string& ip) {
+    ticks.stop();
     stop_accept();
     stop_runtime();
 
+    {
+        std::unique_lock<std::shared_mutex> lock(socket_list_lock); // listener_handle reads the listeners from the io threads
+        listeners.clear(); // listeners hold on to the io context of their worker
+    }
+    while(workers.size() < io_threads) workers.emplace_back(std::make_unique<IoWorker>());
+    if(workers.size() > io_threads){ // a restart without stop_server keeps its clients - their sockets and timers live on the workers
+        bool idle;
+        {
+            std::scoped_lock lock(deferred_lock);
+            idle = deferred_sockets.empty();
+        }
+        if(idle && !get_client_count()) workers.resize(io_threads);
+        else DLOG_WARN << "io threads are not reduced while clients are connected - call stop_server first\n";
+    }
+
+    if(store_config.directory.size() && !blobdata.get_store() && !blobdata.open_store(store_config)){
+        DLOG_ERROR << "block store could not be opened in " << store_config.directory << "\n";
+        return false;
+    }
+
     endpoint = asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port);
 
     try {
@@ -59,35 +126,114 @@ bool Server::start_server(short port, const std::string& ip) {
         return false;
     }
 
+    ping_timer = get_timers().schedule_every(std::chrono::seconds(3), [this](){ // ping all authorized clients
+        std::shared_lock<std::shared_mutex> lock(socket_list_lock);
+        socket_list.for_each([](uint64_t id, Socket& client){
+            if(client.is_authorized()) client.send_command(Command(Command::PING));
+        });
+    });
+
+    paced_sockets = tick_config.rate > 0 && tick_config.paced; // before the first client is accepted
+
     start_context_handle();
     start_runtime();
 
-    dlog << "server started\n";
+    if(tick_config.rate > 0) ticks.start(tick_config.rate, tick_config.spin);
+
+    DLOG_INFO << "server started\n";
 
     return true;
 }
 
+bool Server::start_local(const std::string& path, size_t ring_capacity) {
+    if(!runtime_running) return false;
+
+    return local_listener.start(*workers.front(), path, ring_capacity, [this]() -> IoWorker& { return *workers[next_worker++ % workers.size()]; },
+        [this](IoWorker& worker, SocketStream&& soc){
+            DLOG_INFO << "local connection over shared memory\n";
+            new_client_socket(worker, std::move(soc));
+        });
+}
+
 void Server::stop_server() {
+    drainer.abort(); // its thread closes the server - done again below in case there was none
+    close_server();
+}
+
+std::future<bool> Server::drain(std::chrono::milliseconds deadline) {
+    if(!drainer.prepare()){ // already draining - that drain reports the result
+        std::promise<bool> busy;
+        busy.set_value(false);
+        return busy.get_future();
+    }
+
+    ticks.stop(); // nothing new is produced - the clients only get what is already queued
+    stop_accept();
+    paced_sockets = false;
+
+    {
+        std::shared_lock<std::shared_mutex> lock(socket_list_lock);
+        socket_list.for_each([this](uint64_t id, Socket& client){
+            client.set_paced(false); // without the tick the runtime flushes right away
+            client.when_flushed(drainer.track());
+            client.mark_ready();
+        });
+    }
+
+    return drainer.start(deadline, [this](){ close_server(); });
+}
+
+void Server::close_server() {
+    ticks.stop(); // no simulation runs against a cleared block
     stop_accept();
     stop_runtime();
 
-    ctx.stop(); // first send stop signal to io context
-    while(!ctx.stopped());
-    ctx.reset();
+    for(auto& worker : workers){
+        worker->stop(); // cancel timers and close context handles
+    }
 
-    if(ctx_handle.joinable()){
-        ctx_handle.join(); // close context handle
+    {
+        std::scoped_lock lock(deferred_lock);
+        admission.reject(deferred_sockets.size()); // never admitted - counted as rejected
+        deferred_sockets.clear();
     }
 
     socket_list.clear(); // close all clients
+    sessions.clear();
+
+    {
+        std::scoped_lock lock(resume_lock);
+        resume_requests.clear();
+    }
+
+    ready_list.clear();
+    lingering.clear();
 }
 
 void Server::broadcast_string(const std::string& data) {
     std::shared_lock<std::shared_mutex> lock(socket_list_lock);
 
-    for(auto& [id,client] : socket_list){
-        client->send_command(Command(Command::STRING, data));
-    }
+    socket_list.for_each([&data](uint64_t id, Socket& client){
+        client.send_command(Command(Command::STRING, data));
+    });
+}
+
+std::shared_ptr<Topic> Server::create_topic(const std::string& name, bool open) {
+    std::scoped_lock lock(topics_lock);
+    auto& topic = topics[name];
+    if(!topic) topic = std::make_shared<Topic>(*this, name, open);
+    return topic;
+}
+
+std::shared_ptr<Topic> Server::get_topic(const std::string& name) {
+    std::scoped_lock lock(topics_lock);
+    auto topic = topics.find(name);
+    return topic == topics.end() ? nullptr : topic->second;
+}
+
+void Server::remove_topic(const std::string& name) {
+    std::scoped_lock lock(topics_lock);
+    topics.erase(name);
 }
 
 std::vector<Connection> Server::get_client_list() {
@@ -95,29 +241,98 @@ std::vector<Connection> Server::get_client_list() {
 
     std::shared_lock<std::shared_mutex> lock(socket_list_lock);
 
-    for(const auto& [id, client] : socket_list){
+    list.reserve(socket_list.size());
+    socket_list.for_each([this, &list](uint64_t id, Socket& client){
         Connection& user = list.emplace_back(this);
         user.uuid = id;
-        user.name = client->get_name();
-    }
+        user.name = client.get_name();
+    });
 
     return list;
 }
 
 // Callbacks
 
-void Server::new_client_socket(asio::ip::tcp::socket&& soc) {
-    std::unique_lock<std::shared_mutex> lock(socket_list_lock);
-    while(socket_list.count(cur_uuid)) ++cur_uuid; // find a free uuid
+void Server::admit_client_socket(IoWorker& worker, asio::ip::tcp::socket&& soc) {
+    asio::error_code ec;
+    const auto ep = soc.remote_endpoint(ec);
+    if(ec) return; // peer already gone
+
+    size_t waiting;
+    {
+        std::scoped_lock lock(deferred_lock);
+        waiting = deferred_sockets.size();
+    }
 
-    dlog << "new client [" << cur_uuid << "]\n";
-    auto& c = socket_list.insert_or_assign(
-                                cur_uuid,
-                                generate_socket(std::move(soc), cur_uuid, "NoName")
-                            ).first->second;
+    switch(admission.check(ep.address(), waiting)){
+        case Admission::ADMIT:
+        {
+            DLOG_INFO << "connection from " << ep.address().to_string() << " : " << ep.port() << "\n";
+            new_client_socket(worker, SocketStream(std::move(soc), get_uring(worker)));
+            break;
+        }
+        case Admission::DEFER:
+        {
+            DLOG_DEBUG << "connection from " << ep.address().to_string() << " deferred\n";
+            std::scoped_lock lock(deferred_lock);
+            deferred_sockets.emplace_back(&worker, std::move(soc));
+            if(!get_timers().is_armed(admission_timer)){
+                admission_timer = get_timers().schedule(admission.retry_delay(), [this](){ drain_deferred(); });
+            }
+            break;
+        }
+        case Admission::REJECT:
+        {
+            DLOG_DEBUG << "connection from " << ep.address().to_string() << " rejected\n";
+            soc.close(ec);
+            break;
+        }
+    }
+}
+
+void Server::drain_deferred() { // admit waiting connections as global tokens become available
+    std::unique_lock<std::mutex> lock(deferred_lock);
+
+    while(deferred_sockets.size() && admission.retry()){
+        auto [worker, soc] = std::move(deferred_sockets.front());
+        deferred_sockets.pop_front();
+
+        lock.unlock();
+        if(soc.is_open()) new_client_socket(*worker, SocketStream(std::move(soc), get_uring(*worker)));
+        else admission.reject(); // closed while it waited
+        lock.lock();
+    }
+
+    if(deferred_sockets.size()){
+        admission_timer = get_timers().schedule(admission.retry_delay(), [this](){ drain_deferred(); });
+    }
+}
+
+void Server::new_client_socket(IoWorker& worker, SocketStream&& soc) {
+    if(auto* tcp = soc.tcp_socket()) tcp->set_option(asio::detail::socket_option::integer<SOL_SOCKET, SO_SNDTIMEO>(5000)); // 5 second write timeout
+
+    std::unique_lock<std::shared_mutex> lock(socket_list_lock);
+    uint64_t id = socket_list.emplace([&](uint64_t id){
+        auto client = generate_socket(worker, std::move(soc), id);
+        client->set_ready_handler([this](Socket& c){ mark_socket_ready(c); }); // must be set before the socket is shared
+        client->set_capture(&capture);
+        client->set_send_limits(send_limits);
+        client->set_receive_limits(receive_limits);
+        client->set_paced(paced_sockets);
+
+        ProtocolConfig offer = protocol;
+        if(!session_grace.count()) offer.capabilities &= ~CAP_SESSION; // sessions are only offered while they are kept
+        client->set_protocol(offer);
+        return client;
+    });
+    Socket* c = socket_list.find(id);
     lock.unlock();
+
+    DLOG_DEBUG << "new client [" << id << "]\n";
     // register the on_authorized callback
     c->register_hook("on_authorized", [this](Socket& client, const std::any& data){
+        if(client.get_capabilities() & CAP_SESSION) return; // joined once the session is known - see process_resume_requests
+
         if(on_client_join){
             Connection user(this);
             user.uuid = client.get_id();
@@ -133,111 +348,351 @@ void Server::new_client_socket(asio::ip::tcp::socket&& soc) {
         if(cmd.type == Command::RESPONSE){
             client.send_command(Command::RESPONSE);
         }
+
+        if(cmd.type == Command::RPC_REQUEST){
+            Connection user(this);
+            user.uuid = client.get_id();
+            user.name = client.get_name();
+
+            methods.dispatch(user, cmd);
+        }
+
+        if(cmd.type == Command::RESUME && (client.get_capabilities() & CAP_SESSION)){
+            SessionResume request;
+            if(!Session::decode(cmd, request)) return;
+
+            std::scoped_lock lock(resume_lock);
+            resume_requests.emplace_back(client.get_id(), std::move(request));
+        }
     });
+
+    c->mark_ready(); // the runtime starts the authorization
 }
 
 
-void Server::server_runtime() { // check for and remove invalid clients
-    std::shared_lock<std::shared_mutex> lock(socket_list_lock);
+void Server::mark_socket_ready(Socket& client) {
+    bool wake;
+    {
+        std::scoped_lock lock(ready_lock);
+        wake = ready_list.empty(); // the runtime drains the whole list - only the first entry needs a wake up
+        ready_list.push_back(client.get_id());
+    }
+    if(wake) ready_signal.notify_one();
+}
 
-    for(auto it = socket_list.begin(); it != socket_list.end(); ++it){
-        auto& [id, client] = *it;
+void Server::flush_paced_sockets() {
+    if(!paced_sockets) return;
 
-        if(!client->is_valid()){
-            if(client->is_authorizing() || client->has_weak_references()) continue;
-            dlog << client->get_name() << " disconnected\n";
-            lock.unlock();
-            std::unique_lock<std::shared_mutex> ulock(socket_list_lock);
-            expired_clients.emplace_back(std::move(client)); // move expired client to gc
-            it = socket_list.erase(it); // remove and continue
-            if(it == socket_list.end() || --it == socket_list.end()) break;
-            continue;
+    std::vector<uint64_t> due;
+    {
+        std::shared_lock<std::shared_mutex> lock(socket_list_lock);
+        socket_list.for_each([&due](uint64_t id, Socket& client){
+            if(client.tick_flush()) due.push_back(id);
+        });
+    }
+    if(due.empty()) return;
+
+    {
+        std::scoped_lock lock(ready_lock); // one wake up for the whole tick
+        ready_list.insert(ready_list.end(), due.begin(), due.end());
+    }
+    ready_signal.notify_one();
+}
 
-        } else if(!client->is_authorized()) {
-            client->server_authorize();
+void Server::server_runtime() { // update clients that have work and remove invalid clients
+    std::vector<uint64_t> ready;
+    {
+        std::unique_lock<std::mutex> lock(ready_lock);
+        auto has_work = [this](){ return !ready_list.empty() || !expired_list.empty() || !runtime_running; };
+        if(!has_work()){
+            ready_signal.wait_for(lock, std::chrono::milliseconds(GC_INTERVAL), [&](){ return has_work() || !lingering.empty(); }); // update_socket wakes us for the first lingering socket
+            if(!has_work() && !lingering.empty()) ready_signal.wait_for(lock, LINGER_INTERVAL, has_work); // checked again shortly
+        }
+        std::swap(ready, ready_list);
 
-        } else {
-            client->runtime_update();
+        ready.insert(ready.end(), lingering.begin(), lingering.end());
+        lingering.clear();
+    }
+
+    std::sort(ready.begin(), ready.end());
+    ready.erase(std::unique(ready.begin(), ready.end()), ready.end());
+
+    if(update_pool.is_running()){
+        update_pool.push(ready); // expired sockets come back through expired_list
+    } else {
+        for(uint64_t id : ready){
+            update_socket(id);
         }
     }
 
-    if(ping_timeout.getSeconds() > 3){
-        for(auto& [id, client] : socket_list){
-            if(!client->is_authorized()) continue;
+    std::vector<uint64_t> expired;
+    {
+        std::scoped_lock lock(ready_lock);
+        std::swap(expired, expired_list);
+    }
+
+    if(expired.size()){ // many clients can expire in the same pass - remove them under one exclusive lock
+        std::unique_lock<std::shared_mutex> lock(socket_list_lock);
+        for(uint64_t id : expired){
+            auto client = socket_list.erase(id);
+            if(!client) continue;
+
+            auto session = sessions.find(client->get_session_token());
+            if(session != sessions.end() && session->second == id) sessions.erase(session);
 
-            client->send_command(Command(Command::PING));
+            DLOG_INFO << client->get_name() << " disconnected\n";
+            expired_clients.emplace_back(std::move(client)); // move expired client to gc
         }
-        
+    }
+
+    process_resume_requests();
+    finish_resumes();
+
+    if(gc_timeout.getSeconds() > 3 && socket_list.quiescent()){ // no Connection is between finding a socket and pinning it
         std::erase_if(expired_clients, [](const auto& c){ return !c->has_weak_references(); }); // expired client cleanup
 
-        ping_timeout.restart();
+        gc_timeout.restart();
+    }
+}
+
+void Server::update_socket(uint64_t id) {
+    std::shared_lock<std::shared_mutex> lock(socket_list_lock);
+    Socket* client = socket_list.find(id);
+    if(!client) return; // already released
+    if(!client->begin_update()) return; // another runtime thread has it and queues it again once done
+
+    client->clear_ready(); // anything that happens from here on queues the client again
+
+    if(!client->is_valid()){
+        const bool linger = client->is_authorizing() || client->has_weak_references() || client->is_detached();
+        std::unique_lock<std::mutex> ready_guard(ready_lock);
+        const bool wake = !linger || lingering.empty(); // the runtime only has to learn about the first lingering socket
+        (linger ? lingering : expired_list).push_back(id); // check again shortly or release
+        ready_guard.unlock();
+        if(wake) ready_signal.notify_one();
+
+    } else if(!client->is_authorized()) {
+        client->server_authorize();
+
+    } else {
+        client->runtime_update();
+    }
+
+    if(client->end_update()) mark_socket_ready(*client);
+}
+
+void Server::process_resume_requests() {
+    std::vector<std::pair<uint64_t, SessionResume>> requests;
+    {
+        std::scoped_lock lock(resume_lock);
+        if(resume_requests.empty()) return;
+        std::swap(requests, resume_requests);
+    }
+
+    std::vector<uint64_t> joined;
+    {
+        std::unique_lock<std::shared_mutex> lock(socket_list_lock);
+
+        for(auto& [id, request] : requests){
+            Socket* fresh = socket_list.find(id);
+            if(!fresh || !fresh->is_valid()) continue;
+
+            auto session = request.token.empty() ? sessions.end() : sessions.find(request.token);
+            const uint64_t old_id = session != sessions.end() ? session->second : 0;
+            Socket* old = old_id && old_id != id ? socket_list.find(old_id) : nullptr;
+
+            // a connection that is still alive is never taken over - a leaked token must not be enough to kick its owner
+            if(old && !old->is_valid() && old->is_detached() && old->can_resume(request)){
+                fresh->adopt_session(*old);
+                old->abandon_session();
+
+                auto replacement = socket_list.erase(id); // the resumed connection takes over the id of the session
+                replacement->set_id(old_id);
+                expired_clients.emplace_back(socket_list.replace(old_id, std::move(replacement)));
+
+                fresh->clear_ready();
+                fresh->mark_ready(); // anything queued under the fresh id is found under the session id now
+                held_resumes.emplace_back(old_id, request.received); // replayed by finish_resumes
+                continue;
+            }
+
+            if(request.token.size()){
+                DLOG_DEBUG << "client [" << id << "] could not resume its session\n";
+                fresh->send_command(Session::encode(Command::RESUMED, SessionResumed { false, 0 }));
+            }
+
+            std::string token = Session::generate_token();
+            if(token.empty()){
+                DLOG_ERROR << "no entropy for a session token - client [" << id << "] joins without a session\n";
+                fresh->end_session(); // releases the held output
+                joined.push_back(id);
+                continue;
+            }
+            sessions.insert_or_assign(token, id);
+            fresh->start_session(token, session_grace, session_backlog);
+            joined.push_back(id);
+        }
+    }
+
+    if(on_client_join){
+        for(uint64_t id : joined){
+            Connection user(this);
+            user.uuid = id;
+            user.name = user.get_name();
+
+            on_client_join(user);
+        }
+    }
+}
+
+void Server::finish_resumes() {
+    if(held_resumes.empty()) return;
+
+    std::vector<std::pair<Socket*, uint64_t>> resumed; // the runtime thread is the only one releasing sockets
+    {
+        std::shared_lock<std::shared_mutex> lock(socket_list_lock);
+        for(auto& [id, received] : held_resumes){
+            if(Socket* client = socket_list.find(id)) resumed.emplace_back(client, received);
+        }
+    }
+    held_resumes.clear();
+
+    for(auto& [client, received] : resumed){
+        if(!client->begin_update()){ // a pool thread is flushing it - it queues the socket again once it lets go, and the next pass retries
+            held_resumes.emplace_back(client->get_id(), received);
+            continue;
+        }
+        client->resume_session(received, true);
+        if(client->end_update()) mark_socket_ready(*client);
     }
 }
 
 // Async Loopbacks
 
 void Server::start_accept() {
-    listener.open(endpoint.protocol());
-    listener.set_option(asio::ip::tcp::acceptor::reuse_address(true));
-    listener.bind(endpoint);
-    listener.listen(4); // 4 concurrent incoming connections
+    // with SO_REUSEPORT every worker gets its own listener and the kernel spreads connections between them
+#ifdef SO_REUSEPORT
+    const size_t count = workers.size();
+#else
+    const size_t count = 1; // one shared listener hands sockets to the workers round robin
+#endif
 
-    do_accept();
+    std::unique_lock<std::shared_mutex> lock(socket_list_lock);
+    listeners.clear();
+    for(size_t i = 0; i < count; ++i){
+        auto& listener = *listeners.emplace_back(std::make_unique<asio::ip::tcp::acceptor>(workers[i]->ctx));
+        listener.open(endpoint.protocol());
+        listener.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+        if(count > 1) listener.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#endif
+        listener.bind(endpoint);
+        listener.listen(backlog);
+    }
+    lock.unlock();
+
+    const uint64_t round = ++accept_round; // accepts and backoff timers of an earlier round find their listener gone
+    accepting = true;
+    for(size_t i = 0; i < listeners.size(); ++i){
+        if(UringDriver* driver = get_uring(*workers[i])){
+            asio::post(workers[i]->ctx, [this, i, driver, round](){ do_accept_uring(i, *driver, round); }); // the driver belongs to the io thread
+        } else {
+            do_accept(i, round);
+        }
+    }
 }
 
 void Server::stop_accept() {
+    accepting = false;
+    local_listener.stop();
+
     std::unique_lock<std::shared_mutex> lock(socket_list_lock);
-    if(listener.is_open()){
-        listener.cancel();
-        listener.close();
+    for(auto& listener : listeners){
+        if(listener->is_open()){
+            UringDriver::shutdown_listener(listener->native_handle()); // io_uring accepts hold the listener open past close
+            listener->cancel();
+            listener->close();
+        }
     }
 }
 
-void Server::do_accept() {
-    if(!listener.is_open()) return;
+IoWorker& Server::accept_worker(size_t index) {
+    // a shared listener spreads sockets across the workers - otherwise sockets stay on the listener worker
+    return listeners.size() < workers.size() ? *workers[next_worker++ % workers.size()] : *workers[index];
+}
 
-    listener.async_accept([this](std::error_code er, asio::ip::tcp::socket soc){
-        if(!listener.is_open()){
-            connect_protect = 0;
-            return; // listener shutdown
-        }
+void Server::do_accept(size_t index, uint64_t round) {
+    std::shared_lock<std::shared_mutex> lock(socket_list_lock); // start_server clears the listeners - keep them until the accept is queued
+    if(!accepting || round != accept_round || index >= listeners.size() || !listeners[index]->is_open()) return; // listener shutdown
 
-        if (last_connection_time.getSeconds() > 30) {
-            connect_protect = 0;
-        }
+    IoWorker& worker = accept_worker(index);
 
-        last_connection_time.restart();
+    listeners[index]->async_accept(worker.ctx, [this, index, round, &worker](const asio::error_code& er, asio::ip::tcp::socket soc){
+        if(er == asio::error::operation_aborted || listener_handle(index, round) < 0){
+            return; // listener shutdown - the acceptor may be gone already
+        }
 
         if(soc.is_open()){
-            const auto& ep = soc.remote_endpoint();
-            dlog << "connection from " << ep.address().to_string() << " : " << ep.port() << "\n";
-            soc.set_option(asio::detail::socket_option::integer<SOL_SOCKET, SO_SNDTIMEO>(5000)); // 5 second write timeout
-            new_client_socket(std::move(soc));
+            admit_client_socket(worker, std::move(soc));
         } else {
-            dlog << "error accepting connection\n";
+            DLOG_ERROR << "error accepting connection: " << er.message() << "\n";
         }
 
-#ifdef DREAM_CONNECTION_LIMIT
-        if(++connect_protect > DREAM_CONNECTION_LIMIT){
-            stop_accept();
+        if(is_resource_error(er)){ // the pending connections stay in the backlog until descriptors are free again
+            workers[index]->timers.schedule(ACCEPT_BACKOFF, [this, index, round](){ do_accept(index, round); }); // finds a replaced listener gone
+            return;
+        }
+        do_accept(index, round);
+    });
+}
 
-            std::thread([this](){
-                Clock::sleepMilliseconds(int64_t(200) * connect_protect); // wait 1 second for new connections to prevent DDoS
-                last_connection_time.restart();
-                start_accept();
-            }).detach();
-        } else
-#endif
-        {
-            do_accept();
+int Server::listener_handle(size_t index, uint64_t round) {
+    std::shared_lock<std::shared_mutex> lock(socket_list_lock); // start_accept replaces the listeners
+    if(!accepting || round != accept_round || index >= listeners.size() || !listeners[index]->is_open()) return -1;
+    return listeners[index]->native_handle();
+}
+
+void Server::do_accept_uring(size_t index, UringDriver& driver, uint64_t round) {
+    const int handle = listener_handle(index, round);
+    if(handle < 0) return; // listener shutdown
+
+    driver.accept(handle, driver.has_multishot_accept(), [this, index, round, &driver](int result, uint32_t flags){
+        if(listener_handle(index, round) < 0){ // listener shutdown
+            asio::error_code ignored;
+            if(result >= 0) asio::ip::tcp::socket(workers[index]->ctx).assign(endpoint.protocol(), result, ignored); // closed with the temporary
+            return;
+        }
+
+        const asio::error_code er(result < 0 ? -result : 0, asio::system_category());
+        if(result >= 0){
+            IoWorker& worker = accept_worker(index);
+            asio::error_code ec;
+            asio::ip::tcp::socket soc(worker.ctx);
+            soc.assign(endpoint.protocol(), result, ec);
+            if(!ec){
+                admit_client_socket(worker, std::move(soc));
+            } else {
+                DLOG_ERROR << "error adopting connection: " << ec.message() << "\n";
+            }
+        } else if(result == -EINVAL && driver.has_multishot_accept()){
+            driver.disable_multishot_accept(); // rearmed one accept at a time below
+        } else {
+            DLOG_ERROR << "error accepting connection: " << er.message() << "\n";
+        }
+
+        if(UringDriver::has_more(flags)) return;
+        if(is_resource_error(er)){ // the pending connections stay in the backlog until descriptors are free again
+            workers[index]->timers.schedule(ACCEPT_BACKOFF, [this, index, round, &driver](){ do_accept_uring(index, driver, round); });
+            return;
         }
+        do_accept_uring(index, driver, round);
     });
 }
 
 // Misc
 
-std::unique_ptr<Socket> Server::generate_socket(asio::ip::tcp::socket&& soc, uint64_t id, const std::string& name) {
-    return std::unique_ptr<Socket>( new Socket(ctx, std::move(soc), cur_uuid, std::to_string(cur_uuid)) );
+std::unique_ptr<Socket> Server::generate_socket(IoWorker& worker, SocketStream&& soc, uint64_t id) {
+    return std::unique_ptr<Socket>( new Socket(worker.ctx, worker.timers, std::move(soc), id, std::to_string(uint32_t(id))) ); // named after the slot index
 }
 
 
@@ -0,0 +1,119 @@
+#include "dream_session.h"
+
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+    #include <bcrypt.h>
+    #ifdef _MSC_VER
+    #pragma comment(lib, "bcrypt")
+    #endif
+#elif __has_include(<sys/random.h>)
+    #include <sys/random.h>
+    #include <cerrno>
+#endif
+
+namespace dream {
+
+static constexpr size_t BACKLOG_OVERHEAD = sizeof(uint64_t) + sizeof(Command); // sequence number and command object per entry
+
+// fills the buffer from the operating system's CSPRNG - a token must not be predictable from the ones before it
+static bool system_entropy(char* data, size_t size) {
+#ifdef _WIN32
+    return BCRYPT_SUCCESS(BCryptGenRandom(nullptr, reinterpret_cast<PUCHAR>(data), ULONG(size), BCRYPT_USE_SYSTEM_PREFERRED_RNG));
+#else
+    #if __has_include(<sys/random.h>)
+    while(size){
+        ssize_t n = getrandom(data, size, 0);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            break; // not supported by the kernel - read the device instead
+        }
+        data += n;
+        size -= size_t(n);
+    }
+    if(!size) return true;
+    #endif
+
+    std::ifstream device("/dev/urandom", std::ios::binary);
+    return device.read(data, std::streamsize(size)) && size_t(device.gcount()) == size;
+#endif
+}
+
+std::string Session::generate_token() {
+    std::string token(TOKEN_SIZE, '\0');
+    if(!system_entropy(token.data(), token.size())) return {};
+    return token;
+}
+
+bool Session::is_sequenced(const Command& cmd) {
+    switch(cmd.type){
+        case Command::NILL:
+        case Command::PING:
+        case Command::RESPONSE:
+        case Command::SESSION:
+        case Command::RESUME:
+        case Command::RESUMED:
+            return false;
+        default:
+            return true;
+    }
+}
+
+void Session::start(const std::string& tkn, std::chrono::milliseconds grace_period, size_t limit) {
+    token = tkn;
+    grace = grace_period;
+    backlog_limit = limit;
+}
+
+void Session::reset() {
+    token.clear();
+    grace = std::chrono::milliseconds(0);
+    sent_count = 0;
+    received_count = 0;
+    backlog.clear();
+    backlog_bytes = 0;
+}
+
+void Session::sent(const Command& cmd) {
+    if(!is_sequenced(cmd)) return;
+
+    uint64_t seq = ++sent_count;
+    if(!is_active() || !backlog_limit) return; // nothing to resume - no reason to keep a copy
+
+    backlog_bytes += cmd.data.size() + BACKLOG_OVERHEAD;
+    backlog.emplace_back(seq, cmd);
+
+    while(backlog.size() > 1 && backlog_bytes > backlog_limit){ // the newest command is always kept
+        backlog_bytes -= backlog.front().second.data.size() + BACKLOG_OVERHEAD;
+        backlog.pop_front();
+    }
+}
+
+uint64_t Session::first_available() const {
+    return backlog.empty() ? sent_count + 1 : backlog.front().first;
+}
+
+bool Session::can_replay(uint64_t peer_received) const {
+    return peer_received <= sent_count && peer_received + 1 >= first_available();
+}
+
+std::vector<Command> Session::rewind(uint64_t peer_received) {
+    std::vector<Command> missed;
+    for(auto& [seq, cmd] : backlog){
+        if(seq > peer_received) missed.emplace_back(std::move(cmd));
+    }
+
+    backlog.clear();
+    backlog_bytes = 0;
+    sent_count = peer_received; // the replay is numbered again as it is written
+
+    return missed;
+}
+
+}
@@ -0,0 +1,617 @@
+#include "dream_shard.h"
+#include "dream_externs.h"
+#include "lib_cereal.h"
+
+#include <cstdio>
+#include <sstream>
+
+namespace dream {
+
+static constexpr uint32_t MAX_SHARD_FRAME = 64 * 1024 * 1024;
+
+template<typename T>
+static std::string encode(const T& value) {
+    std::stringstream output;
+    {
+        cereal::BinaryOutputArchive archive(output);
+        archive(value);
+    } // enforce flush
+    return output.str();
+}
+
+template<typename T>
+static bool decode(const std::string& bytes, T& value) {
+    try {
+        std::stringstream input(bytes);
+        cereal::BinaryInputArchive archive(input);
+        archive(value);
+    } catch(...) {
+        return false;
+    }
+    return true;
+}
+
+bool split_endpoint(const std::string& endpoint, std::string& host, short& port) {
+    size_t colon = endpoint.rfind(':');
+    if(colon == std::string::npos || colon + 1 == endpoint.size()) return false;
+
+    try {
+        int value = std::stoi(endpoint.substr(colon + 1));
+        if(value <= 0 || value > UINT16_MAX) return false;
+        port = short(value);
+    } catch(const std::exception&) {
+        return false;
+    }
+    host = endpoint.substr(0, colon);
+    return true;
+}
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+
+using local = asio::local::stream_protocol;
+
+// a unix domain socket carrying length prefixed frames - every member is used on the io thread of the owner only
+class ShardPipe : public std::enable_shared_from_this<ShardPipe> {
+public:
+    using FrameHandler = std::function<void(ShardFrame&&)>;
+
+    local::socket socket;
+    ShardId id; // set once the shard said hello - broker side
+
+    ShardPipe(asio::io_context& ctx): socket(ctx), id(NO_SHARD), length(0), writing(false), closing(false), closed(false) {}
+
+    void start(FrameHandler frame_handler, std::function<void()> close_handler) {
+        on_frame = std::move(frame_handler);
+        on_close = std::move(close_handler);
+        read_header();
+    }
+
+    static std::string frame_bytes(const ShardFrame& frame) { // length prefixed
+        std::string body = encode(frame);
+        uint32_t size = uint32_t(body.size());
+        std::string out(reinterpret_cast<const char*>(&size), sizeof(size));
+        return out += body;
+    }
+
+    void send(const ShardFrame& frame) {
+        send_bytes(frame_bytes(frame));
+    }
+
+    void send_bytes(std::string&& frames) { // one or more encoded frames
+        if(closed) return;
+        out_frames.push_back(std::move(frames));
+        if(!writing) write_next();
+    }
+
+    void send_and_close(const ShardFrame& frame) { // the last frame - the pipe closes once it is written
+        send(frame);
+        closing = true;
+        on_frame = nullptr; // nothing the peer sends from here on is read
+        if(!writing) close();
+    }
+
+    void close() { // no handler runs afterwards
+        if(closed) return;
+        closed = true;
+        on_frame = nullptr;
+        on_close = nullptr;
+
+        asio::error_code ignored;
+        socket.shutdown(local::socket::shutdown_both, ignored);
+        socket.close(ignored);
+    }
+
+private:
+    uint32_t length;
+    std::string body;
+    std::deque<std::string> out_frames;
+    std::string in_flight;
+    bool writing, closing, closed;
+
+    FrameHandler on_frame;
+    std::function<void()> on_close;
+
+    void read_header() {
+        asio::async_read(socket, asio::buffer(&length, sizeof(length)), [self = shared_from_this()](const asio::error_code& error, size_t){
+            if(error || self->length > MAX_SHARD_FRAME) return self->fail();
+            self->read_body();
+        });
+    }
+
+    void read_body() {
+        body.resize(length);
+        asio::async_read(socket, asio::buffer(body), [self = shared_from_this()](const asio::error_code& error, size_t){
+            if(error) return self->fail();
+
+            ShardFrame frame;
+            if(!decode(self->body, frame)) return self->fail();
+            if(self->on_frame) self->on_frame(std::move(frame));
+            if(!self->closed) self->read_header();
+        });
+    }
+
+    void write_next() { // everything queued while the last write was in flight goes out in one write
+        if(out_frames.empty() || closed){
+            writing = false;
+            if(closing) close();
+            return;
+        }
+        writing = true;
+
+        in_flight.clear();
+        for(const std::string& frame : out_frames) in_flight += frame;
+        out_frames.clear();
+
+        asio::async_write(socket, asio::buffer(in_flight), [self = shared_from_this()](const asio::error_code& error, size_t){
+            if(error) return self->fail();
+            self->write_next();
+        });
+    }
+
+    void fail() {
+        if(closed) return;
+        auto handler = std::move(on_close);
+        close();
+        if(handler) handler();
+    }
+};
+
+struct ShardBroker::Listener {
+    local::acceptor acceptor;
+    Listener(asio::io_context& ctx): acceptor(ctx) {}
+};
+
+// Shard Broker
+
+ShardBroker::ShardBroker(): stats({}) {}
+
+ShardBroker::~ShardBroker() {
+    stop();
+}
+
+bool ShardBroker::start(const std::string& socket_path) {
+    stop();
+    if(!removeStaleSocket(socket_path)){
+        DLOG_ERROR << "shard broker could not listen on " << socket_path << ": another broker is running there\n";
+        return false;
+    }
+    path = socket_path;
+
+    listener = std::make_unique<Listener>(worker.ctx);
+    asio::error_code error;
+    listener->acceptor.open(local(), error);
+    if(!error) listener->acceptor.bind(local::endpoint(path), error);
+    if(!error) listener->acceptor.listen(asio::socket_base::max_listen_connections, error);
+    if(error){
+        DLOG_ERROR << "shard broker could not listen on " << path << ": " << error.message() << "\n";
+        listener.reset();
+        return false;
+    }
+
+    do_accept();
+    worker.start();
+    return true;
+}
+
+void ShardBroker::stop() {
+    if(!listener) return;
+
+    worker.stop(); // no handler runs from here on
+    asio::error_code ignored;
+    listener->acceptor.close(ignored);
+    listener.reset();
+
+    for(auto& [id, pipe] : shards) pipe->close();
+    shards.clear();
+    directory = {};
+    std::remove(path.c_str());
+
+    std::scoped_lock lock(stats_lock);
+    stats.shards = stats.keys = 0;
+}
+
+ShardBrokerStats ShardBroker::get_stats() const {
+    std::scoped_lock lock(stats_lock);
+    return stats;
+}
+
+void ShardBroker::do_accept() {
+    auto pipe = std::make_shared<ShardPipe>(worker.ctx);
+    listener->acceptor.async_accept(pipe->socket, [this, pipe](const asio::error_code& error){
+        if(error == asio::error::operation_aborted || !listener) return;
+        if(!error){
+            pipe->start(
+                [this, weak = std::weak_ptr<ShardPipe>(pipe)](ShardFrame&& frame){ if(auto p = weak.lock()) on_frame(p, std::move(frame)); },
+                [this, weak = std::weak_ptr<ShardPipe>(pipe)](){ if(auto p = weak.lock()) on_close(p); }
+            );
+        }
+        do_accept();
+    });
+}
+
+void ShardBroker::on_frame(const std::shared_ptr<ShardPipe>& pipe, ShardFrame&& frame) {
+    if(pipe->id == NO_SHARD){ // the first frame has to introduce the shard
+        if(frame.kind != ShardFrame::SHARD_HELLO || frame.from == NO_SHARD || frame.from == ALL_SHARDS || shards.count(frame.from)){
+            DLOG_WARN << "shard broker rejected shard " << frame.from << "\n";
+            pipe->send_and_close(ShardFrame { ShardFrame::SHARD_REJECT, NO_SHARD, frame.from, 0, {}, {} });
+            return;
+        }
+
+        pipe->id = frame.from;
+        shards.emplace(pipe->id, pipe);
+        directory.endpoints[pipe->id] = frame.payload;
+        DLOG_INFO << "shard " << pipe->id << " joined at " << frame.payload << "\n";
+        publish_directory();
+        return;
+    }
+
+    frame.from = pipe->id; // shards cannot speak for each other
+
+    switch(frame.kind){
+    case ShardFrame::SHARD_CLAIM: {
+        auto [it, claimed] = directory.owners.emplace(frame.key, pipe->id);
+        const bool owned = claimed || it->second == pipe->id;
+        pipe->send(ShardFrame { ShardFrame::SHARD_CLAIM, NO_SHARD, pipe->id, 0, frame.key, owned ? "1" : "0" });
+        if(claimed) publish_directory();
+        break;
+    }
+    case ShardFrame::SHARD_RELEASE: {
+        auto it = directory.owners.find(frame.key);
+        if(it != directory.owners.end() && it->second == pipe->id){
+            directory.owners.erase(it);
+            publish_directory();
+        }
+        break;
+    }
+    case ShardFrame::SHARD_HANDOFF: {
+        // the receiver takes the key as its own - it may only get it from the shard the directory names as the owner
+        auto it = directory.owners.find(frame.key);
+        const bool owner = frame.key.empty() || it == directory.owners.end() || it->second == pipe->id;
+        if(!owner || !shards.count(frame.to)){
+            {
+                std::scoped_lock lock(stats_lock);
+                ++stats.dropped;
+            }
+            frame.kind = ShardFrame::SHARD_HANDOFF_REJECT; // the blobs go back to the sender
+            frame.to = pipe->id;
+            pipe->send(frame);
+            break;
+        }
+
+        std::string key = frame.key; // the frame is moved into relay
+        const ShardId to = frame.to;
+        relay(std::move(frame));
+        if(!key.empty()){
+            directory.owners[key] = to;
+            publish_directory();
+        }
+        break;
+    }
+    case ShardFrame::SHARD_COMMAND:
+        relay(std::move(frame));
+        break;
+    default:
+        break;
+    }
+}
+
+void ShardBroker::on_close(const std::shared_ptr<ShardPipe>& pipe) {
+    if(pipe->id == NO_SHARD) return;
+
+    auto it = shards.find(pipe->id);
+    if(it == shards.end() || it->second != pipe) return;
+    shards.erase(it);
+
+    DLOG_INFO << "shard " << pipe->id << " left\n";
+    directory.endpoints.erase(pipe->id);
+    std::erase_if(directory.owners, [id = pipe->id](const auto& entry){ return entry.second == id; }); // keys of a lost shard are free to claim
+    publish_directory();
+}
+
+void ShardBroker::relay(ShardFrame&& frame) {
+    ShardId to = frame.to;
+    if(to == NO_SHARD){
+        auto it = directory.owners.find(frame.key);
+        if(it != directory.owners.end()) to = it->second;
+    }
+
+    uint64_t relayed = 0, dropped = 0;
+    if(to == ALL_SHARDS){
+        for(auto& [id, pipe] : shards){
+            if(id == frame.from) continue;
+            pipe->send(frame);
+            ++relayed;
+        }
+    } else {
+        auto it = shards.find(to);
+        if(it != shards.end()){
+            frame.to = to;
+            it->second->send(frame);
+            ++relayed;
+        } else {
+            ++dropped;
+        }
+    }
+
+    std::scoped_lock lock(stats_lock);
+    stats.relayed += relayed;
+    stats.dropped += dropped;
+}
+
+void ShardBroker::publish_directory() {
+    const ShardFrame frame { ShardFrame::SHARD_DIRECTORY, NO_SHARD, ALL_SHARDS, 0, {}, encode(directory) };
+    for(auto& [id, pipe] : shards) pipe->send(frame);
+
+    std::scoped_lock lock(stats_lock);
+    stats.shards = directory.endpoints.size();
+    stats.keys = directory.owners.size();
+}
+
+// Shard Link
+
+ShardLink::ShardLink(): id(NO_SHARD), connected(false), flush_posted(false) {}
+
+ShardLink::~ShardLink() {
+    stop();
+}
+
+bool ShardLink::start(const std::string& path, ShardId shard_id, const std::string& public_endpoint, std::chrono::milliseconds timeout) {
+    stop();
+    if(shard_id == NO_SHARD || shard_id == ALL_SHARDS) return false;
+
+    id = shard_id;
+    endpoint = public_endpoint;
+    auto link = std::make_shared<ShardPipe>(worker.ctx);
+
+    asio::error_code error;
+    link->socket.connect(local::endpoint(path), error); // local connects complete at once
+    if(error){
+        DLOG_WARN << "shard " << id << " could not reach the broker at " << path << ": " << error.message() << "\n";
+        return false;
+    }
+
+    {
+        std::scoped_lock lock(out_lock); // senders read the pipe under it
+        pipe = link;
+    }
+
+    registered = std::make_unique<std::promise<bool>>();
+    std::future<bool> result = registered->get_future();
+
+    pipe->start([this](ShardFrame&& frame){ on_frame(std::move(frame)); }, [this](){ on_close(); });
+    pipe->send(ShardFrame { ShardFrame::SHARD_HELLO, id, NO_SHARD, 0, {}, endpoint });
+    worker.start();
+
+    if(result.wait_for(timeout) != std::future_status::ready || !result.get()){
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void ShardLink::stop() {
+    if(!pipe) return;
+
+    worker.stop(); // no handler runs from here on
+    pipe->close();
+    connected = false;
+    registered.reset();
+
+    {
+        std::scoped_lock lock(out_lock); // senders read the pipe under it
+        pipe.reset();
+        out_pending.clear();
+        flush_posted = false;
+    }
+
+    {
+        std::scoped_lock lock(directory_lock);
+        directory = {};
+    }
+
+    std::map<std::string, std::deque<std::function<void(bool)>>> waiting;
+    {
+        std::scoped_lock lock(claims_lock);
+        waiting.swap(claims);
+    }
+    for(auto& [key, handlers] : waiting){
+        for(auto& handler : handlers) if(handler) handler(false);
+    }
+}
+
+void ShardLink::on_frame(ShardFrame&& frame) {
+    switch(frame.kind){
+    case ShardFrame::SHARD_REJECT:
+        DLOG_WARN << "shard broker rejected id " << id << "\n";
+        if(registered){
+            registered->set_value(false);
+            registered.reset();
+        }
+        break;
+    case ShardFrame::SHARD_DIRECTORY: {
+        ShardDirectory received;
+        if(!decode(frame.payload, received)) break;
+        {
+            std::scoped_lock lock(directory_lock);
+            directory = received;
+        }
+        if(registered){
+            connected = true;
+            registered->set_value(true);
+            registered.reset();
+        }
+        if(on_directory) on_directory(received);
+        break;
+    }
+    case ShardFrame::SHARD_CLAIM: {
+        std::function<void(bool)> handler;
+        {
+            std::scoped_lock lock(claims_lock);
+            auto it = claims.find(frame.key);
+            if(it == claims.end()) break;
+            handler = std::move(it->second.front());
+            it->second.pop_front();
+            if(it->second.empty()) claims.erase(it);
+        }
+        if(handler) handler(frame.payload == "1");
+        break;
+    }
+    case ShardFrame::SHARD_COMMAND:
+        if(on_command) on_command(frame.from, Command(Command::Type(frame.type), frame.payload));
+        break;
+    case ShardFrame::SHARD_HANDOFF: {
+        ShardHandoff handoff;
+        if(!decode(frame.payload, handoff)) break;
+        handoff.from = frame.from;
+        if(on_handoff) on_handoff(std::move(handoff));
+        break;
+    }
+    case ShardFrame::SHARD_HANDOFF_REJECT: {
+        ShardHandoff handoff;
+        if(!decode(frame.payload, handoff)) break;
+        handoff.from = id;
+        DLOG_WARN << "shard broker rejected the handoff of key '" << handoff.key << "'\n";
+        if(on_handoff_rejected) on_handoff_rejected(std::move(handoff));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void ShardLink::on_close() {
+    connected = false;
+    if(registered){
+        registered->set_value(false);
+        registered.reset();
+    }
+    DLOG_WARN << "shard " << id << " lost the broker\n";
+    if(on_disconnect) on_disconnect();
+}
+
+bool ShardLink::send_frame(ShardFrame&& frame) {
+    if(!connected) return false;
+
+    std::string bytes = ShardPipe::frame_bytes(frame); // encoded on the calling thread
+    std::shared_ptr<ShardPipe> target;
+    {
+        std::scoped_lock lock(out_lock); // start and stop swap the pipe under it
+        if(!pipe) return false;
+        out_pending += bytes;
+        if(flush_posted) return true; // the posted flush takes it along
+        flush_posted = true;
+        target = pipe;
+    }
+
+    asio::post(worker.ctx, [this, target](){
+        std::string frames;
+        {
+            std::scoped_lock lock(out_lock);
+            if(target != pipe) return; // queued before a restart - the new pipe has its own flush
+            frames.swap(out_pending);
+            flush_posted = false;
+        }
+        target->send_bytes(std::move(frames)); // a pipe closed by stop drops it
+    });
+    return true;
+}
+
+void ShardLink::claim(const std::string& key, std::function<void(bool)> on_result) {
+    {
+        std::scoped_lock lock(claims_lock);
+        claims[key].push_back(std::move(on_result));
+    } // answers come back in order per key
+
+    if(!send_frame(ShardFrame { ShardFrame::SHARD_CLAIM, id, NO_SHARD, 0, key, {} })){
+        std::function<void(bool)> handler;
+        {
+            std::scoped_lock lock(claims_lock);
+            auto it = claims.find(key);
+            if(it == claims.end()) return;
+            handler = std::move(it->second.back());
+            it->second.pop_back();
+            if(it->second.empty()) claims.erase(it);
+        }
+        if(handler) handler(false);
+    }
+}
+
+void ShardLink::release(const std::string& key) {
+    send_frame(ShardFrame { ShardFrame::SHARD_RELEASE, id, NO_SHARD, 0, key, {} });
+}
+
+ShardId ShardLink::owner_of(const std::string& key) {
+    std::scoped_lock lock(directory_lock);
+    auto it = directory.owners.find(key);
+    return it == directory.owners.end() ? NO_SHARD : it->second;
+}
+
+std::string ShardLink::locate(const std::string& key) {
+    std::scoped_lock lock(directory_lock);
+    auto owner = directory.owners.find(key);
+    if(owner == directory.owners.end()) return {};
+    auto it = directory.endpoints.find(owner->second);
+    return it == directory.endpoints.end() ? std::string() : it->second;
+}
+
+ShardDirectory ShardLink::get_directory() {
+    std::scoped_lock lock(directory_lock);
+    return directory;
+}
+
+bool ShardLink::send(ShardId to, const Command& cmd) {
+    if(to == NO_SHARD || to == id) return false;
+    return send_frame(ShardFrame { ShardFrame::SHARD_COMMAND, id, to, uint16_t(cmd.type), {}, cmd.data });
+}
+
+bool ShardLink::send_to_owner(const std::string& key, const Command& cmd) {
+    return send_frame(ShardFrame { ShardFrame::SHARD_COMMAND, id, NO_SHARD, uint16_t(cmd.type), key, cmd.data });
+}
+
+bool ShardLink::handoff(ShardId to, const std::string& key, const BlockSnapshot& view, const std::vector<std::string>& blobs) {
+    if(to == NO_SHARD || to == ALL_SHARDS || to == id) return false;
+
+    ShardHandoff handoff { id, key, {} };
+    for(const std::string& name : blobs){
+        const std::string* state = view.get(name);
+        if(!state) return false; // not published yet
+        handoff.blobs.emplace(name, *state);
+    }
+    return send_frame(ShardFrame { ShardFrame::SHARD_HANDOFF, id, to, 0, key, encode(handoff) });
+}
+
+#else // no unix domain sockets on this platform - sharding reports failure
+
+class ShardPipe {};
+struct ShardBroker::Listener {};
+
+ShardBroker::ShardBroker(): stats({}) {}
+ShardBroker::~ShardBroker() {}
+bool ShardBroker::start(const std::string&) { return false; }
+void ShardBroker::stop() {}
+ShardBrokerStats ShardBroker::get_stats() const { return stats; }
+void ShardBroker::do_accept() {}
+void ShardBroker::on_frame(const std::shared_ptr<ShardPipe>&, ShardFrame&&) {}
+void ShardBroker::on_close(const std::shared_ptr<ShardPipe>&) {}
+void ShardBroker::relay(ShardFrame&&) {}
+void ShardBroker::publish_directory() {}
+
+ShardLink::ShardLink(): id(NO_SHARD), connected(false), flush_posted(false) {}
+ShardLink::~ShardLink() {}
+bool ShardLink::start(const std::string&, ShardId, const std::string&, std::chrono::milliseconds) { return false; }
+void ShardLink::stop() {}
+void ShardLink::on_frame(ShardFrame&&) {}
+void ShardLink::on_close() {}
+bool ShardLink::send_frame(ShardFrame&&) { return false; }
+void ShardLink::claim(const std::string&, std::function<void(bool)> on_result) { if(on_result) on_result(false); }
+void ShardLink::release(const std::string&) {}
+ShardId ShardLink::owner_of(const std::string&) { return NO_SHARD; }
+std::string ShardLink::locate(const std::string&) { return {}; }
+ShardDirectory ShardLink::get_directory() { return {}; }
+bool ShardLink::send(ShardId, const Command&) { return false; }
+bool ShardLink::send_to_owner(const std::string&, const Command&) { return false; }
+bool ShardLink::handoff(ShardId, const std::string&, const BlockSnapshot&, const std::vector<std::string>&) { return false; }
+
+#endif
+
+}
@@ -5,11 +5,15 @@
 #include <fstream>
 #include <functional>
 #include <algorithm>
+#include <cstring>
 
 namespace dream {
 
 Socket::~Socket() {
+    timers.cancel(auth_timer);
+    timers.cancel(read_timer);
     shutdown();
+    release_waiters();
     delete[] in_data;
 }
 
@@ -30,7 +34,7 @@ bool Socket::send_raw_data(const char* data, size_t length, std::function<void(b
         },
         [this, on_complete](const asio::error_code& error, size_t bytes){
             if(error){
-                dlog << error.message() << "\n";
+                DLOG_ERROR << error.message() << "\n";
                 shutdown();
                 on_complete(false);
             } else {
@@ -42,13 +46,11 @@ bool Socket::send_raw_data(const char* data, size_t length, std::function<void(b
 }
 
 // append a new command to the package payload - remember to flush the payload buffer to send the data
-void Socket::append_command_package(Command&& cmd) {
+static std::string frame_command(const Command& cmd) { // u32 length, then the archived command - empty if there was no payload
     std::stringstream raw;
 
-    auto beg = raw.tellp(); // prepare for overwritten length
-    for(uint32_t i=0; i < sizeof(cmdbuf); ++i){
-        raw.write("\0", 1); // length reservation
-    }
+    uint32_t plength = 0;
+    raw.write(reinterpret_cast<const char*>(&plength), sizeof(plength)); // length reservation
 
     { 
         cereal::BinaryOutputArchive archive(raw);
@@ -58,21 +60,35 @@ void Socket::append_command_package(Command&& cmd) {
     raw.seekg(0, std::ios::end);
     if(raw.tellg() > UINT32_MAX) throw std::runtime_error("command payload too large");
 
-    uint32_t plength = uint32_t(raw.tellg()); // get the size of the data stream
+    plength = uint32_t(raw.tellg()); // get the size of the data stream
 
     if(plength <= sizeof(plength)){
-        dlog << "warning: skipping package due to zero length payload\n";
-        return; // something went wrong because there was no payload found
+        DLOG_WARN << "skipping package due to zero length payload\n";
+        return {}; // something went wrong because there was no payload found
     }
     plength -= sizeof(plength); // decrement the reserved length size in the payload
 
-    raw.seekp(beg); // re-write at beginning
-    raw.write(reinterpret_cast<const char*>(&plength), sizeof(plength)); // overwrite the payload length
-    raw.seekg(0, std::ios::beg); // read from beginning
+    std::string frame = std::move(raw).str();
+    std::memcpy(frame.data(), &plength, sizeof(plength)); // overwrite the payload length
+    return frame;
+}
 
-    {
-        out_payload << raw.rdbuf(); // append to payload cache
-    }
+std::shared_ptr<const SharedFrame> SharedFrame::make(Command&& cmd) {
+    auto shared = std::make_shared<SharedFrame>();
+    shared->frame = frame_command(cmd);
+    shared->cmd = std::move(cmd);
+    return shared;
+}
+
+void Socket::append_command_package(Command&& cmd) {
+    append_frame(frame_command(cmd));
+}
+
+void Socket::append_frame(const std::string& frame) {
+    if(frame.empty()) return;
+
+    if(capture && capture->is_active()) capture->record(id, Capture::OUTBOUND, std::string_view(frame).substr(sizeof(uint32_t)));
+    out_payload.write(frame.data(), std::streamsize(frame.size())); // append to payload cache
 }
 
 size_t Socket::check_command_package() {
@@ -82,6 +98,12 @@ size_t Socket::check_command_package() {
 bool Socket::flush_command_package() {
     if(!out_payload_protection.try_acquire()) return false;
 
+    send_command_package();
+
+    return true;
+}
+
+void Socket::send_command_package() {
     {
         std::swap(out_payload_flushing, out_payload); // cache buffer swaps for fast performance
         out_payload.str(""); // clear next payload cache for fresh data for next flush
@@ -93,27 +115,238 @@ bool Socket::flush_command_package() {
     const char* data = out_payload_flushing.view().data(); // current payload flushing cache buffer as a raw buffer
     size_t length = out_payload_flushing.view().length(); // calculate the length of the flush buffer
 
-    if(length > 0){ // let's never send nothing
-        if(!send_raw_data(data, length, [this](bool success){
-            out_payload_protection.release();
-        })) out_payload_protection.release(); // whow - release this lock on error
+    flushing_flushes.swap(package_flushes);
+    package_flushes.clear();
+
+    if(length == 0){ // let's never send nothing
+        auto flushed = std::move(flushing_flushes);
+        flushing_flushes.clear();
+        out_payload_protection.release();
+        for(auto& on_flushed : flushed) on_flushed(true);
+        return;
     }
 
-    return true;
+    out_flushing_bytes = length;
+    if(!send_raw_data(data, length, [this](bool success){
+        out_flushing_bytes = 0;
+        auto flushed = std::move(flushing_flushes);
+        flushing_flushes.clear();
+        out_payload_protection.release();
+        for(auto& on_flushed : flushed) on_flushed(success);
+        check_drain();
+        check_flushed();
+        if(flush_pending.exchange(false)) mark_ready(); // pick up the commands queued while this flush was in flight
+    })){
+        out_flushing_bytes = 0;
+        auto flushed = std::move(flushing_flushes);
+        flushing_flushes.clear();
+        out_payload_protection.release(); // whow - release this lock on error
+        for(auto& on_flushed : flushed) on_flushed(false);
+    }
 }
 
-void Socket::wait_for_flush() {
-    do {
-        Clock::sleepMilliseconds(2);
+void Socket::when_flushed(FlushHandler done) {
+    bool idle;
+    {
+        std::unique_lock<std::shared_mutex> lock(outgoing_command_lock);
+        idle = out_commands.empty() && !out_flushing_bytes && check_command_package() == 0;
+        if(!idle && is_valid()){
+            flush_waiters.emplace_back(std::move(done)); // the write that empties the queue hands it the result
+            return;
+        }
+    }
+
+    done(idle); // nothing left to write - or it is lost with the connection
+}
+
+void Socket::check_flushed() {
+    std::vector<FlushHandler> waiters;
+    bool idle;
+    {
         std::unique_lock<std::shared_mutex> lock(outgoing_command_lock);
-    } while(!flush_command_package() && is_valid());
+        if(flush_waiters.empty()) return;
+        idle = out_commands.empty() && !out_flushing_bytes && check_command_package() == 0;
+        if(!idle && is_valid()) return; // more was queued meanwhile - the next completed write checks again
+        waiters.swap(flush_waiters);
+    }
+
+    for(auto& done : waiters) done(idle);
 }
 
-void Socket::send_command(Command&& cmd) {
+bool Socket::wait_for_flush() {
+    auto flushed = std::make_shared<std::promise<bool>>(); // shared - the handler may still be inside set_value when the waiter returns
+    auto result = flushed->get_future();
+    when_flushed([flushed](bool success){ flushed->set_value(success); });
+    return result.get();
+}
+
+SendStatus Socket::send_command(Command&& cmd, FlushHandler on_flushed) {
+    if(!is_valid() && !is_detached()){ // a detached session keeps queueing for the resumed connection
+        if(on_flushed) on_flushed(false);
+        return SEND_REJECTED;
+    }
+
     trigger_hook("on_send", cmd);
 
+    SendStatus status;
+    bool disconnect = false;
+    {
+        std::unique_lock<std::shared_mutex> lock(outgoing_command_lock);
+        status = queue_command({ std::move(cmd), std::move(on_flushed), nullptr }, disconnect); // move command into the queue
+    }
+
+    return after_queue(status, disconnect);
+}
+
+static uint8_t control_bit(const Command& cmd);
+
+SendStatus Socket::send_shared(const std::shared_ptr<const SharedFrame>& frame) {
+    if(frame->frame.empty() || control_bit(frame->cmd)) return send_command(Command(frame->cmd)); // coalescing needs its own entry
+
+    if(!is_valid() && !is_detached()) return SEND_REJECTED;
+
+    trigger_hook("on_send", frame->cmd);
+
+    SendStatus status;
+    bool disconnect = false;
+    {
+        std::unique_lock<std::shared_mutex> lock(outgoing_command_lock);
+        status = queue_command({ Command(frame->cmd.type), nullptr, frame }, disconnect);
+    }
+
+    return after_queue(status, disconnect);
+}
+
+SendStatus Socket::after_queue(SendStatus status, bool disconnect) {
+    if(disconnect){
+        DLOG_WARN << "socket " << name << " is not keeping up - disconnecting\n";
+        shutdown();
+    } else if(status == SEND_ACCEPTED && !paced){
+        mark_ready();
+    }
+
+    return status;
+}
+
+static constexpr size_t COMMAND_OVERHEAD = sizeof(uint32_t) + sizeof(Command::Type) + sizeof(uint64_t); // frame length, type and data length
+
+static uint8_t control_bit(const Command& cmd) { // control commands carry no data - one queued copy is as good as many
+    if(!cmd.data.empty() || (cmd.type != Command::PING && cmd.type != Command::RESPONSE)) return 0;
+    return uint8_t(1 << cmd.type);
+}
+
+SendStatus Socket::queue_command(OutgoingCommand&& out, bool& disconnect) {
+    const Command& cmd = out.command();
+    FlushHandler& on_flushed = out.on_flushed;
+    auto reject = [&](){
+        ++out_dropped;
+        if(on_flushed) on_flushed(false);
+        return SEND_REJECTED;
+    };
+
+    if(cmd.data.size() + COMMAND_OVERHEAD > max_frame){ // the peer would drop the connection
+        return reject();
+    }
+
+    const uint8_t control = control_bit(cmd);
+    if(control & out_control){
+        if(on_flushed) on_flushed(true); // goes out with the copy that is already queued
+        return SEND_COALESCED;
+    }
+
+    const size_t cost = cmd.data.size() + COMMAND_OVERHEAD;
+    auto over_limit = [&](){
+        return (send_limits.high_water && out_command_bytes + out_flushing_bytes + cost > send_limits.high_water) ||
+               (send_limits.max_commands && out_commands.size() >= send_limits.max_commands);
+    };
+
+    if(over_limit()){
+        congested = true;
+
+        switch(send_limits.policy){
+            case SendLimits::DROP_OLDEST:
+            {
+                while(!out_commands.empty() && over_limit()){
+                    OutgoingCommand& oldest = out_commands.front();
+                    out_command_bytes -= oldest.command().data.size() + COMMAND_OVERHEAD;
+                    out_control &= ~control_bit(oldest.command());
+                    if(oldest.on_flushed) oldest.on_flushed(false);
+                    out_commands.pop();
+                    ++out_dropped;
+                }
+                if(over_limit()){ // the data in flight alone is above the mark
+                    return reject();
+                }
+                break;
+            }
+            case SendLimits::DROP_NEWEST:
+            {
+                return reject();
+            }
+            case SendLimits::DISCONNECT:
+            {
+                disconnect = true;
+                return reject();
+            }
+        }
+    }
+
+    out_command_bytes += cost;
+    out_control |= control;
+    out_commands.push(std::move(out));
+    paced_pending = true;
+
+    return SEND_ACCEPTED;
+}
+
+void Socket::check_drain() {
+    if(!congested || get_queued_bytes() > send_limits.low_water) return;
+
+    if(congested.exchange(false)){
+        trigger_hook("on_drain");
+    }
+}
+
+void Socket::set_send_limits(const SendLimits& limits) {
     std::unique_lock<std::shared_mutex> lock(outgoing_command_lock);
-    out_commands.emplace(std::move(cmd)); // move command into the queue
+    send_limits = limits;
+}
+
+size_t Socket::get_queued_bytes() {
+    std::shared_lock<std::shared_mutex> lock(outgoing_command_lock);
+    return out_command_bytes + out_flushing_bytes;
+}
+
+size_t Socket::get_queued_commands() {
+    std::shared_lock<std::shared_mutex> lock(outgoing_command_lock);
+    return out_commands.size();
+}
+
+static constexpr auto HANDSHAKE_TIMEOUT = std::chrono::seconds(3);
+static constexpr size_t MAX_INBOX_BYTES = 1024 * 1024; // user commands kept for receive_command before the oldest is dropped
+static std::atomic<uint64_t> next_receiver = 0; // shared by every socket - a receiver keeps its id when a resumed session moves it
+
+void Socket::start_handshake_timeout() {
+    auth_timer = timers.schedule(HANDSHAKE_TIMEOUT, [this](){ // validation timeout
+        if(!server_authorized){
+            DLOG_WARN << "socket " << name << " - handshake timeout\n";
+            shutdown();
+            valid = false;
+        }
+        authorizing = false;
+        mark_ready(); // let the owner release an invalid socket
+    });
+}
+
+void Socket::handshake_complete(const Handshake& negotiated) {
+    max_frame = negotiated.max_frame;
+    capabilities = negotiated.capabilities;
+    if(!client_side && (negotiated.capabilities & CAP_SESSION)) hold_output = true; // nothing goes out until the client asked for a session
+
+    server_authorized = true;
+    if(timers.cancel(auth_timer)) authorizing = false; // the timeout will never run
+    trigger_hook("on_authorized");
+    incoming_command_handle(); // begin incoming data stream
 }
 
 void Socket::server_authorize() {
@@ -121,72 +354,171 @@ void Socket::server_authorize() {
     if(authorizing) return;
 
     authorizing = true;
+    start_handshake_timeout();
 
-    asio::async_read(socket, asio::buffer(in_data, sizeof(DREAM_PROTO_ACCESS)), [&](const asio::error_code& error, size_t bytes){
+    asio::async_read(socket, asio::buffer(in_data, Handshake::HELLO_SIZE), [this](const asio::error_code& error, size_t bytes){
         if(error){
             return 0ULL;
         }
-        return sizeof(DREAM_PROTO_ACCESS) - bytes;
-    }, [&](const asio::error_code& error, size_t bytes){
-        if(error || sizeof(DREAM_PROTO_ACCESS) != bytes){
+        return Handshake::HELLO_SIZE - bytes;
+    }, [this](const asio::error_code& error, size_t bytes){
+        Handshake hello;
+        if(error || Handshake::HELLO_SIZE != bytes || !Handshake::read_hello(in_data, DREAM_PROTO_ACCESS, hello)){
             return; // auth read error - no print or error handling for security
         }
-        std::string rcv(in_data, bytes);
-        std::string rdx(DREAM_PROTO_ACCESS, sizeof(DREAM_PROTO_ACCESS));
-        if( (server_authorized = (rcv == rdx)) ){ // authorized successful
-            trigger_hook("on_authorized");
-            incoming_command_handle(); // begin incoming data stream
-        }
-    });
 
-    std::thread timeout([&](){
-        dream::Clock::sleepSeconds(3);
-        if(!server_authorized){
-            dlog << "invalid client - validation timeout\n";
-            shutdown();
-            valid = false;
+        Handshake welcome = hello.negotiate(protocol);
+        welcome.write_welcome(handshake_out);
+
+        if(!out_payload_protection.try_acquire()) return; // nothing else writes before the handshake
+        const bool accepted = welcome.status == Handshake::ACCEPTED;
+        send_raw_data(handshake_out, Handshake::WELCOME_SIZE, [this, accepted](bool success){
+            out_payload_protection.release();
+            if(!accepted) return shutdown(); // the client learned why
+            if(flush_pending.exchange(false)) mark_ready(); // commands the join hooks queued while the WELCOME was in flight
+        });
+
+        if(!accepted){
+            DLOG_WARN << "socket " << name << " - protocol version " << hello.version << " is not supported\n";
+            return;
         }
-        authorizing = false;
+        handshake_complete(welcome); // the client can send right after its HELLO - no need to wait for the WELCOME to be written
     });
-    timeout.detach();
 }
 
 void Socket::client_authorize() {
-    for(int i=0; i < 4 && // retry 3 times
-        (
-            !out_payload_protection.try_acquire() ||
-            !send_raw_data(DREAM_PROTO_ACCESS, sizeof(DREAM_PROTO_ACCESS), [this](bool success){
-                if(success){
-                    server_authorized = true;
-                    trigger_hook("on_authorized"); // for now authorize the client connection immediately after sending the data
-                    reset_and_receive_data(); // begin incoming data stream
-                }
-                out_payload_protection.release();
-            })
-        ); ++i) Clock::sleepSeconds(1); // 1 second timeout
+    std::unique_lock<std::recursive_mutex> lock(shutdown_lock);
+    if(authorizing || server_authorized) return;
+
+    authorizing = true;
+    client_side = true;
+    start_handshake_timeout();
+
+    Handshake::offer(protocol).write_hello(handshake_out, DREAM_PROTO_ACCESS);
+
+    if(!out_payload_protection.try_acquire() || !send_raw_data(handshake_out, Handshake::HELLO_SIZE, [this](bool success){
+        out_payload_protection.release();
+        if(flush_pending.exchange(false)) mark_ready();
+    })){
+        DLOG_ERROR << "socket " << name << " - handshake could not be sent\n";
+        shutdown();
+        return;
+    }
+
+    asio::async_read(socket, asio::buffer(in_data, Handshake::WELCOME_SIZE), [this](const asio::error_code& error, size_t bytes){
+        if(error){
+            return 0ULL;
+        }
+        return Handshake::WELCOME_SIZE - bytes;
+    }, [this](const asio::error_code& error, size_t bytes){
+        if(error || Handshake::WELCOME_SIZE != bytes){
+            DLOG_ERROR << "socket " << name << " - handshake failed: " << error.message() << "\n";
+            shutdown();
+            return;
+        }
+
+        Handshake welcome = Handshake::read_welcome(in_data);
+        if(welcome.status != Handshake::ACCEPTED){
+            DLOG_ERROR << "socket " << name << " - server does not support protocol version " << Handshake::VERSION << "\n";
+            shutdown();
+            return;
+        }
+        handshake_complete(welcome);
+    });
 }
 
 void Socket::runtime_update() {
 
     process_incoming_commands();
 
+    if(paced && !flush_due.exchange(false)) return; // waits for the owner's tick - see tick_flush
+
     process_outgoing_commands();
 }
 
+bool Socket::tick_flush() {
+    if(!paced_pending.exchange(false)) return false;
+
+    flush_due = true;
+    return !ready_queued.exchange(true); // already queued - the update that is coming flushes
+}
+
+bool Socket::begin_update() {
+    update_again = true; // before the attempt - the thread that holds the socket checks it after letting go
+    if(updating.exchange(true)) return false;
+    update_again = false;
+    return true;
+}
+
+bool Socket::end_update() {
+    updating = false;
+    return update_again.exchange(false);
+}
+
+void Socket::mark_ready() {
+    if(ready_handler && !ready_queued.exchange(true)){
+        ready_handler(*this);
+    }
+}
+
 void Socket::shutdown() {
-    std::unique_lock<std::recursive_mutex> lock(shutdown_lock);
+    bool gone = false;
+    {
+        std::unique_lock<std::recursive_mutex> lock(shutdown_lock);
 
-    if(socket.is_open()){
-        dlog << "socket " << name << " disconnected\n";
-        socket.close();
-        trigger_hook("on_disconnected");
+        if(socket.is_open()){
+            DLOG_INFO << "socket " << name << " disconnected\n";
+            socket.close();
+            if(session_grace){ // keep the session around for a reconnect
+                detach_deadline = (std::chrono::steady_clock::now() + std::chrono::milliseconds(session_grace)).time_since_epoch().count();
+            } else {
+                gone = true;
+            }
+            trigger_hook("on_disconnected");
+            mark_ready();
+        }
     }
+
+    if(gone) release_waiters(); // outside the shutdown lock - send_raw_data takes it while the outgoing lock is held
+    else check_flushed(); // a detached session keeps its queue - but nothing is written until it is resumed
+}
+
+void Socket::release_waiters() {
+    std::vector<FlushHandler> flushes;
+    {
+        std::unique_lock<std::shared_mutex> lock(outgoing_command_lock);
+        flushes.swap(package_flushes);
+        flushes.insert(flushes.end(), std::make_move_iterator(flush_waiters.begin()), std::make_move_iterator(flush_waiters.end()));
+        flush_waiters.clear();
+        std::queue<OutgoingCommand> queued;
+        for(; !out_commands.empty(); out_commands.pop()){
+            OutgoingCommand& out = out_commands.front();
+            if(out.on_flushed) flushes.emplace_back(std::move(out.on_flushed));
+            queued.push({ std::move(out.cmd), nullptr, std::move(out.shared) });
+        }
+        out_commands.swap(queued);
+    }
+
+    std::deque<Receiver> waiting;
+    {
+        std::scoped_lock lock(inbox_lock);
+        waiting.swap(receivers);
+    }
+
+    for(auto& on_flushed : flushes) on_flushed(false);
+    for(auto& receiver : waiting) receiver.handler(RECEIVE_CLOSED, Command(), 0);
+    rpc_calls->fail_all(RPC_DISCONNECTED);
 }
 
 bool Socket::is_valid() {
     return socket.is_open() && valid;
 }
 
+bool Socket::is_detached() {
+    int64_t deadline = detach_deadline;
+    return deadline && !socket.is_open() && std::chrono::steady_clock::now().time_since_epoch().count() < deadline;
+}
+
 bool Socket::is_authorized() {
     return server_authorized.load();
 }
@@ -203,7 +535,7 @@ void Socket::reset_and_receive_data() {
 
 void Socket::incoming_command_handle() {
     if (!in_payload_protection.try_acquire()) {
-        dlog << "A serious error has occurred:\nThe incoming data handler was called at an invalid time!\n";
+        DLOG_ERROR << "A serious error has occurred:\nThe incoming data handler was called at an invalid time!\n";
         return;
     }
 
@@ -215,12 +547,15 @@ void Socket::incoming_command_handle() {
         return sizeof(cmdbuf) - bytes;
     }, [this](const asio::error_code& error, size_t bytes){
         if(error){
-            dlog << error.message() << "\n";
+            DLOG_ERROR << error.message() << "\n";
             if(internal_error_check(error)) reset_and_receive_data();
         } else {
 
             uint32_t len = *std::launder(reinterpret_cast<uint32_t*>(cmdbuf));
-            if(!len){
+            if(len > max_frame){
+                DLOG_WARN << "socket " << name << " - frame of " << len << " bytes is above the negotiated maximum\n";
+                shutdown();
+            } else if(!len){
                 reset_and_receive_data();
             } else {
                 incoming_data_handle(len); // 4 byte payload length sent to data payload retriever
@@ -234,13 +569,13 @@ void Socket::incoming_data_handle(size_t length) {
 
     asio::async_read(socket, asio::buffer(in_data, length - overflow), [this, length, overflow](const asio::error_code& error, size_t bytes){
         if(error){
-            dlog << error.message() << "\n";
+            DLOG_ERROR << error.message() << "\n";
             if(!internal_error_check(error)) return 0ULL;
         }
         return length - overflow - bytes;
     }, [this, length, overflow](const asio::error_code& error, size_t bytes) mutable {
         if(error){
-            dlog << error.message() << "\n";
+            DLOG_ERROR << error.message() << "\n";
             if(internal_error_check(error)) reset_and_receive_data();
         } else {
             in_payload.write(in_data, bytes);
@@ -249,6 +584,8 @@ void Socket::incoming_data_handle(size_t length) {
             if(length > 0){ // more data that needs to be read
                 incoming_data_handle(length); // continue reading data with the left-over payload size
             } else {
+                if(capture && capture->is_active()) capture->record(id, Capture::INBOUND, in_payload.view());
+
                 Command cmd;
                 try {
                     cereal::BinaryInputArchive fetch(in_payload);
@@ -257,19 +594,309 @@ void Socket::incoming_data_handle(size_t length) {
                         std::unique_lock<std::shared_mutex> lock(incoming_command_lock);
                         in_commands.emplace(std::move(cmd));
                     }
+                    mark_ready();
                 } catch(cereal::Exception e){
-                    dlog << "\tcaught exception: " << e.what() << "\n";
+                    DLOG_ERROR << "\tcaught exception: " << e.what() << "\n";
                 }
-                reset_and_receive_data();
+                command_received(size_t(in_payload.tellp()) + sizeof(cmdbuf));
             }
         }
     });
 }
 
+void Socket::command_received(size_t bytes) {
+    {
+        std::unique_lock<std::shared_mutex> lock(incoming_command_lock);
+
+        receive_stats.bytes_received += bytes;
+        ++receive_stats.commands_received;
+
+        in_bytes.take(double(bytes)); // buckets may go into debt - the next read waits for it to be paid off
+        in_messages.take(1.0);
+
+        if(receive_limits.max_commands && in_commands.size() >= receive_limits.max_commands){
+            queue_paused = true; // process_incoming_commands resumes reading
+            ++receive_stats.queue_pauses;
+            return;
+        }
+    }
+
+    continue_receiving();
+}
+
+void Socket::continue_receiving() {
+    std::chrono::milliseconds wait;
+    {
+        std::unique_lock<std::shared_mutex> lock(incoming_command_lock);
+        in_bytes.refill();
+        in_messages.refill();
+        wait = std::max(in_bytes.time_until(1.0), in_messages.time_until(1.0));
+        if(wait.count()) ++receive_stats.rate_pauses;
+    }
+
+    if(wait.count()){ // leave the data in the kernel buffer - tcp flow control pushes back on the sender
+        read_timer = timers.schedule(wait, [this](){ reset_and_receive_data(); });
+        return;
+    }
+
+    reset_and_receive_data();
+}
+
+void Socket::set_hold_output(bool hold) {
+    hold_output = hold;
+    if(hold) return;
+
+    flush_due = true; // the held commands and the replay do not wait for a tick
+    mark_ready(); // send whatever was held back
+}
+
+void Socket::start_session(const std::string& token, std::chrono::milliseconds grace, size_t backlog) {
+    SessionTicket ticket { token, uint32_t(grace.count()) };
+    {
+        std::unique_lock<std::shared_mutex> lock(outgoing_command_lock);
+        session.start(token, grace, backlog);
+        session_grace = grace.count();
+
+        bool disconnect = false;
+        queue_command(Session::encode(Command::SESSION, ticket), disconnect);
+    }
+    set_hold_output(false);
+}
+
+void Socket::adopt_session(Socket& old) {
+    std::scoped_lock lock(outgoing_command_lock, incoming_command_lock, old.outgoing_command_lock, old.incoming_command_lock);
+
+    hold_output = true; // nothing goes out until both sides agree on what was missed
+
+    session = std::move(old.session);
+    old.session.reset();
+    session_grace = old.session_grace.load();
+
+    out_commands = std::move(old.out_commands); // commands queued for this connection before the session was known are superseded
+    old.out_commands = {};
+    out_command_bytes = old.out_command_bytes;
+    out_control = old.out_control;
+    old.out_command_bytes = 0;
+    old.out_control = 0;
+
+    {
+        std::scoped_lock inbox_guard(inbox_lock, old.inbox_lock); // so do the coroutines waiting on it
+        inbox_open = old.inbox_open;
+        inbox = std::move(old.inbox);
+        inbox_bytes = old.inbox_bytes;
+        inbox_dropped = old.inbox_dropped;
+        receivers = std::move(old.receivers);
+        old.inbox.clear();
+        old.inbox_bytes = 0;
+        old.inbox_dropped = false;
+        old.receivers.clear();
+    }
+    std::swap(rpc_calls, old.rpc_calls); // the answers come in on the new connection
+
+    adopt_global_hooks(old); // user hooks follow the session
+}
+
+void Socket::resume_session(uint64_t peer_received, bool reply) {
+    size_t replayed;
+    {
+        uint64_t received = 0;
+        if(reply){ // the client resumes from process_command - it already holds the incoming lock and needs no count
+            std::shared_lock<std::shared_mutex> lock(incoming_command_lock);
+            received = session.get_received();
+        }
+
+        std::unique_lock<std::shared_mutex> lock(outgoing_command_lock);
+
+        std::vector<Command> missed = session.rewind(peer_received);
+        replayed = missed.size();
+
+        std::queue<OutgoingCommand> queue;
+        size_t bytes = 0;
+        uint8_t control = 0;
+        auto push = [&](OutgoingCommand&& out){
+            bytes += out.command().data.size() + COMMAND_OVERHEAD;
+            control |= control_bit(out.command());
+            queue.emplace(std::move(out));
+        };
+
+        if(reply) push({ Session::encode(Command::RESUMED, SessionResumed { true, received }), nullptr }); // must reach the peer before the replay
+        for(Command& cmd : missed) push({ std::move(cmd), nullptr });
+        for(; !out_commands.empty(); out_commands.pop()) push(std::move(out_commands.front())); // queued while disconnected
+
+        out_commands.swap(queue);
+        out_command_bytes = bytes;
+        out_control = control;
+    }
+
+    DLOG_INFO << "socket " << name << " resumed session - " << replayed << " commands replayed\n";
+
+    set_hold_output(false);
+    trigger_hook("on_resumed", peer_received);
+}
+
+void Socket::end_session() {
+    {
+        std::unique_lock<std::shared_mutex> lock(outgoing_command_lock);
+        session.reset();
+        session_grace = 0;
+    }
+    set_hold_output(false);
+}
+
+void Socket::abandon_session() {
+    detach_deadline = 0;
+    release_waiters();
+}
+
+void Socket::hold_inbox() {
+    std::scoped_lock lock(inbox_lock);
+    inbox_open = true;
+}
+
+uint64_t Socket::receive_command(Command::Type type, ReceiveHandler handler, bool requests) {
+    std::unique_lock<std::mutex> lock(inbox_lock);
+    inbox_open = true; // a receive loop awaits the next command right after this one
+
+    if(inbox_dropped){ // the caller learns that it missed commands - the next receive goes on with what is left
+        inbox_dropped = false;
+        lock.unlock();
+        handler(RECEIVE_DROPPED, Command(), 0);
+        return 0;
+    }
+
+    for(auto waiting = inbox.begin(); waiting != inbox.end(); ++waiting){
+        if((type != Command::NILL && waiting->cmd.type != type) || (waiting->request != 0) != requests) continue;
+
+        Unclaimed found = std::move(*waiting);
+        inbox_bytes -= found.cmd.data.size() + sizeof(Unclaimed);
+        inbox.erase(waiting);
+        lock.unlock();
+        handler(RECEIVE_OK, std::move(found.cmd), found.request);
+        return 0;
+    }
+
+    if(!is_valid() && !is_detached()){ // nothing more is coming
+        lock.unlock();
+        handler(RECEIVE_CLOSED, Command(), 0);
+        return 0;
+    }
+
+    const uint64_t id = ++next_receiver;
+    receivers.push_back({ id, type, requests, false, std::move(handler) });
+    return id;
+}
+
+uint64_t Socket::receive_reply(ReceiveHandler handler) {
+    std::scoped_lock lock(inbox_lock);
+    const uint64_t id = ++next_receiver; // unique across sockets - a reply can never complete somebody else's request
+    receivers.push_back({ id, Command::NILL, false, true, std::move(handler) });
+    return id;
+}
+
+void Socket::cancel_receive(uint64_t id) {
+    ReceiveHandler handler;
+    {
+        std::scoped_lock lock(inbox_lock);
+        auto receiver = std::find_if(receivers.begin(), receivers.end(), [id](const Receiver& r){ return r.id == id; });
+        if(receiver == receivers.end()) return; // already ran
+        handler = std::move(receiver->handler);
+        receivers.erase(receiver);
+    }
+    handler(RECEIVE_CLOSED, Command(), 0);
+}
+
+void Socket::deliver_command(const Command& cmd) {
+    Command message;
+    uint64_t request = 0, reply = 0;
+    if(cmd.type == Command::REQUEST || cmd.type == Command::REPLY){
+        MessageEnvelope envelope;
+        if(!Session::decode(cmd, envelope) || !envelope.id || envelope.type == Command::NILL || envelope.type >= Command::RESERVED) return;
+        message = Command(Command::Type(envelope.type), std::move(envelope.data));
+        (cmd.type == Command::REQUEST ? request : reply) = envelope.id;
+    } else {
+        message = cmd;
+    }
+
+    ReceiveHandler handler;
+    {
+        std::scoped_lock lock(inbox_lock);
+
+        auto receiver = std::find_if(receivers.begin(), receivers.end(), [&](const Receiver& r){
+            if(reply || r.reply) return r.reply && r.id == reply;
+            return (r.type == Command::NILL || r.type == message.type) && r.requests == (request != 0);
+        });
+        if(receiver == receivers.end()){
+            if(reply) return; // the request was cancelled or failed - nobody waits for the answer anymore
+            if(!inbox_open) return; // applications that never use send or receive keep nothing
+
+            inbox_bytes += message.data.size() + sizeof(Unclaimed);
+            inbox.push_back({ std::move(message), request });
+            while(inbox.size() > 1 && inbox_bytes > MAX_INBOX_BYTES){ // nobody claims them - the newest command is always kept
+                if(!inbox_dropped){
+                    DLOG_WARN << "socket " << name << " inbox is full - dropping the oldest commands\n";
+                    inbox_dropped = true;
+                }
+                inbox_bytes -= inbox.front().cmd.data.size() + sizeof(Unclaimed);
+                inbox.pop_front();
+            }
+            return;
+        }
+        handler = std::move(receiver->handler);
+        receivers.erase(receiver);
+    }
+    handler(RECEIVE_OK, std::move(message), request);
+}
+
+uint64_t Socket::send_request(RpcMethod method, const std::string& payload, RpcCallback callback, std::chrono::milliseconds timeout) {
+    const uint64_t id = rpc_calls->add(std::move(callback), timers, timeout);
+
+    send_command(Session::encode(Command::RPC_REQUEST, RpcRequest { id, method.id, payload }),
+        [&io = ctx, calls = std::weak_ptr<RpcCalls>(rpc_calls), id](bool flushed){ // may run on the socket that resumed this session
+            if(flushed) return;
+            asio::post(io, [calls, id](){ // the socket's locks may be held here
+                if(auto pending = calls.lock()) pending->complete(id, { RPC_DISCONNECTED, {} });
+            });
+        });
+    return id;
+}
+
+void Socket::send_response(uint64_t id, RpcStatus status, const std::string& payload) {
+    send_command(Session::encode(Command::RPC_RESPONSE, RpcResponse { id, status, payload }));
+}
+
+bool Socket::can_resume(const SessionResume& request) {
+    std::scoped_lock lock(outgoing_command_lock, incoming_command_lock);
+    return session.is_active() && request.token == session.get_token() &&
+           session.can_replay(request.received) && request.first_available <= session.get_received() + 1;
+}
+
+SessionResume Socket::get_resume_request() {
+    std::scoped_lock lock(outgoing_command_lock, incoming_command_lock);
+    return { session.get_token(), session.get_received(), session.first_available() };
+}
+
+std::string Socket::get_session_token() {
+    std::shared_lock<std::shared_mutex> lock(outgoing_command_lock);
+    return session.get_token();
+}
+
+void Socket::set_receive_limits(const ReceiveLimits& limits) {
+    std::unique_lock<std::shared_mutex> lock(incoming_command_lock);
+    receive_limits = limits;
+    in_bytes = TokenBucket(limits.byte_rate, limits.byte_burst);
+    in_messages = TokenBucket(limits.message_rate, limits.message_burst);
+}
+
+ReceiveStats Socket::get_receive_stats() {
+    std::shared_lock<std::shared_mutex> lock(incoming_command_lock);
+    return receive_stats;
+}
+
 bool Socket::internal_error_check(const asio::error_code& error) {
     trigger_hook("internal_error", error);
 
-    if(!socket.is_open() || ++consecutiveErrors > 4){
+    const bool closed = error == asio::error::eof || error == asio::error::connection_reset || error == asio::error::broken_pipe; // retrying cannot help
+    if(closed || !socket.is_open() || ++consecutiveErrors > 4){
         shutdown();
         return false; // failed
     }
@@ -282,16 +909,56 @@ void Socket::process_command(Command& cmd) {
     switch(cmd.type){
         case Command::PING:
         {
-            std::unique_lock<std::shared_mutex> lock(outgoing_command_lock);
-            out_commands.emplace(Command(Command::RESPONSE));
+            bool disconnect = false;
+            {
+                std::unique_lock<std::shared_mutex> lock(outgoing_command_lock);
+                queue_command(Command(Command::RESPONSE), disconnect); // sent by process_outgoing_commands right after this
+            }
+            if(disconnect) shutdown();
             break;
         }
         case Command::RESPONSE:
         {
             break;
         }
+        case Command::SESSION:
+        {
+            SessionTicket ticket;
+            if(!client_side || !Session::decode(cmd, ticket)) break;
+
+            std::unique_lock<std::shared_mutex> lock(outgoing_command_lock);
+            session.start(ticket.token, std::chrono::milliseconds(ticket.grace_ms), Session::DEFAULT_BACKLOG);
+            session_grace = ticket.grace_ms;
+            break;
+        }
+        case Command::RESUMED:
+        {
+            SessionResumed reply;
+            if(!client_side || !Session::decode(cmd, reply)) break;
+
+            if(reply.accepted){
+                resume_session(reply.received, false);
+            } else {
+                DLOG_INFO << "socket " << name << " session expired - starting over\n";
+                end_session(); // the server numbers the new session from zero - the held commands go out as part of it
+            }
+            break;
+        }
+        case Command::RPC_REQUEST:
+        {
+            break; // answered by the owner's method table - see RpcMethods
+        }
+        case Command::RPC_RESPONSE:
+        {
+            RpcResponse response;
+            if(!Session::decode(cmd, response)) break;
+
+            rpc_calls->complete(response.id, { RpcStatus(response.status), std::move(response.payload) });
+            break;
+        }
         default:
         {
+            if(Session::is_sequenced(cmd)) deliver_command(cmd);
             break;
         }
     }
@@ -303,24 +970,56 @@ void Socket::process_command(Command& cmd) {
 void Socket::process_incoming_commands() {
     std::unique_lock<std::shared_mutex> lock(incoming_command_lock);
 
-    while(!in_commands.empty()){ // process all commands and dequeue
+    for(size_t budget = UPDATE_BUDGET; budget && !in_commands.empty(); --budget){ // process commands and dequeue
+        session.received(in_commands.front()); // counted as processed - commands left behind by a disconnect are replayed by the peer
         process_command(in_commands.front());
         in_commands.pop();
     }
+
+    if(!in_commands.empty()){ // over budget - the rest waits for the next update
+        lock.unlock();
+        mark_ready();
+        return;
+    }
+
+    bool resume = queue_paused;
+    queue_paused = false;
+    lock.unlock();
+
+    if(resume) continue_receiving();
 }
 
 void Socket::process_outgoing_commands() {
     std::unique_lock<std::shared_mutex> lock(outgoing_command_lock);
 
-    bool flush = false;
-    for(; !out_commands.empty(); out_commands.pop()){
-        append_command_package(std::move(out_commands.front())); // move all commands into package cache
-        if(!flush) flush = true;
+    if(out_commands.empty() && check_command_package() == 0) return;
+
+    flush_pending = true; // set before the attempt so an in-flight flush that completes now still sees it
+    if(!out_payload_protection.try_acquire()){ // commands stay queued - and subject to the send limits - until the flush completes
+        if(paced) flush_due = true; // they were due at this tick - the completion picks them up
+        return;
     }
+    flush_pending = false;
 
-    if(flush || check_command_package() > 0){
-        flush_command_package(); // flush out the payload stream
+    std::queue<OutgoingCommand> held;
+    size_t held_bytes = 0;
+    for(; !out_commands.empty(); out_commands.pop()){
+        OutgoingCommand& out = out_commands.front();
+        if(hold_output && Session::is_sequenced(out.cmd)){ // waiting for the session handshake
+            held_bytes += out.command().data.size() + COMMAND_OVERHEAD;
+            held.emplace(std::move(out));
+            continue;
+        }
+        session.sent(out.command());
+        if(out.shared) append_frame(out.shared->frame); // framed once for every subscriber
+        else append_command_package(std::move(out.cmd)); // move all commands into package cache
+        if(out.on_flushed) package_flushes.emplace_back(std::move(out.on_flushed));
     }
+    out_commands.swap(held);
+    out_command_bytes = held_bytes;
+    out_control = 0; // held commands are never control commands
+
+    send_command_package(); // flush out the payload stream
 }
 
 }
@@ -0,0 +1,596 @@
+#include "dream_store.h"
+#include "dream_externs.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+    #include <io.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace dream {
+
+static const char SNAPSHOT_MAGIC[8] = { 'D', 'R', 'M', 'S', 'N', 'A', 'P', '2' };
+static const char* SNAPSHOT_FILE = "block.snap.";
+static const char* JOURNAL_FILE = "block.journal.";
+
+struct SnapshotHeader {
+    char magic[8];
+    uint64_t tick; // store tick of the view the snapshot was written from
+    uint64_t count;
+    uint64_t index_offset; // the index runs to the end of the file
+    uint32_t index_checksum;
+    uint32_t data_checksum; // blob bytes between the header and the index
+};
+
+// index entry: u64 id, u64 offset, u64 length, u32 name length, name bytes
+// journal record: u32 body length, u32 body checksum, body { u64 tick, u64 id, u32 name length, name bytes, blob bytes }
+static constexpr size_t RECORD_FIXED = sizeof(uint64_t) * 2 + sizeof(uint32_t);
+
+static uint32_t checksum(const char* data, size_t length) { // fnv-1a - catches torn writes, not tampering
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; ++i){
+        hash = (hash ^ uint8_t(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+template<typename T>
+static void put(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+static bool get(const char*& data, const char* end, T& value) {
+    if(size_t(end - data) < sizeof(value)) return false;
+    std::memcpy(&value, data, sizeof(value));
+    data += sizeof(value);
+    return true;
+}
+
+static bool sync_file(std::FILE* file) {
+    if(std::fflush(file)) return false;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+static void sync_directory(const std::string& directory) { // make renames and new files durable
+#ifndef _WIN32
+    int fd = ::open(directory.c_str(), O_RDONLY);
+    if(fd < 0) return;
+    fsync(fd);
+    ::close(fd);
+#endif
+}
+
+class MappedFile {
+public:
+    const char* data;
+    size_t size;
+
+    MappedFile(): data(nullptr), size(0) {}
+    ~MappedFile() { unmap(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool map(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER length;
+        if(!GetFileSizeEx(file, &length) || length.QuadPart == 0){ unmap(); return false; }
+
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(!mapping){ unmap(); return false; }
+
+        data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if(!data){ unmap(); return false; }
+        size = size_t(length.QuadPart);
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) return false;
+
+        struct stat info;
+        if(fstat(fd, &info) || info.st_size == 0){ unmap(); return false; }
+
+        void* view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if(view == MAP_FAILED){ unmap(); return false; }
+
+        data = static_cast<const char*>(view);
+        size = size_t(info.st_size);
+#endif
+        return true;
+    }
+
+    void unmap() {
+#ifdef _WIN32
+        if(data) UnmapViewOfFile(data);
+        if(mapping) CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if(data) munmap(const_cast<char*>(data), size);
+        if(fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// walks the index of a mapped snapshot - f(id, name, bytes) - false if the file is not a complete snapshot
+template<typename F>
+static bool read_snapshot(const MappedFile& file, uint64_t& tick, F&& f) {
+    if(file.size < sizeof(SnapshotHeader)) return false;
+
+    SnapshotHeader header;
+    std::memcpy(&header, file.data, sizeof(header));
+    if(std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) || header.index_offset > file.size) return false;
+
+    if(header.index_offset < sizeof(header)) return false;
+
+    const char* data = file.data + header.index_offset;
+    const char* end = file.data + file.size;
+    if(checksum(data, size_t(end - data)) != header.index_checksum) return false; // torn write
+    if(checksum(file.data + sizeof(header), size_t(header.index_offset - sizeof(header))) != header.data_checksum) return false;
+
+    for(uint64_t i = 0; i < header.count; ++i){
+        uint64_t id, offset, length;
+        uint32_t name_length;
+        if(!get(data, end, id) || !get(data, end, offset) || !get(data, end, length) || !get(data, end, name_length)) return false;
+        if(size_t(end - data) < name_length || offset + length > header.index_offset) return false;
+
+        f(id, std::string(data, name_length), std::string_view(file.data + offset, size_t(length)));
+        data += name_length;
+    }
+
+    tick = header.tick;
+    return true;
+}
+
+BlockStore::BlockStore(): config(DEFAULT_STORE_CONFIG), mapped_slot(-1), max_id(0), recorded_tick(0), durable_tick(0),
+    sync_requested(false), journal(nullptr), journal_index(0), stats({}), running(false) {}
+
+BlockStore::~BlockStore() {
+    close();
+}
+
+std::string BlockStore::path(const std::string& file) const {
+    return (std::filesystem::path(config.directory) / file).string();
+}
+
+bool BlockStore::open(const StoreConfig& cfg) {
+    close();
+    config = cfg;
+    stats = {};
+    journal_index = 0;
+    max_id = 0;
+    pending.clear();
+
+    std::error_code ec;
+    std::filesystem::create_directories(config.directory, ec);
+    if(!std::filesystem::is_directory(config.directory, ec)) return false;
+
+    uint64_t snapshot_tick = 0;
+    {
+        std::scoped_lock lock(restore_lock);
+
+        int best = -1;
+        for(int slot = 0; slot < 2; ++slot){ // the newest complete snapshot wins
+            MappedFile file;
+            uint64_t tick;
+            if(file.map(path(SNAPSHOT_FILE + std::to_string(slot))) && read_snapshot(file, tick, [](uint64_t, std::string, std::string_view){})){
+                if(best < 0 || tick > snapshot_tick){
+                    best = slot;
+                    snapshot_tick = tick;
+                }
+            }
+        }
+
+        if(best >= 0 && !map_snapshot(best)){
+            DLOG_ERROR << "block store: snapshot " << best << " could not be mapped\n";
+            return false;
+        }
+    }
+
+    recorded_tick = snapshot_tick;
+    replay_journal(snapshot_tick);
+
+    journal = std::fopen(path(JOURNAL_FILE + std::to_string(++journal_index)).c_str(), "ab"); // a torn segment is never appended to
+    if(!journal){
+        DLOG_ERROR << "block store: journal could not be opened in " << config.directory << "\n";
+        return false;
+    }
+    sync_directory(config.directory);
+
+    durable_tick = recorded_tick;
+    running = true;
+    writer = std::thread([this](){ writer_loop(); });
+
+    DLOG_INFO << "block store opened - " << restored.size() << " blobs restorable, " << stats.replayed << " journal records replayed\n";
+    return true;
+}
+
+void BlockStore::close() {
+    {
+        std::scoped_lock lock(journal_lock);
+        running = false;
+    }
+    journal_signal.notify_all();
+    if(writer.joinable()) writer.join(); // commits what is still pending
+
+    durable_signal.notify_all();
+
+    if(journal) std::fclose(journal);
+    journal = nullptr;
+
+    std::scoped_lock lock(restore_lock);
+    restored.clear();
+    restored_names.clear();
+    recorded.clear();
+    mapping.reset();
+    mapped_slot = -1;
+    last_view.reset();
+}
+
+bool BlockStore::map_snapshot(int slot) {
+    auto file = std::make_shared<MappedFile>();
+    if(!file->map(path(SNAPSHOT_FILE + std::to_string(slot)))) return false;
+
+    const bool reopen = mapping != nullptr; // rewritten snapshot - only the blobs still waiting for the Block move to the new mapping
+    std::unordered_map<uint64_t, Entry> moved;
+
+    uint64_t tick;
+    bool complete = read_snapshot(*file, tick, [&](uint64_t id, std::string name, std::string_view bytes){
+        if(reopen){
+            if(!restored.count(id)) return;
+            moved.insert_or_assign(id, Entry { std::move(name), bytes, nullptr });
+            return;
+        }
+        restored_names.insert_or_assign(name, id);
+        restored.insert_or_assign(id, Entry { std::move(name), bytes, nullptr });
+        max_id = std::max(max_id, id);
+    });
+    if(!complete) return false;
+
+    for(auto& [id, entry] : moved) restored.insert_or_assign(id, std::move(entry));
+
+    mapping = std::move(file); // the previous mapping is released here
+    mapped_slot = slot;
+    return true;
+}
+
+std::vector<std::pair<uint64_t, std::string>> BlockStore::list_journal() const {
+    std::vector<std::pair<uint64_t, std::string>> segments;
+
+    std::error_code ec;
+    const std::string prefix = JOURNAL_FILE;
+    for(auto& file : std::filesystem::directory_iterator(config.directory, ec)){
+        std::string name = file.path().filename().string();
+        if(name.compare(0, prefix.size(), prefix)) continue;
+        try {
+            segments.emplace_back(std::stoull(name.substr(prefix.size())), file.path().string());
+        } catch(...) {}
+    }
+    std::sort(segments.begin(), segments.end());
+
+    return segments;
+}
+
+void BlockStore::replay_journal(uint64_t snapshot_tick) {
+    std::scoped_lock lock(restore_lock);
+    for(auto& [index, file] : list_journal()){
+        journal_index = std::max(journal_index, index);
+
+        std::ifstream input(file, std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+        const char* data = contents.data();
+        const char* end = data + contents.size();
+        while(data < end){
+            uint32_t length, sum;
+            if(!get(data, end, length) || !get(data, end, sum) || size_t(end - data) < length || length < RECORD_FIXED) break;
+            if(checksum(data, length) != sum) break; // torn tail - the rest of the segment was never committed
+
+            const char* body = data;
+            const char* body_end = data + length;
+            data = body_end;
+
+            uint64_t tick = 0, id = 0;
+            uint32_t name_length = 0;
+            get(body, body_end, tick);
+            get(body, body_end, id);
+            get(body, body_end, name_length);
+            if(size_t(body_end - body) < name_length) break;
+
+            recorded_tick = std::max(recorded_tick, tick);
+            if(tick <= snapshot_tick) continue; // already part of the snapshot
+
+            std::string name(body, name_length);
+            auto owned = std::make_shared<const std::string>(body + name_length, body_end);
+
+            restored_names.insert_or_assign(name, id);
+            restored.insert_or_assign(id, Entry { std::move(name), std::string_view(*owned), owned });
+            max_id = std::max(max_id, id);
+            ++stats.replayed;
+        }
+    }
+}
+
+bool BlockStore::take(const std::string& name, uint64_t& id, std::string& bytes) {
+    std::scoped_lock lock(restore_lock);
+
+    auto it = restored_names.find(name);
+    if(it == restored_names.end()) return false;
+
+    auto entry = restored.find(it->second);
+    if(entry == restored.end()){
+        restored_names.erase(it);
+        return false;
+    }
+
+    id = entry->first;
+    bytes.assign(entry->second.bytes.data(), entry->second.bytes.size());
+    recorded.insert_or_assign(id, 1); // blobs start at version 1 - the restored state is already persisted
+
+    restored.erase(entry);
+    restored_names.erase(it);
+    return true;
+}
+
+void BlockStore::restore() {
+    std::shared_ptr<const BlockSnapshot> view;
+    {
+        std::scoped_lock lock(journal_lock);
+        view = last_view;
+    }
+    recorded.clear();
+    if(!view) return;
+
+    std::scoped_lock lock(restore_lock);
+    for(auto& [name, id] : view->names){
+        auto blob = view->blobs.find(id);
+        if(blob == view->blobs.end()) continue;
+
+        restored_names.insert_or_assign(name, id);
+        restored.insert_or_assign(id, Entry { name, std::string_view(*blob->second.data), blob->second.data });
+        max_id = std::max(max_id, id);
+    }
+}
+
+void BlockStore::record(const std::shared_ptr<const BlockSnapshot>& view) {
+    if(!running || !view) return;
+
+    std::vector<uint64_t> changed;
+    for(auto& [id, entry] : view->blobs){
+        auto it = recorded.find(id);
+        if(it != recorded.end() && it->second == entry.version) continue;
+
+        recorded.insert_or_assign(id, entry.version);
+        changed.push_back(id);
+    }
+
+    std::map<uint64_t, const std::string*> names; // only built when something changed
+    if(changed.size()){
+        for(auto& [name, id] : view->names) names.emplace(id, &name);
+    }
+
+    std::scoped_lock lock(journal_lock);
+    const uint64_t tick = ++recorded_tick;
+
+    for(uint64_t id : changed){
+        const std::string& bytes = *view->blobs.at(id).data;
+        auto name = names.find(id);
+        const std::string empty;
+        const std::string& blob_name = name != names.end() ? *name->second : empty;
+
+        std::string body;
+        body.reserve(RECORD_FIXED + blob_name.size() + bytes.size());
+        put(body, tick);
+        put(body, id);
+        put(body, uint32_t(blob_name.size()));
+        body += blob_name;
+        body += bytes;
+
+        put(pending, uint32_t(body.size()));
+        put(pending, checksum(body.data(), body.size()));
+        pending += body;
+    }
+
+    stats.records += changed.size();
+    last_view = view;
+
+    if(changed.size()) journal_signal.notify_one();
+}
+
+void BlockStore::sync() {
+    std::unique_lock<std::mutex> lock(journal_lock);
+    if(!running) return;
+
+    const uint64_t target = recorded_tick;
+    sync_requested = true;
+    journal_signal.notify_one();
+    durable_signal.wait(lock, [&](){ return durable_tick >= target || !running; });
+}
+
+StoreStats BlockStore::get_stats() {
+    std::scoped_lock lock(journal_lock);
+    return stats;
+}
+
+void BlockStore::writer_loop() {
+    std::unique_lock<std::mutex> lock(journal_lock);
+
+    while(true){
+        journal_signal.wait(lock, [this](){ return !running || pending.size() || sync_requested; });
+        if(!running && pending.empty()) break;
+
+        if(running && !sync_requested){ // group commit - everything recorded within the interval shares the fsync
+            journal_signal.wait_for(lock, config.commit_interval, [this](){ return !running || sync_requested; });
+        }
+
+        std::string batch;
+        std::swap(batch, pending);
+        const uint64_t tick = recorded_tick;
+        sync_requested = false;
+
+        lock.unlock();
+        const bool committed = batch.empty() || commit(batch);
+        if(!committed){
+            DLOG_ERROR << "block store: journal write failed\n";
+        }
+        lock.lock();
+
+        if(committed){
+            ++stats.commits;
+            stats.journal_bytes += batch.size();
+        }
+        durable_tick = tick; // waiters are released even after a failed write - the error is logged
+        durable_signal.notify_all();
+
+        if(stats.journal_bytes >= config.snapshot_threshold){
+            lock.unlock();
+            bool written = write_snapshot();
+            lock.lock();
+            if(written){
+                ++stats.snapshots;
+                stats.journal_bytes = 0;
+            }
+        }
+    }
+}
+
+bool BlockStore::commit(std::string& batch) {
+    return std::fwrite(batch.data(), 1, batch.size(), journal) == batch.size() && sync_file(journal);
+}
+
+bool BlockStore::write_snapshot() {
+    std::shared_ptr<const BlockSnapshot> view;
+    uint64_t tick, covered; // segments below covered are folded into this snapshot
+    {
+        std::scoped_lock lock(journal_lock); // nothing is recorded between taking the view and starting the next segment
+        view = last_view;
+        tick = recorded_tick;
+        if(!view) return false;
+
+        std::FILE* next = std::fopen(path(JOURNAL_FILE + std::to_string(journal_index + 1)).c_str(), "ab");
+        if(!next) return false;
+        std::fclose(journal);
+        journal = next;
+        covered = ++journal_index;
+    }
+
+    // blobs that were never inserted again are carried over from the mapping - copied under the lock so take() on the
+    // Block thread only waits for the copy, not for the write and fsync below
+    std::vector<std::pair<uint64_t, Entry>> carried;
+    std::shared_ptr<MappedFile> pinned; // the carried views point into it
+    int slot;
+    {
+        std::scoped_lock lock(restore_lock);
+        slot = mapped_slot == 0 ? 1 : 0;
+        pinned = mapping;
+        for(auto& [id, entry] : restored){
+            if(!view->blobs.count(id)) carried.emplace_back(id, entry);
+        }
+    }
+
+    const std::string file_path = path(SNAPSHOT_FILE + std::to_string(slot));
+
+    std::FILE* file = std::fopen(file_path.c_str(), "wb");
+    if(!file) return false;
+
+    std::map<uint64_t, const std::string*> names;
+    for(auto& [name, id] : view->names) names.emplace(id, &name);
+
+    SnapshotHeader header {}; // written without magic first - the file is no snapshot until its data is durable
+    uint32_t data_checksum = 2166136261u;
+
+    std::string index;
+    uint64_t offset = sizeof(header);
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+    auto write_entry = [&](uint64_t id, const std::string& name, std::string_view bytes){
+        put(index, id);
+        put(index, offset);
+        put(index, uint64_t(bytes.size()));
+        put(index, uint32_t(name.size()));
+        index += name;
+
+        ok = ok && std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        for(char c : bytes) data_checksum = (data_checksum ^ uint8_t(c)) * 16777619u; // continues checksum() over every blob
+        offset += bytes.size();
+        ++header.count;
+    };
+
+    const std::string empty;
+    for(auto& [id, entry] : view->blobs){
+        auto name = names.find(id);
+        write_entry(id, name != names.end() ? *name->second : empty, *entry.data);
+    }
+    for(auto& [id, entry] : carried){
+        write_entry(id, entry.name, entry.bytes);
+    }
+
+    ok = ok && std::fwrite(index.data(), 1, index.size(), file) == index.size();
+    ok = ok && sync_file(file); // data and index are durable before the header makes them a snapshot
+
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.tick = tick;
+    header.index_offset = offset;
+    header.index_checksum = checksum(index.data(), index.size());
+    header.data_checksum = data_checksum;
+
+    ok = ok && std::fseek(file, 0, SEEK_SET) == 0 && std::fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && sync_file(file);
+    std::fclose(file);
+
+    if(!ok){
+        DLOG_ERROR << "block store: snapshot write failed\n";
+        return false;
+    }
+    sync_directory(config.directory);
+
+    {
+        std::scoped_lock lock(restore_lock);
+        if(!map_snapshot(slot)){ // blobs taken while the snapshot was written stay taken
+            DLOG_ERROR << "block store: snapshot " << slot << " could not be mapped\n";
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    for(auto& [index, file] : list_journal()){ // the snapshot is durable - the folded segments are not needed anymore
+        if(index < covered) std::filesystem::remove(file, ec);
+    }
+
+    DLOG_DEBUG << "block store: snapshot " << slot << " written - " << header.count << " blobs\n";
+    return true;
+}
+
+}
@@ -0,0 +1,126 @@
+#include "dream_tick.h"
+#include "dream_externs.h"
+
+#include <algorithm>
+
+namespace dream {
+
+using steady = std::chrono::steady_clock;
+
+static double to_ms(steady::duration d) { return std::chrono::duration<double, std::milli>(d).count(); }
+
+TickScheduler::TickScheduler(): callbacks(std::make_shared<const std::vector<Entry>>()), next_id(0), stats({}), total_duration_ms(0), total_jitter_ms(0), running(false) {}
+
+TickScheduler::~TickScheduler() {
+    stop();
+}
+
+bool TickScheduler::start(double rate, std::chrono::microseconds spin) {
+    if(rate <= 0) return false;
+    stop();
+
+    const auto interval = std::chrono::duration_cast<steady::duration>(std::chrono::duration<double>(1.0 / rate));
+    running = true;
+    handle = std::thread([this, interval, spin](){ run(interval, spin); });
+    return true;
+}
+
+void TickScheduler::stop() {
+    {
+        std::scoped_lock lock(state_lock);
+        running = false;
+    }
+    wake.notify_all();
+    if(handle.joinable()){
+        handle.join();
+    }
+}
+
+uint64_t TickScheduler::add(Phase phase, Callback callback) {
+    std::scoped_lock lock(callbacks_lock);
+    auto changed = std::make_shared<std::vector<Entry>>(*callbacks);
+    changed->push_back({ ++next_id, phase, std::move(callback) });
+    callbacks = std::move(changed);
+    return next_id;
+}
+
+void TickScheduler::remove(uint64_t id) {
+    std::scoped_lock lock(callbacks_lock);
+    auto changed = std::make_shared<std::vector<Entry>>(*callbacks);
+    std::erase_if(*changed, [id](const Entry& e){ return e.id == id; });
+    callbacks = std::move(changed);
+}
+
+TickStats TickScheduler::get_stats() {
+    std::scoped_lock lock(stats_lock);
+    TickStats result = stats;
+    if(stats.ticks){
+        result.avg_duration_ms = total_duration_ms / stats.ticks;
+        result.avg_jitter_ms = total_jitter_ms / stats.ticks;
+    }
+    return result;
+}
+
+void TickScheduler::reset_stats() {
+    std::scoped_lock lock(stats_lock);
+    stats = {};
+    total_duration_ms = total_jitter_ms = 0;
+}
+
+bool TickScheduler::wait_until(steady::time_point deadline, std::chrono::microseconds spin) {
+    {
+        std::unique_lock<std::mutex> lock(state_lock);
+        wake.wait_until(lock, deadline - spin, [this](){ return !running; });
+    }
+
+    while(running && steady::now() < deadline) std::this_thread::yield(); // the sleep is only as precise as the os timer
+    return running;
+}
+
+void TickScheduler::run(steady::duration interval, std::chrono::microseconds spin) {
+    const steady::time_point origin = steady::now();
+    uint64_t tick = 0;
+
+    while(wait_until(origin + interval * tick, spin)){
+        const steady::time_point deadline = origin + interval * tick;
+        const steady::time_point woke = steady::now();
+
+        auto entries = [this](){ std::scoped_lock lock(callbacks_lock); return callbacks; }();
+        const TickInfo info { tick, deadline, interval };
+
+        for(Phase phase : { SIMULATE, REPLICATE }){
+            for(const Entry& entry : *entries){
+                if(entry.phase == phase) entry.callback(info);
+            }
+        }
+        if(flush) flush();
+
+        const steady::time_point done = steady::now();
+        uint64_t next = tick + 1;
+        uint64_t skipped = 0;
+        const bool overran = done >= origin + interval * next;
+        if(overran){ // resume with the first deadline that is still ahead
+            next = uint64_t((done - origin) / interval) + 1;
+            skipped = next - tick - 1;
+        }
+
+        {
+            std::scoped_lock lock(stats_lock);
+            const double duration = to_ms(done - woke), jitter = to_ms(woke - deadline);
+            ++stats.ticks;
+            stats.overruns += overran;
+            stats.skipped += skipped;
+            stats.max_duration_ms = std::max(stats.max_duration_ms, duration);
+            stats.max_jitter_ms = std::max(stats.max_jitter_ms, jitter);
+            total_duration_ms += duration;
+            total_jitter_ms += jitter;
+        }
+
+        if(skipped){
+            DLOG_DEBUG << "tick " << tick << " overran - skipping " << skipped << " ticks\n";
+        }
+        tick = next;
+    }
+}
+
+}
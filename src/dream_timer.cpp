@@ -0,0 +1,242 @@
+#include "dream_timer.h"
+
+#include <algorithm>
+
+namespace dream {
+
+TimerWheel::TimerWheel(asio::io_context& ctx, std::chrono::milliseconds resolution):
+    driver(ctx), resolution(resolution), origin(std::chrono::steady_clock::now()),
+    now_tick(0), armed_count(0), driving(false), running(0)
+{
+    std::fill(std::begin(wheel), std::end(wheel), NIL);
+}
+
+TimerWheel::~TimerWheel() {
+    stop();
+}
+
+uint64_t TimerWheel::current_tick() const {
+    return uint64_t((std::chrono::steady_clock::now() - origin) / resolution);
+}
+
+TimerId TimerWheel::schedule(Duration delay, std::function<void()> cb) {
+    uint64_t ticks = uint64_t(std::max<int64_t>(1, (delay + resolution - Duration(1)) / resolution)); // round up - timers never fire early
+    return arm(ticks, 0, std::move(cb));
+}
+
+TimerId TimerWheel::schedule_every(Duration interval, std::function<void()> cb) {
+    uint64_t ticks = uint64_t(std::max<int64_t>(1, (interval + resolution - Duration(1)) / resolution));
+    return arm(ticks, ticks, std::move(cb));
+}
+
+bool TimerWheel::cancel(TimerId id) {
+    std::unique_lock<std::mutex> lock(mtx);
+    wait_idle(lock, id); // the callback may already be running on the io thread - it must not outlive the cancel
+
+    Node* node = resolve(id);
+    if(!node) return false;
+
+    uint32_t index = uint32_t(id);
+    if(node->linked) unlink(index);
+    release(index);
+    return true;
+}
+
+void TimerWheel::wait_idle(std::unique_lock<std::mutex>& lock, TimerId id) {
+    // a callback that cancels its own timer - or any other from the io thread - must not wait for itself
+    idle_signal.wait(lock, [&](){ return !running || (id && running != id) || running_thread == std::this_thread::get_id(); });
+}
+
+bool TimerWheel::is_armed(TimerId id) {
+    std::scoped_lock lock(mtx);
+    return resolve(id) != nullptr;
+}
+
+void TimerWheel::stop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    wait_idle(lock, 0);
+
+    asio::error_code ignored;
+    driver.cancel(ignored);
+    driving = false;
+
+    for(uint32_t i = 0; i < nodes.size(); ++i){
+        nodes[i].linked = false;
+        if(nodes[i].armed) release(i);
+    }
+    std::fill(std::begin(wheel), std::end(wheel), NIL);
+}
+
+size_t TimerWheel::size() {
+    std::scoped_lock lock(mtx);
+    return armed_count;
+}
+
+TimerId TimerWheel::arm(uint64_t delay_ticks, uint64_t interval, std::function<void()>&& cb) {
+    std::scoped_lock lock(mtx);
+
+    if(armed_count == 0) now_tick = current_tick(); // the wheel was idle - jump straight to the present
+
+    uint32_t index;
+    if(free_nodes.size()){
+        index = free_nodes.back();
+        free_nodes.pop_back();
+    } else {
+        index = uint32_t(nodes.size());
+        nodes.push_back(Node { 0, 0, {}, NIL, NIL, 0, 0, false, false });
+    }
+
+    Node& node = nodes[index];
+    if(++node.generation == 0) node.generation = 1; // generation 0 would allow a zero timer id
+    // now_tick lags behind while callbacks run and the current tick is partly over - count from the present and round up
+    node.expires = std::max(now_tick, current_tick()) + delay_ticks + 1;
+    node.interval = interval;
+    node.cb = std::move(cb);
+    node.armed = true;
+
+    link(index);
+    ++armed_count;
+
+    if(!driving) drive();
+
+    return (TimerId(node.generation) << 32) | index;
+}
+
+TimerWheel::Node* TimerWheel::resolve(TimerId id) {
+    uint32_t index = uint32_t(id);
+    if(index >= nodes.size()) return nullptr;
+
+    Node& node = nodes[index];
+    if(!node.armed || node.generation != uint32_t(id >> 32)) return nullptr; // stale id
+
+    return &node;
+}
+
+void TimerWheel::link(uint32_t index) {
+    Node& node = nodes[index];
+    uint64_t expires = std::max(node.expires, now_tick);
+    uint64_t delta = expires - now_tick;
+
+    size_t level = 0;
+    while(level < LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) ++level;
+
+    if(delta >= (uint64_t(1) << (SLOT_BITS * LEVELS))){ // beyond the wheel range - park in the furthest slot and cascade down later
+        expires = now_tick + (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+    }
+
+    uint32_t slot = uint32_t(level * SLOTS + ((expires >> (SLOT_BITS * level)) & (SLOTS - 1)));
+
+    node.slot = slot;
+    node.linked = true;
+    node.prev = NIL;
+    node.next = wheel[slot];
+    if(node.next != NIL) nodes[node.next].prev = index;
+    wheel[slot] = index;
+}
+
+void TimerWheel::unlink(uint32_t index) {
+    Node& node = nodes[index];
+
+    if(node.prev != NIL) nodes[node.prev].next = node.next;
+    else wheel[node.slot] = node.next;
+
+    if(node.next != NIL) nodes[node.next].prev = node.prev;
+
+    node.prev = node.next = NIL;
+    node.linked = false;
+}
+
+void TimerWheel::release(uint32_t index) {
+    Node& node = nodes[index];
+    node.armed = false;
+    node.cb = nullptr;
+    free_nodes.push_back(index);
+    --armed_count;
+}
+
+void TimerWheel::cascade(size_t level) {
+    uint32_t slot = uint32_t(level * SLOTS + ((now_tick >> (SLOT_BITS * level)) & (SLOTS - 1)));
+
+    uint32_t index = wheel[slot];
+    wheel[slot] = NIL;
+
+    while(index != NIL){ // re-insert every node of this slot into the lower levels
+        uint32_t next = nodes[index].next;
+        link(index);
+        index = next;
+    }
+}
+
+void TimerWheel::drive() {
+    driving = true;
+    driver.expires_at(origin + resolution * (now_tick + 1));
+    driver.async_wait([this](const asio::error_code& error){
+        on_tick(error);
+    });
+}
+
+void TimerWheel::on_tick(const asio::error_code& error) {
+    if(error) return; // cancelled or superseded
+
+    std::vector<TimerId> due;
+    std::unique_lock<std::mutex> lock(mtx);
+    driving = false;
+
+    uint64_t target = current_tick();
+    while(now_tick < target && armed_count){
+        ++now_tick;
+
+        // cascade from the highest level that wrapped down to level 1
+        size_t top = 0;
+        while(top < LEVELS - 1 && (now_tick & ((uint64_t(1) << (SLOT_BITS * (top + 1))) - 1)) == 0) ++top;
+        for(size_t level = top; level > 0; --level){
+            cascade(level);
+        }
+
+        uint32_t slot = uint32_t(now_tick & (SLOTS - 1));
+        uint32_t index = wheel[slot];
+        wheel[slot] = NIL;
+
+        while(index != NIL){
+            Node& node = nodes[index];
+            uint32_t next = node.next;
+
+            if(node.expires > now_tick){ // parked long timer - not due yet
+                link(index);
+            } else {
+                due.push_back((TimerId(node.generation) << 32) | index);
+                if(node.interval){
+                    node.expires = now_tick + node.interval;
+                    link(index);
+                } else {
+                    node.linked = false; // off the wheel but still armed - cancel can stop it until it runs
+                    node.prev = node.next = NIL;
+                }
+            }
+
+            index = next;
+        }
+    }
+
+    if(armed_count) drive();
+
+    for(TimerId id : due){ // callbacks run without the wheel lock so they can arm / cancel timers
+        Node* node = resolve(id);
+        if(!node) continue; // cancelled by an earlier callback or another thread
+
+        std::function<void()> cb = node->interval ? node->cb : std::move(node->cb);
+        if(!node->interval) release(uint32_t(id));
+
+        running = id; // cancel from another thread waits until the callback returned
+        running_thread = std::this_thread::get_id();
+        lock.unlock();
+
+        cb();
+
+        lock.lock();
+        running = 0;
+        idle_signal.notify_all();
+    }
+}
+
+}
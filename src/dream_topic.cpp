@@ -0,0 +1,66 @@
+#include "libdream.h"
+
+#include <algorithm>
+
+namespace dream {
+
+Topic::Topic(Server& server, const std::string& name, bool open): server(server), name(name), open(open), subscribers(std::make_shared<const std::vector<uint64_t>>()) {}
+
+std::shared_ptr<const std::vector<uint64_t>> Topic::snapshot() {
+    std::scoped_lock guard(lock);
+    return subscribers;
+}
+
+bool Topic::update(uint64_t id, bool add) {
+    std::scoped_lock guard(lock);
+
+    auto at = std::lower_bound(subscribers->begin(), subscribers->end(), id);
+    const bool present = at != subscribers->end() && *at == id;
+    if(present == add) return false;
+
+    auto changed = std::make_shared<std::vector<uint64_t>>();
+    changed->reserve(subscribers->size() + add);
+    changed->insert(changed->end(), subscribers->begin(), at);
+    if(add) changed->push_back(id);
+    changed->insert(changed->end(), present ? at + 1 : at, subscribers->end());
+
+    subscribers = std::move(changed); // publishers that took the old snapshot keep it alive
+    return true;
+}
+
+bool Topic::subscribe(const Connection& user) {
+    return update(user.uuid, true);
+}
+
+bool Topic::unsubscribe(const Connection& user) {
+    return update(user.uuid, false);
+}
+
+bool Topic::is_subscribed(const Connection& user) {
+    auto ids = snapshot();
+    return std::binary_search(ids->begin(), ids->end(), user.uuid);
+}
+
+size_t Topic::publish(const Command& cmd) {
+    auto ids = snapshot();
+    auto frame = SharedFrame::make(Command(cmd)); // serialized once - every subscriber queues the same bytes
+
+    size_t sent = 0;
+    std::vector<uint64_t> gone;
+    {
+        SlotMap<Socket>::ReadGuard guard(server.socket_list); // lock-free - the guard keeps the gc away while we send
+        for(uint64_t id : *ids){
+            Socket* client = server.socket_list.find(id);
+            if(!client){
+                gone.push_back(id); // released - the id never comes back
+                continue;
+            }
+            if(client->send_shared(frame) != SEND_REJECTED) ++sent; // a detached session queues it for the resume
+        }
+    }
+
+    for(uint64_t id : gone) update(id, false);
+    return sent;
+}
+
+}
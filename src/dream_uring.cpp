@@ -0,0 +1,566 @@
+#include "dream_uring.h"
+#include "dream_externs.h"
+
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__linux__) && !defined(DREAM_NO_URING) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT) // headers of Linux 6.0 or later - older kernels are detected at runtime
+#define DREAM_URING
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#endif
+#endif
+
+namespace dream {
+
+#ifdef DREAM_URING
+
+static constexpr uint16_t POOL_GROUP = 0; // buffer group of the receive pool
+
+static int uring_setup(uint32_t entries, io_uring_params* params) {
+    return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int uring_enter(int fd, uint32_t submit) {
+    return int(syscall(__NR_io_uring_enter, fd, submit, 0, 0, nullptr, 0));
+}
+
+static int uring_register(int fd, uint32_t opcode, const void* arg, uint32_t count) {
+    return int(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+template<typename T>
+static T* at(void* base, uint32_t offset) { return reinterpret_cast<T*>(static_cast<char*>(base) + offset); }
+
+struct UringDriver::Rings {
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    uint32_t *sq_head, *sq_tail, *sq_array;
+    uint32_t sq_mask, sq_entries, sq_local_tail; // entries are published to the kernel on submit
+    uint32_t *cq_head, *cq_tail;
+    uint32_t cq_mask;
+    io_uring_cqe* cqes;
+
+    asio::posix::stream_descriptor events; // the eventfd - readable once the kernel posted completions
+    uint64_t event_count;
+    std::vector<io_uring_cqe> batch; // completions of one reap
+    bool reaping;
+
+    Rings(asio::io_context& ctx): sq_ring(MAP_FAILED), sq_ring_size(0), cq_ring(MAP_FAILED), cq_ring_size(0), sqes(nullptr), sqes_size(0),
+        sq_head(nullptr), sq_tail(nullptr), sq_array(nullptr), sq_mask(0), sq_entries(0), sq_local_tail(0),
+        cq_head(nullptr), cq_tail(nullptr), cq_mask(0), cqes(nullptr), events(ctx), event_count(0), reaping(false) {}
+
+    ~Rings() {
+        if(sqes) munmap(sqes, sqes_size);
+        if(cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        if(sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+    }
+};
+
+// Uring Driver
+
+UringDriver::UringDriver(asio::io_context& ctx, const UringConfig& config):
+    ctx(ctx), config(config), ring_fd(-1), event_fd(-1), rings(std::make_unique<Rings>(ctx)), next_op(1), queued(0), flush_posted(false),
+    buffer_ring(nullptr), buffer_ring_size(0), buffer_tail(0), pool_ready(false), multishot_accept(true), starved_posted(false) {}
+
+std::unique_ptr<UringDriver> UringDriver::create(asio::io_context& ctx, const UringConfig& config) {
+    std::unique_ptr<UringDriver> driver(new UringDriver(ctx, config));
+    if(!driver->setup()) return nullptr;
+    if(!driver->setup_pool()){
+        DLOG_INFO << "io_uring provided buffers are not available - sockets receive one operation at a time\n";
+    }
+    driver->wait_events();
+    return driver;
+}
+
+UringDriver::~UringDriver() {
+    asio::error_code ignored;
+    rings->events.close(ignored);
+    if(ring_fd >= 0) ::close(ring_fd); // the kernel cancels whatever is still in flight
+    ops.clear();
+    starved.clear();
+    rings.reset();
+    if(buffer_ring) munmap(buffer_ring, buffer_ring_size);
+}
+
+bool UringDriver::setup() {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+    params.cq_entries = config.entries * 2;
+
+    ring_fd = uring_setup(config.entries, &params);
+    if(ring_fd < 0) return false;
+
+    Rings& r = *rings;
+    r.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    r.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap) r.sq_ring_size = r.cq_ring_size = std::max(r.sq_ring_size, r.cq_ring_size);
+
+    r.sq_ring = mmap(nullptr, r.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if(r.sq_ring == MAP_FAILED) return false;
+    r.cq_ring = single_mmap ? r.sq_ring : mmap(nullptr, r.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if(r.cq_ring == MAP_FAILED) return false;
+
+    r.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, r.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) return false;
+    r.sqes = static_cast<io_uring_sqe*>(sqes);
+
+    r.sq_head = at<uint32_t>(r.sq_ring, params.sq_off.head);
+    r.sq_tail = at<uint32_t>(r.sq_ring, params.sq_off.tail);
+    r.sq_array = at<uint32_t>(r.sq_ring, params.sq_off.array);
+    r.sq_mask = *at<uint32_t>(r.sq_ring, params.sq_off.ring_mask);
+    r.sq_entries = params.sq_entries;
+    r.sq_local_tail = *r.sq_tail;
+    r.cq_head = at<uint32_t>(r.cq_ring, params.cq_off.head);
+    r.cq_tail = at<uint32_t>(r.cq_ring, params.cq_off.tail);
+    r.cq_mask = *at<uint32_t>(r.cq_ring, params.cq_off.ring_mask);
+    r.cqes = at<io_uring_cqe>(r.cq_ring, params.cq_off.cqes);
+    r.batch.reserve(params.cq_entries);
+
+    // every operation the sockets need must be there - anything newer is optional
+    std::vector<char> probe_data(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(probe_data.data());
+    if(uring_register(ring_fd, IORING_REGISTER_PROBE, probe, 256) < 0) return false;
+    for(int op : { IORING_OP_RECV, IORING_OP_SEND, IORING_OP_ACCEPT, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL }){
+        if(op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+    }
+
+    event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(event_fd < 0) return false;
+    asio::error_code error;
+    r.events.assign(event_fd, error); // owns the descriptor from here on
+    if(error){
+        ::close(event_fd);
+        return false;
+    }
+    return uring_register(ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) == 0;
+}
+
+bool UringDriver::setup_pool() {
+    const uint32_t count = std::bit_ceil(std::clamp<uint32_t>(config.buffers, 1, 32768));
+    buffer_ring_size = count * sizeof(io_uring_buf);
+    buffer_ring = mmap(nullptr, buffer_ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if(buffer_ring == MAP_FAILED){
+        buffer_ring = nullptr;
+        return false;
+    }
+
+    io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = uint64_t(buffer_ring);
+    reg.ring_entries = count;
+    reg.bgid = POOL_GROUP;
+    if(uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0){
+        munmap(buffer_ring, buffer_ring_size);
+        buffer_ring = nullptr;
+        return false;
+    }
+
+    pool.resize(size_t(count) * config.buffer_size);
+    for(uint32_t id = 0; id < count; ++id){
+        release_buffer(uint16_t(id));
+    }
+    pool_ready = true;
+    return true;
+}
+
+void* UringDriver::prepare(uint8_t opcode, int fd, uint64_t user_data) {
+    Rings& r = *rings;
+    while(r.sq_local_tail - std::atomic_ref<uint32_t>(*r.sq_head).load(std::memory_order_acquire) >= r.sq_entries){
+        submit(); // the kernel consumes the entries while it is entered
+        if(!r.reaping) reap(); // completions it could not post hold entries back
+    }
+
+    const uint32_t index = r.sq_local_tail++ & r.sq_mask;
+    io_uring_sqe* sqe = &r.sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    r.sq_array[index] = index;
+    ++queued;
+
+    if(!flush_posted){ // every operation queued during this pass goes out with one io_uring_enter
+        flush_posted = true;
+        asio::post(ctx, [this](){
+            flush_posted = false;
+            submit();
+        });
+    }
+    return sqe;
+}
+
+uint64_t UringDriver::track(Completion&& done) {
+    const uint64_t op = next_op++;
+    ops.emplace(op, std::move(done));
+    return op;
+}
+
+void UringDriver::submit() {
+    if(!queued) return;
+
+    Rings& r = *rings;
+    std::atomic_ref<uint32_t>(*r.sq_tail).store(r.sq_local_tail, std::memory_order_release);
+    const int submitted = uring_enter(ring_fd, queued);
+    if(submitted < 0){
+        if(errno != EINTR && errno != EAGAIN && errno != EBUSY){
+            DLOG_ERROR << "io_uring submit failed: " << std::strerror(errno) << "\n";
+        }
+        return; // retried by the next pass that queues or reaps
+    }
+    queued -= std::min<uint32_t>(queued, uint32_t(submitted));
+}
+
+void UringDriver::wait_events() {
+    rings->events.async_read_some(asio::buffer(&rings->event_count, sizeof(rings->event_count)), [this](const asio::error_code& error, size_t){
+        if(error == asio::error::operation_aborted) return; // the driver is going away
+        if(error && error != asio::error::would_block && error != asio::error::try_again){
+            DLOG_ERROR << "io_uring event wait failed: " << error.message() << "\n";
+            return;
+        }
+        reap();
+        submit(); // operations the handlers queued go out in the same pass
+        wait_events();
+    });
+}
+
+void UringDriver::reap() {
+    Rings& r = *rings;
+    r.reaping = true;
+
+    uint32_t head = *r.cq_head;
+    const uint32_t tail = std::atomic_ref<uint32_t>(*r.cq_tail).load(std::memory_order_acquire);
+    r.batch.clear();
+    for(; head != tail; ++head){
+        r.batch.push_back(r.cqes[head & r.cq_mask]);
+    }
+    std::atomic_ref<uint32_t>(*r.cq_head).store(head, std::memory_order_release);
+
+    for(const io_uring_cqe& cqe : r.batch){
+        auto it = ops.find(cqe.user_data);
+        if(it == ops.end()) continue; // cancellations and operations of closed streams
+
+        if(cqe.flags & IORING_CQE_F_MORE){
+            it->second(cqe.res, cqe.flags); // stays armed - only reap erases operations so the element outlives the call
+        } else {
+            Completion done = std::move(it->second);
+            ops.erase(it);
+            done(cqe.res, cqe.flags);
+        }
+    }
+
+    r.reaping = false;
+}
+
+uint64_t UringDriver::recv(int fd, void* data, size_t size, Completion done) {
+    const uint64_t op = track(std::move(done));
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(prepare(IORING_OP_RECV, fd, op));
+    sqe->addr = uint64_t(data);
+    sqe->len = uint32_t(std::min<size_t>(size, UINT32_MAX));
+    return op;
+}
+
+uint64_t UringDriver::recv_multishot(int fd, Completion done) {
+    const uint64_t op = track(std::move(done));
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(prepare(IORING_OP_RECV, fd, op));
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = POOL_GROUP;
+    return op;
+}
+
+uint64_t UringDriver::send(int fd, const void* data, size_t size, Completion done) {
+    const uint64_t op = track(std::move(done));
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(prepare(IORING_OP_SEND, fd, op));
+    sqe->addr = uint64_t(data);
+    sqe->len = uint32_t(std::min<size_t>(size, UINT32_MAX));
+    sqe->msg_flags = MSG_NOSIGNAL;
+    return op;
+}
+
+uint64_t UringDriver::accept(int fd, bool multishot, Completion done) {
+    const uint64_t op = track(std::move(done));
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(prepare(IORING_OP_ACCEPT, fd, op));
+    sqe->ioprio = multishot ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    return op;
+}
+
+uint64_t UringDriver::poll(int fd, uint32_t events, Completion done) {
+    const uint64_t op = track(std::move(done));
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(prepare(IORING_OP_POLL_ADD, fd, op));
+    sqe->poll32_events = events;
+    return op;
+}
+
+void UringDriver::cancel(uint64_t op) {
+    if(!ops.count(op)) return;
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(prepare(IORING_OP_ASYNC_CANCEL, -1, 0)); // its own completion is ignored
+    sqe->addr = op;
+}
+
+bool UringDriver::has_more(uint32_t flags) { return flags & IORING_CQE_F_MORE; }
+bool UringDriver::has_buffer(uint32_t flags) { return flags & IORING_CQE_F_BUFFER; }
+uint16_t UringDriver::buffer_id(uint32_t flags) { return uint16_t(flags >> IORING_CQE_BUFFER_SHIFT); }
+
+void UringDriver::release_buffer(uint16_t id) {
+    io_uring_buf* bufs = static_cast<io_uring_buf*>(buffer_ring);
+    const uint32_t mask = uint32_t(buffer_ring_size / sizeof(io_uring_buf)) - 1;
+
+    io_uring_buf& buf = bufs[buffer_tail & mask]; // field by field - the resv field of the first entry is the ring tail
+    buf.addr = uint64_t(pool.data() + size_t(id) * config.buffer_size);
+    buf.len = config.buffer_size;
+    buf.bid = id;
+    std::atomic_ref<uint16_t>(bufs[0].resv).store(++buffer_tail, std::memory_order_release);
+
+    if(starved.empty() || starved_posted) return;
+    starved_posted = true; // served after the current handler - the receives it wakes may hand buffers back themselves
+    asio::post(ctx, [this](){
+        starved_posted = false;
+        std::vector<std::function<void()>> waiting;
+        waiting.swap(starved);
+        for(auto& retry : waiting) retry();
+    });
+}
+
+void UringDriver::wait_for_buffers(std::function<void()> retry) {
+    starved.push_back(std::move(retry));
+}
+
+void UringDriver::shutdown_listener(int fd) {
+    ::shutdown(fd, SHUT_RDWR); // a pending accept completes with EINVAL - closing the descriptor alone would leave it armed
+}
+
+// Uring Stream
+
+static asio::error_code errno_code(int result) {
+    return asio::error_code(-result, asio::system_category());
+}
+
+// queued entries name the descriptor by number - a copy of it stays open until every operation released the stream,
+// so a descriptor closed by the SocketStream is never reused under an entry that was not submitted yet
+UringStream::UringStream(UringDriver& driver, int descriptor): driver(driver), fd(::dup(descriptor)), open(fd >= 0), recv_op(0), send_op(0),
+    multishot(driver.has_buffer_pool()), armed(false), starved(false) {}
+
+UringStream::~UringStream() { // every completion holds the stream - nothing in flight uses fd anymore
+    if(fd >= 0) ::close(fd);
+}
+
+void UringStream::post(RingCompletion&& handler, const asio::error_code& error, size_t bytes) {
+    asio::post(driver.get_context(), [handler = std::move(handler), error, bytes]() mutable { handler(error, bytes); });
+}
+
+void UringStream::read_some(asio::mutable_buffer buffer, RingCompletion&& handler) {
+    if(!open) return post(std::move(handler), asio::error::bad_descriptor, 0);
+    if(!buffer.size()) return post(std::move(handler), {}, 0);
+
+    asio::dispatch(driver.get_context(), [self = shared_from_this(), buffer, handler = std::move(handler)]() mutable {
+        if(!self->open) return self->post(std::move(handler), asio::error::operation_aborted, 0);
+        self->read_buffer = buffer;
+        self->pending_read = std::move(handler);
+        self->start_read();
+    });
+}
+
+void UringStream::write_some(asio::const_buffer buffer, RingCompletion&& handler) {
+    if(!open) return post(std::move(handler), asio::error::bad_descriptor, 0);
+    if(!buffer.size()) return post(std::move(handler), {}, 0);
+
+    asio::dispatch(driver.get_context(), [self = shared_from_this(), buffer, handler = std::move(handler)]() mutable {
+        if(!self->open) return self->post(std::move(handler), asio::error::operation_aborted, 0);
+        self->write_buffer = buffer;
+        self->pending_write = std::move(handler);
+        self->start_write();
+    });
+}
+
+void UringStream::close() {
+    if(!open.exchange(false)) return;
+    ::shutdown(fd, SHUT_RDWR); // operations in flight complete - the copy of the descriptor goes with the last of them
+
+    asio::dispatch(driver.get_context(), [self = shared_from_this()](){
+        if(self->pending_read) self->post(std::move(self->pending_read), asio::error::operation_aborted, 0);
+        if(self->pending_write) self->post(std::move(self->pending_write), asio::error::operation_aborted, 0);
+        if(self->armed) self->driver.cancel(self->recv_op);
+        for(const Held& h : self->held){
+            self->driver.release_buffer(h.id);
+        }
+        self->held.clear();
+    });
+}
+
+void UringStream::start_read() {
+    if(!multishot){
+        recv_op = driver.recv(fd, read_buffer.data(), read_buffer.size(), [self = shared_from_this()](int result, uint32_t){ self->on_read(result); });
+        return;
+    }
+
+    if(drain_held()) return;
+    if(read_error) return post(std::move(pending_read), read_error, 0);
+    if(!armed && !starved) arm();
+}
+
+void UringStream::start_write() {
+    send_op = driver.send(fd, write_buffer.data(), write_buffer.size(), [self = shared_from_this()](int result, uint32_t){
+        self->send_op = 0;
+        if(!self->pending_write || !self->open) return; // closed
+        if(result == -EINTR) return self->start_write();
+        if(result == -EAGAIN){ // the socket is non-blocking and its buffer is full - wait until it drains
+            self->send_op = self->driver.poll(self->fd, POLLOUT, [self](int, uint32_t){
+                self->send_op = 0;
+                if(self->pending_write && self->open) self->start_write();
+            });
+            return;
+        }
+
+        if(result >= 0) self->post(std::move(self->pending_write), {}, size_t(result));
+        else self->post(std::move(self->pending_write), errno_code(result), 0);
+    });
+}
+
+void UringStream::arm() {
+    armed = true;
+    recv_op = driver.recv_multishot(fd, [self = shared_from_this()](int result, uint32_t flags){ self->on_recv(result, flags); });
+}
+
+void UringStream::on_starved() {
+    if(starved) return;
+    starved = true;
+    driver.wait_for_buffers([weak = weak_from_this()](){
+        auto self = weak.lock();
+        if(!self) return;
+        self->starved = false;
+        if(self->open && self->pending_read && !self->armed && self->held.empty() && !self->read_error) self->arm();
+    });
+}
+
+void UringStream::on_read(int result) {
+    recv_op = 0;
+    if(!pending_read || !open) return; // closed
+    if(result == -EINTR) return start_read();
+    if(result == -EAGAIN){ // nothing to read on a non-blocking socket
+        recv_op = driver.poll(fd, POLLIN, [self = shared_from_this()](int, uint32_t){
+            self->recv_op = 0;
+            if(self->pending_read && self->open) self->start_read();
+        });
+        return;
+    }
+
+    if(result > 0) post(std::move(pending_read), {}, size_t(result));
+    else post(std::move(pending_read), result ? errno_code(result) : asio::error::eof, 0);
+}
+
+void UringStream::on_recv(int result, uint32_t flags) {
+    if(!UringDriver::has_more(flags)) armed = false;
+
+    if(result > 0 && UringDriver::has_buffer(flags)){
+        const uint16_t id = UringDriver::buffer_id(flags);
+        if(!open) return driver.release_buffer(id);
+
+        held.push_back({ id, 0, uint32_t(result) });
+        if(armed && held.size() >= driver.get_config().max_held) driver.cancel(recv_op); // pause a socket that does not read - it resumes in drain_held
+        drain_held();
+        return;
+    }
+    if(!open) return;
+
+    if(result == -EINVAL && held.empty() && !read_error){ // the kernel has no multishot receive
+        multishot = false;
+        if(pending_read && open) start_read();
+        return;
+    }
+    if(armed) return; // still receiving - nothing to do until the next result
+    if(result == -ENOBUFS){ // the pool ran dry - arming again right away would only fail again
+        if(held.empty()) on_starved(); // otherwise drain_held arms once the held data is read
+        return;
+    }
+    if(result == -EAGAIN){ // a non-blocking socket had nothing - wait for data before arming again
+        armed = true; // no second receive while the poll is out
+        recv_op = driver.poll(fd, POLLIN, [self = shared_from_this()](int, uint32_t){
+            self->armed = false;
+            if(self->open && self->pending_read && self->held.empty() && !self->read_error) self->arm();
+        });
+        return;
+    }
+    if(result == -ECANCELED || result == -EINTR){ // paused - see max_held
+        if(pending_read && held.empty() && open) arm();
+        return;
+    }
+
+    read_error = result ? errno_code(result) : asio::error::eof; // held data is read before the error
+    if(pending_read && held.empty()) post(std::move(pending_read), read_error, 0);
+}
+
+bool UringStream::drain_held() {
+    if(!pending_read || held.empty()) return false;
+
+    char* out = static_cast<char*>(read_buffer.data());
+    size_t copied = 0;
+    while(copied < read_buffer.size() && held.size()){
+        Held& h = held.front();
+        const size_t count = std::min<size_t>(read_buffer.size() - copied, h.size);
+        std::memcpy(out + copied, driver.buffer(h.id) + h.offset, count);
+        copied += count;
+        h.offset += uint32_t(count);
+        h.size -= uint32_t(count);
+        if(!h.size){
+            driver.release_buffer(h.id);
+            held.pop_front();
+        }
+    }
+
+    if(open && !armed && !starved && !read_error && held.size() < driver.get_config().max_held) arm();
+    post(std::move(pending_read), {}, copied);
+    return true;
+}
+
+#else // no io_uring - every socket stays on the reactor
+
+struct UringDriver::Rings {};
+
+UringDriver::UringDriver(asio::io_context& ctx, const UringConfig& config):
+    ctx(ctx), config(config), ring_fd(-1), event_fd(-1), next_op(1), queued(0), flush_posted(false),
+    buffer_ring(nullptr), buffer_ring_size(0), buffer_tail(0), pool_ready(false), multishot_accept(false), starved_posted(false) {}
+std::unique_ptr<UringDriver> UringDriver::create(asio::io_context&, const UringConfig&) { return nullptr; }
+UringDriver::~UringDriver() {}
+uint64_t UringDriver::recv(int, void*, size_t, Completion) { return 0; }
+uint64_t UringDriver::recv_multishot(int, Completion) { return 0; }
+uint64_t UringDriver::send(int, const void*, size_t, Completion) { return 0; }
+uint64_t UringDriver::accept(int, bool, Completion) { return 0; }
+uint64_t UringDriver::poll(int, uint32_t, Completion) { return 0; }
+void UringDriver::cancel(uint64_t) {}
+bool UringDriver::has_more(uint32_t) { return false; }
+bool UringDriver::has_buffer(uint32_t) { return false; }
+uint16_t UringDriver::buffer_id(uint32_t) { return 0; }
+void UringDriver::release_buffer(uint16_t) {}
+void UringDriver::wait_for_buffers(std::function<void()>) {}
+void UringDriver::shutdown_listener(int) {}
+
+UringStream::UringStream(UringDriver& driver, int): driver(driver), fd(-1), open(false), recv_op(0), send_op(0), multishot(false), armed(false), starved(false) {}
+UringStream::~UringStream() {}
+void UringStream::post(RingCompletion&& handler, const asio::error_code& error, size_t bytes) {
+    asio::post(driver.get_context(), [handler = std::move(handler), error, bytes]() mutable { handler(error, bytes); });
+}
+void UringStream::read_some(asio::mutable_buffer, RingCompletion&& handler) { post(std::move(handler), asio::error::operation_not_supported, 0); }
+void UringStream::write_some(asio::const_buffer, RingCompletion&& handler) { post(std::move(handler), asio::error::operation_not_supported, 0); }
+void UringStream::close() {}
+
+#endif
+
+}
@@ -1,5 +1,7 @@
 #include "ip_tools.h"
 
+#include <cstdio>
+
 using asio::ip::tcp;
 
 bool stoip(const std::string& str, asio::ip::address& ipaddr) {
@@ -44,4 +46,21 @@ bool getIpv4Address(std::vector<asio::ip::address>& addrList) {
     } catch(...) {}
 
     return false;
-}
\ No newline at end of file
+}
+
+bool removeStaleSocket(const std::string& path) {
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+    asio::io_context context; // temporary context
+    asio::local::stream_protocol::socket probe(context);
+    asio::error_code error;
+
+    probe.open(asio::local::stream_protocol(), error);
+    if(error) return true; // bind reports whatever is wrong
+    probe.non_blocking(true, error); // a listener with a full backlog must not hold up the probe
+    probe.connect(asio::local::stream_protocol::endpoint(path), error);
+
+    if(!error || error == asio::error::would_block || error == asio::error::try_again) return false; // somebody is listening there
+    if(error == asio::error::connection_refused) std::remove(path.c_str()); // left behind by a listener that did not stop cleanly
+#endif
+    return true;
+}
@@ -1,4 +1,5 @@
 #include "libdream.h"
+#include "test-units.h"
 
 #include <iostream>
 #include <algorithm>
@@ -44,12 +45,15 @@ public:
     int RunServer() {
         server.on_client_join = std::bind(&TestServer::OnClientConnect, this, std::placeholders::_1);
 
+        server.set_tick_config({ 100, true, std::chrono::microseconds(500) }); // updates go out at the tick boundary
+        server.add_tick_callback(dream::TickScheduler::SIMULATE, [this](const dream::TickInfo&){ OnUpdate(); });
+
         if(!server.start_server(5050)){
             dream::dlog << "error starting server\n";
             return 1;
         }
 
-        while(OnUpdate());
+        while(server.is_running()) dream::Clock::sleepMilliseconds(100);
 
         server.stop_server();
 
@@ -58,10 +62,7 @@ public:
 
 private:
 
-    bool OnUpdate() {
-        dream::Clock::sleepMilliseconds(10);
-
-        if(!server.is_running()) return false;
+    void OnUpdate() {
 
         static std::vector<std::string> list = {
             "this is test data", "chunk of data", "something", "more data as a string placed here",
@@ -80,8 +81,6 @@ private:
 
         //user.send_string(list.at(rand() % list.size()));
         server.broadcast_string(list.at(rand() % list.size()));
-
-        return true;
     }
 
     void OnClientConnect(dream::Connection& user) {
@@ -315,6 +314,14 @@ std::map<std::string, Command> commands {
                 if(client->Terminated()) break;
             }
 
+            return true;
+        }
+    }},
+    {"units", {
+        "Run the unit checks of the delta codec, bit packing, slot map and timer wheel",
+        "== no arguments ==",
+        [](ArgumentList args, const Command& t) -> bool {
+            unit::run_all(); // failures are reported per check
             return true;
         }
     }}
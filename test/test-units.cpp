@@ -0,0 +1,314 @@
+#include "test-units.h"
+#include "libdream.h"
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+namespace unit {
+
+static int failures = 0;
+
+#define UNIT_CHECK(cond) \
+    do { if(!(cond)){ ++failures; dream::dlog << "  failed: " << #cond << " (" << __FILE__ << ":" << __LINE__ << ")\n"; } } while(0)
+
+static std::mt19937 rng(1234);
+
+// bytes with zero runs of every length - exercises both branches of the run encoder
+static std::string sample(size_t length, int zero_chance) {
+    std::string out(length, '\0');
+    for(char& c : out){
+        if(int(rng() % 100) >= zero_chance) c = char(1 + rng() % 255);
+    }
+    return out;
+}
+
+// Delta
+
+static void test_delta_kernels() {
+    for(size_t length = 0; length <= 80; ++length){ // crosses the 16 and 32 byte lanes
+        for(size_t offset = 0; offset < 4; ++offset){ // unaligned starts
+            std::string a = sample(length + offset, 30), b = sample(length + offset, 30);
+            std::string out(length + offset, '\0');
+
+            dream::delta::xor_bytes(out.data() + offset, a.data() + offset, b.data() + offset, length);
+            bool same = true;
+            for(size_t i = 0; i < length; ++i) same &= out[offset + i] == char(a[offset + i] ^ b[offset + i]);
+            UNIT_CHECK(same);
+
+            for(size_t mark = 0; mark <= length; ++mark){ // first non-zero / first zero at every position
+                std::string zeros(length + offset, '\0');
+                if(mark < length) zeros[offset + mark] = 1;
+                UNIT_CHECK(dream::delta::count_zero(zeros.data() + offset, length) == mark);
+
+                std::string ones(length + offset, '\1');
+                if(mark < length) ones[offset + mark] = 0;
+                UNIT_CHECK(dream::delta::find_zero(ones.data() + offset, length) == mark);
+            }
+        }
+    }
+}
+
+static void test_delta_roundtrip() {
+    const size_t sizes[] = { 0, 1, 3, 4, 5, 15, 16, 17, 31, 32, 33, 63, 64, 65, 1000 };
+    for(size_t base_size : sizes){
+        for(size_t size : sizes){
+            for(int zeros : { 0, 50, 95, 100 }){
+                std::string base = sample(base_size, 40);
+                std::string current = base.substr(0, std::min(base_size, size));
+                current.resize(size, '\0');
+
+                std::string change = sample(size, zeros); // xor'd in - a zero byte keeps the baseline byte
+                for(size_t i = 0; i < size; ++i) current[i] ^= change[i];
+
+                std::string delta = dream::delta::encode(base, current);
+                std::string rebuilt;
+                UNIT_CHECK(dream::delta::decode(base, delta, rebuilt));
+                UNIT_CHECK(rebuilt == current);
+
+                for(size_t cut = 0; cut < delta.size(); ++cut){ // a truncated delta never reads past its end
+                    std::string partial;
+                    if(dream::delta::decode(base, delta.substr(0, cut), partial)) UNIT_CHECK(partial.size() == size);
+                }
+            }
+        }
+    }
+}
+
+static void test_delta_corrupt() {
+    std::string out;
+
+    std::string huge; // length above MAX_LENGTH
+    dream::delta::write_varint(huge, dream::delta::MAX_LENGTH + 1);
+    UNIT_CHECK(!dream::delta::decode({}, huge, out));
+
+    std::string skip; // zero skip past the length
+    dream::delta::write_varint(skip, 8);
+    dream::delta::write_varint(skip, 9);
+    dream::delta::write_varint(skip, 0);
+    UNIT_CHECK(!dream::delta::decode({}, skip, out));
+
+    std::string literal; // literal longer than the remaining data
+    dream::delta::write_varint(literal, 8);
+    dream::delta::write_varint(literal, 0);
+    dream::delta::write_varint(literal, 4);
+    literal += "ab";
+    UNIT_CHECK(!dream::delta::decode({}, literal, out));
+
+    std::string endless(11, char(0x80)); // varint that never ends
+    UNIT_CHECK(!dream::delta::decode({}, endless, out));
+    UNIT_CHECK(!dream::delta::decode({}, {}, out));
+}
+
+static void test_delta_baseline() {
+    using dream::delta::Baseline;
+    Baseline sender, receiver;
+    std::string state;
+    uint32_t seq = 0;
+
+    UNIT_CHECK(receiver.decode(sender.encode("first"), state, seq) && state == "first");
+    sender.acknowledge(seq);
+
+    uint32_t oldest = 0; // the oldest state the sender still keeps once the window is full
+    for(size_t i = 0; i < Baseline::MAX_HISTORY * 2; ++i){
+        UNIT_CHECK(receiver.decode(sender.encode("state " + std::to_string(i)), state, seq));
+        if(i == Baseline::MAX_HISTORY) oldest = seq;
+    }
+    sender.acknowledge(oldest); // still in both windows
+    UNIT_CHECK(sender.get_base_sequence() == oldest);
+    UNIT_CHECK(receiver.decode(sender.encode("after"), state, seq) && state == "after");
+
+    Baseline late; // never saw the base - asks for a full state
+    UNIT_CHECK(!late.decode(sender.encode("lost"), state, seq) && seq == 0);
+    sender.acknowledge(0);
+    UNIT_CHECK(late.decode(sender.encode("full"), state, seq) && state == "full");
+
+    UNIT_CHECK(Baseline::is_newer(1, UINT32_MAX)); // sequences wrap to 1
+    UNIT_CHECK(!Baseline::is_newer(UINT32_MAX, 1));
+}
+
+// Bitpack
+
+template<typename T>
+static void check_range(T min, T max, unsigned width) {
+    T value = min;
+    UNIT_CHECK(dream::bits::range(value, min, max).width() == width);
+
+    for(T probe : { min, max, T(min + (max - min) / 2) }){
+        T in = probe, out = T(0);
+        dream::BitOutputArchive writer;
+        writer(dream::bits::range(in, min, max));
+        UNIT_CHECK(writer.bit_size() == width);
+
+        const std::string packed = writer.finish(); // the reader points into it
+        dream::BitInputArchive reader(packed);
+        reader(dream::bits::range(out, min, max));
+        UNIT_CHECK(out == probe);
+    }
+}
+
+static void test_bitpack_ranged() {
+    check_range<int>(0, 0, 0);
+    check_range<int>(0, 1, 1);
+    check_range<int>(0, 255, 8);
+    check_range<int>(0, 256, 9);
+    check_range<int8_t>(-128, 127, 8);
+    check_range<int32_t>(std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max(), 32);
+    check_range<uint32_t>(0, std::numeric_limits<uint32_t>::max(), 32);
+
+    int high = 500, clamped = 0; // out of range values are clamped on save
+    dream::BitOutputArchive writer;
+    writer(dream::bits::range(high, 0, 100));
+    const std::string packed = writer.finish();
+    dream::BitInputArchive reader(packed);
+    reader(dream::bits::range(clamped, 0, 100));
+    UNIT_CHECK(clamped == 100);
+}
+
+static void test_bitpack_quantized_array() {
+    std::vector<float> probe;
+    UNIT_CHECK(dream::bits::quantize_array(probe, 0.0f, 1.0f, 1.0f / 1073741824.0f).width() == 31);
+
+    bool thrown = false;
+    try {
+        dream::bits::quantize_array(probe, 0.0f, 1.0f, 1.0f / 2147483648.0f).width(); // 2^31 steps take 32 bits
+    } catch(const dream::bits::Exception&) {
+        thrown = true;
+    }
+    UNIT_CHECK(thrown);
+
+    const float min = -100.0f, max = 100.0f, precision = 0.01f;
+    for(size_t count : { 0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 33 }){ // around the sse2 and avx2 lanes
+        std::vector<float> in(count), out;
+        for(size_t i = 0; i < count; ++i) in[i] = min + float(rng() % 20001) * precision;
+        if(count > 2){
+            in[0] = std::numeric_limits<float>::quiet_NaN(); // maps to min
+            in[1] = max * 2; // clamped
+            in[2] = min * 2;
+        }
+
+        dream::BitOutputArchive writer;
+        writer(dream::bits::quantize_array(in, min, max, precision));
+        const std::string packed = writer.finish();
+        dream::BitInputArchive reader(packed);
+        reader(dream::bits::quantize_array(out, min, max, precision));
+
+        UNIT_CHECK(out.size() == count);
+        for(size_t i = 0; i < std::min(count, out.size()); ++i){
+            float expect = std::isnan(in[i]) ? min : std::clamp(in[i], min, max);
+            UNIT_CHECK(std::fabs(out[i] - expect) <= precision * 0.5f + 1e-4f);
+        }
+    }
+}
+
+// SlotMap
+
+static void test_slotmap_generations() {
+    dream::SlotMap<int> map;
+
+    auto first = map.emplace([](uint64_t){ return std::make_unique<int>(1); });
+    UNIT_CHECK(first != 0 && map.find(first) && *map.find(first) == 1);
+
+    UNIT_CHECK(map.erase(first) != nullptr);
+    UNIT_CHECK(map.find(first) == nullptr);
+    UNIT_CHECK(map.erase(first) == nullptr); // stale handles do not resolve twice
+
+    auto second = map.emplace([](uint64_t){ return std::make_unique<int>(2); });
+    UNIT_CHECK(uint32_t(second) == uint32_t(first)); // the slot is recycled
+    UNIT_CHECK(second != first); // under a new generation
+    UNIT_CHECK(map.find(first) == nullptr);
+    UNIT_CHECK(map.find(second) && *map.find(second) == 2);
+
+    auto stale = map.replace(first, std::make_unique<int>(3)); // handed back - the live object stays
+    UNIT_CHECK(stale && *stale == 3 && *map.find(second) == 2);
+
+    bool thrown = false;
+    try {
+        map.emplace([](uint64_t) -> std::unique_ptr<int> { throw std::runtime_error("factory"); });
+    } catch(const std::runtime_error&) {
+        thrown = true;
+    }
+    UNIT_CHECK(thrown && map.size() == 1); // a failed factory leaves no slot behind
+
+    size_t visited = 0;
+    map.for_each([&](uint64_t handle, int& value){ ++visited; UNIT_CHECK(handle == second && value == 2); });
+    UNIT_CHECK(visited == 1);
+}
+
+// TimerWheel
+
+static void test_timer_cascade() {
+    using namespace std::chrono;
+    asio::io_context ctx;
+    auto idle = asio::make_work_guard(ctx);
+    std::thread runner([&](){ ctx.run(); });
+
+    {
+        dream::TimerWheel timers(ctx, milliseconds(1));
+        const auto start = steady_clock::now();
+
+        // every level boundary - level 0 holds 64 ticks and level 1 holds 64 * 64
+        const int delays[] = { 1, 2, 63, 64, 65, 127, 128, 129, 4095, 4096, 4097 };
+        std::atomic<int> early = 0, fired = 0;
+        for(int delay : delays){
+            timers.schedule(milliseconds(delay), [&, delay](){
+                if(steady_clock::now() - start < milliseconds(delay)) ++early;
+                ++fired;
+            });
+        }
+
+        std::atomic<int> cancelled_ran = 0;
+        dream::TimerId cancelled = timers.schedule(milliseconds(100), [&](){ ++cancelled_ran; });
+        UNIT_CHECK(timers.cancel(cancelled));
+        UNIT_CHECK(!timers.is_armed(cancelled));
+
+        for(int i = 0; i < 600 && fired < int(std::size(delays)); ++i) std::this_thread::sleep_for(milliseconds(10));
+
+        UNIT_CHECK(fired == int(std::size(delays)));
+        UNIT_CHECK(early == 0); // timers never fire early
+        UNIT_CHECK(cancelled_ran == 0);
+        UNIT_CHECK(timers.size() == 0);
+    }
+
+    idle.reset();
+    ctx.stop();
+    runner.join();
+}
+
+int run_all() {
+    struct Case { const char* name; void (*run)(); };
+    const Case cases[] = {
+        { "delta kernels", test_delta_kernels },
+        { "delta round trip", test_delta_roundtrip },
+        { "delta corrupt input", test_delta_corrupt },
+        { "delta baseline", test_delta_baseline },
+        { "bitpack ranged", test_bitpack_ranged },
+        { "bitpack quantized array", test_bitpack_quantized_array },
+        { "slot map generations", test_slotmap_generations },
+        { "timer wheel cascade", test_timer_cascade },
+    };
+
+    dream::dlog << "delta backend: " << dream::delta::backend() << " - bitpack backend: " << dream::bits::backend() << "\n";
+
+    failures = 0;
+    for(const Case& c : cases){
+        const int before = failures;
+        c.run();
+        dream::dlog << (failures == before ? "ok     " : "FAILED ") << c.name << "\n";
+    }
+    dream::dlog << failures << " failed checks\n";
+    dream::dlog.flush();
+
+    return failures;
+}
+
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+/*
+    Focused checks for the building blocks that the dual client / server test cannot reach
+    Run with:  test units
+    The delta and bitpack kernels are chosen at compile time - build once with -mavx2, once plain (sse2 on x86-64)
+    and once with -DDREAM_NO_SIMD to cover every backend
+*/
+
+namespace unit {
+
+int run_all(); // returns the number of failed checks
+
+}